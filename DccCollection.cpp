@@ -12,26 +12,20 @@
 #include <Arduino.h>
 #include "DccCollection.h"
 
-#define FILTER_KIND_UNKNOWN 		(0x0)
-#define FILTER_KIND_MF_SPEED_28 	(0x1)
-#define FILTER_KIND_MF_SPEED_128 	(0x2)
-#define FILTER_KIND_MF_F0_F4 		(0x3)
-#define FILTER_KIND_MF_F5_F8 		(0x4)
-#define FILTER_KIND_MF_F9_F12 		(0x5)
-#define FILTER_KIND_MF_F13_F20 		(0x6)
-#define FILTER_KIND_MF_F20_F28 		(0x7)
-#define FILTER_KIND_BA_OUTPUT 		(0x8)
-#define FILTER_KIND_EA_OUTPUT 		(0x9)
-
 DccStack::DccStack() {
 	top = NULL;
+	pushed = popped = minSize = 0;
+	exhausted = 0;
 }
 
 DccStack::DccStack(DccPacket* packet, byte count) {
+	pushed = popped = minSize = 0;
+	exhausted = 0;
 	if (packet == NULL || count <= 0) {
 		top = NULL;
 		return;
 	}
+	pushed = minSize = count;
 		
 	top = &packet[0];
 	for(int i = 1; i < count; ++i)
@@ -40,50 +34,95 @@ DccStack::DccStack(DccPacket* packet, byte count) {
 	packet[count-1].next = NULL;
 }
 
-byte DccStack::size() {
-	byte count = 0;
-	for(DccPacket* p = top; p != NULL; p = p->next)
-		++count;
+DccQueue::DccQueue() {
+	first = last = NULL;
+	added = taken = maxSize = 0;
+}
 
-	return count;	
+DccHeap::DccHeap(DccPacket* items[], byte capacity) 
+	: items(items), capacity(capacity), count(0) {
 }
 
-DccQueue::DccQueue() {
-	first = last = NULL;
+boolean DccHeap::add(DccPacket* packet, word deadline) {
+	if (count == capacity)
+		return false;
+
+	packet->deadline = deadline;
+	packet->next = NULL;
+	items[count] = packet;
+	siftUp(count++);
+	return true;
+}
+
+DccPacket* DccHeap::next() {
+	if (count == 0)
+		return NULL;
+
+	DccPacket* packet = items[0];
+	items[0] = items[--count];
+	siftDown(0);
+	return packet;
 }
 
-byte DccQueue::size() {
-	byte count = 0;
-	for(DccPacket* p = first; p != NULL; p = p->next)
-		++count;
+void DccHeap::siftUp(byte i) {
+	DccPacket* packet = items[i];
+	while (i > 0) {
+		byte parent = (i - 1) / 2;
+		if (!isBefore(packet, items[parent]))
+			break;
+		items[i] = items[parent];
+		i = parent;
+	}
+	items[i] = packet;
+}
+
+void DccHeap::siftDown(byte i) {
+	if (count == 0)
+		return;
 
-	return count;	
+	DccPacket* packet = items[i];
+	for (;;) {
+		word child = 2 * i + 1;
+		if (child >= count)
+			break;
+		if (child + 1 < count && isBefore(items[child + 1], items[child]))
+			++child;
+		if (!isBefore(items[child], packet))
+			break;
+		items[i] = items[child];
+		i = child;
+	}
+	items[i] = packet;
 }
 
-byte DccQueue::extractFilterKind(DccPacket* packet, boolean shortAddress) {
-	if (packet->isMultiFunction()) {
-		byte command = packet->dcc_data[shortAddress ? 1 : 2];
-		switch(command & DCC_MF_KIND3_MASK) {
-			case DCC_MF_KIND3_ADVANCED_OPERATION: 	return (command == DCC_MF_KIND8_SPEED_128) ? FILTER_KIND_MF_SPEED_128 : FILTER_KIND_UNKNOWN; 
-			case DCC_MF_KIND3_REVERSE_OPERATION:
-			case DCC_MF_KIND3_FORWARD_OPERATION: 	return FILTER_KIND_MF_SPEED_28;
-			case DCC_MF_KIND3_F0_F4: 				return FILTER_KIND_MF_F0_F4;
-			case DCC_MF_KIND3_F5_F12: 				return ((command & DCC_MF_KIND4_MASK) == DCC_MF_KIND4_F5_F8) ? FILTER_KIND_MF_F5_F8 : FILTER_KIND_MF_F9_F12;
-			case DCC_MF_KIND3_FUTURE_EXPANSION:		return (command == DCC_MF_KIND8_F13_F20) ? FILTER_KIND_MF_F13_F20 : (command == DCC_MF_KIND8_F21_F28) ? FILTER_KIND_MF_F20_F28 : FILTER_KIND_UNKNOWN;	
-			default:								return FILTER_KIND_UNKNOWN;
-		}	
-	} else if (packet->isBasicAccessory()) {
-		return packet->size() == 3 ? FILTER_KIND_BA_OUTPUT : FILTER_KIND_UNKNOWN;
-	} else if (packet->isExtendedAccessory()) {
-		return packet->size() == 4 ? FILTER_KIND_EA_OUTPUT : FILTER_KIND_UNKNOWN;
+// Only packets, that could substitute each other
+byte DccQueue::extractFilterKind(DccPacket* packet) {
+	byte kind = packet->kind();
+	switch(kind) {
+		case DCC_KIND_SPEED_28:
+		case DCC_KIND_SPEED_128:
+		case DCC_KIND_F0_F4:
+		case DCC_KIND_F5_F8:
+		case DCC_KIND_F9_F12:
+		case DCC_KIND_F13_F20:
+		case DCC_KIND_F21_F28:
+		case DCC_KIND_F29_F36:
+		case DCC_KIND_F37_F44:
+		case DCC_KIND_F45_F52:
+		case DCC_KIND_F53_F60:
+		case DCC_KIND_F61_F68:
+		case DCC_KIND_BINARY_STATE_SHORT:
+		case DCC_KIND_BINARY_STATE_LONG:
+		case DCC_KIND_BA_OUTPUT:
+		case DCC_KIND_EA_STATE:	return kind;
 	}
-	return FILTER_KIND_UNKNOWN;
+	return DCC_KIND_UNKNOWN;
 }
 
 boolean DccQueue::replaceSameKindPacket(DccPacket* packet, boolean resetRepeat) {
 	boolean shortAddress = packet->isAddressShort();
-	byte kind = extractFilterKind(packet, shortAddress);
-	if (kind == FILTER_KIND_UNKNOWN)
+	byte kind = extractFilterKind(packet);
+	if (kind == DCC_KIND_UNKNOWN)
 		return false;
 	
 	boolean broadcast = packet->isBroadcast();
@@ -93,28 +132,48 @@ boolean DccQueue::replaceSameKindPacket(DccPacket* packet, boolean resetRepeat)
 			continue;
 			
 		boolean qpShortAddress = qp->isAddressShort();	
-		if(kind != extractFilterKind(qp, qpShortAddress))
+		if(kind != extractFilterKind(qp))
 			continue;
 			
 		switch(kind) {
-			case FILTER_KIND_MF_SPEED_28: 
-			case FILTER_KIND_MF_F0_F4:
-			case FILTER_KIND_MF_F5_F8:
-			case FILTER_KIND_MF_F9_F12:
+			case DCC_KIND_SPEED_28: 
+			case DCC_KIND_F0_F4:
+			case DCC_KIND_F5_F8:
+			case DCC_KIND_F9_F12:
 							//broadcast address also short
 							if (!shortAddress && qp->dcc_data[1] != packet->dcc_data[1])
 								continue;
 							qp->dcc_data[qpShortAddress ? 1 : 2] = packet->dcc_data[shortAddress ? 1 : 2];
 							break;
-			case FILTER_KIND_MF_SPEED_128: 
-			case FILTER_KIND_MF_F13_F20: 
-			case FILTER_KIND_MF_F20_F28: 
+			case DCC_KIND_SPEED_128: 
+			case DCC_KIND_F13_F20: 
+			case DCC_KIND_F21_F28: 
+			case DCC_KIND_F29_F36:
+			case DCC_KIND_F37_F44:
+			case DCC_KIND_F45_F52:
+			case DCC_KIND_F53_F60:
+			case DCC_KIND_F61_F68:
 							//broadcast address also short
 							if (!shortAddress && qp->dcc_data[1] != packet->dcc_data[1])
 								continue;
 							qp->dcc_data[qpShortAddress ? 2 : 3] = packet->dcc_data[shortAddress ? 2 : 3];
 							break;
-			case FILTER_KIND_BA_OUTPUT: 
+			case DCC_KIND_BINARY_STATE_SHORT:
+			case DCC_KIND_BINARY_STATE_LONG: {
+							//broadcast address also short
+							if (!shortAddress && qp->dcc_data[1] != packet->dcc_data[1])
+								continue;
+							//only the same binary state number
+							byte* qpState = qp->dcc_data + (qpShortAddress ? 2 : 3);
+							byte* state = packet->dcc_data + (shortAddress ? 2 : 3);
+							if (((qpState[0] ^ state[0]) & DCC_MF_BINARY_STATE_MASK) != 0)
+								continue;
+							if (kind == DCC_KIND_BINARY_STATE_LONG && qpState[1] != state[1])
+								continue;
+							qpState[0] = state[0];
+							break;
+			}
+			case DCC_KIND_BA_OUTPUT: 
 							if (broadcast) {
 								if (((qp->dcc_data[1] ^ packet->dcc_data[1]) & DCC_BA_ADDRESS_PAIR_MASK) != 0)
 									continue;
@@ -126,7 +185,7 @@ boolean DccQueue::replaceSameKindPacket(DccPacket* packet, boolean resetRepeat)
 								continue;
 							qp->dcc_data[1] = packet->dcc_data[1];
 							break;
-			case FILTER_KIND_EA_OUTPUT: 
+			case DCC_KIND_EA_STATE: 
 							if (!broadcast && qp->dcc_data[1] != packet->dcc_data[1])
 								continue;
 							qp->dcc_data[2] = packet->dcc_data[2];
@@ -134,6 +193,7 @@ boolean DccQueue::replaceSameKindPacket(DccPacket* packet, boolean resetRepeat)
 			default: 		
 							continue;
 		}
+		qp->updateErrorByte();
 		changed = true;
 		if (resetRepeat)
 			qp->resetRepeat();
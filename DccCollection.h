@@ -15,11 +15,17 @@
 #include <Arduino.h>
 #include "DccPacket.h"
 
+// add() and push() are called from loop(), next() from the interrupt. Each side changes only
+// its own counter, and loop() calls next() only with the interrupts off. The counters are
+// volatile single bytes, so the other side always reads the current value atomically.
 class DccQueue {
 	
 private:
 	DccPacket* 		 first;
 	DccPacket* 		 last;
+	volatile byte	 added;
+	volatile byte	 taken;
+	volatile byte	 maxSize;
 	
 public:
 	DccQueue();
@@ -33,6 +39,10 @@ public:
 	
 	byte 		size();
 	boolean 	isEmpty();
+
+	// The largest size since the construction or the reset
+	byte 		highWater();
+	void 		resetHighWater();
 	
 	//If provided packet has the same address (of if specified command is broadcast) and same command (Speed, Function, Accessory Output)
 	//Then command will be substituted, with provided one
@@ -40,14 +50,21 @@ public:
 	boolean 	replaceSameKindPacket(DccPacket* packet, boolean resetRepeat);
 	
 private:
-	byte 		extractFilterKind(DccPacket* packet, boolean shortAddress);
+	byte 		extractFilterKind(DccPacket* packet);
 };
 
+// Sent packets are pushed back from the interrupt, and pop() is called from loop() only.
+// pop() turns the interrupts off for itself, push() from loop() needs the interrupts off.
+// The counters are volatile, exhaustedCount() is a word and is read with the interrupts off.
 class DccStack {
 	
 private:
 
 	DccPacket* top;
+	volatile byte	pushed;
+	volatile byte	popped;
+	volatile byte	minSize;
+	volatile word	exhausted;
 	
 public:
 	DccStack();
@@ -60,6 +77,11 @@ public:
 	
 	byte 		size();
 	boolean 	isEmpty();
+
+	// The smallest size since the construction or the reset, and the count of pop() from the empty stack
+	byte 		lowWater();
+	word 		exhaustedCount();
+	void 		resetLowWater();
 };
 
 
@@ -68,6 +90,10 @@ inline void DccQueue::push(DccPacket* packet) {
 	first = packet;
 	if (last == NULL)
 		last = first;
+
+	++added;
+	if (size() > maxSize)
+		maxSize = size();
 }
 
 inline void DccQueue::add(DccPacket* packet) {
@@ -82,6 +108,10 @@ inline void DccQueue::add(DccPacket* packet) {
 	last = packet;
 	if (first == NULL)
 		first = last;
+
+	++added;
+	if (size() > maxSize)
+		maxSize = size();
 }
 
 inline DccPacket* DccQueue::next() {
@@ -90,6 +120,7 @@ inline DccPacket* DccQueue::next() {
 		first = packet->next;
 		if (packet == last)
 			last = NULL;
+		++taken;
 	}
 	return packet;
 }
@@ -106,9 +137,22 @@ inline boolean DccQueue::isEmpty() {
 	return first == NULL;
 }
 
+inline byte DccQueue::size() {
+	return added - taken;
+}
+
+inline byte DccQueue::highWater() {
+	return maxSize;
+}
+
+inline void DccQueue::resetHighWater() {
+	maxSize = size();
+}
+
 inline void DccStack::push(DccPacket* packet) {
 	packet->next = top;
 	top = packet;
+	++pushed;
 }
 
 inline DccPacket* DccStack::getTop() {
@@ -116,10 +160,20 @@ inline DccPacket* DccStack::getTop() {
 }
 
 inline DccPacket* DccStack::pop() {
+	noInterrupts();
 	DccPacket* packet = top;
-	if (packet != NULL)
+	if (packet != NULL) {
 		top = packet->next;
-		
+		++popped;
+	}
+	interrupts();
+
+	if (packet == NULL) {
+		++exhausted;
+		return NULL;
+	}
+	if (size() < minSize)
+		minSize = size();
 	return packet;
 }
 
@@ -127,6 +181,79 @@ inline boolean DccStack::isEmpty() {
 	return top == NULL;
 }
 
+inline byte DccStack::size() {
+	return pushed - popped;
+}
+
+inline byte DccStack::lowWater() {
+	return minSize;
+}
+
+inline word DccStack::exhaustedCount() {
+	return exhausted;
+}
+
+inline void DccStack::resetLowWater() {
+	minSize = size();
+	exhausted = 0;
+}
+
+
+// Packets ordered by the deadline, the earliest first. The heap keeps pointers
+// in the provided array, so it holds at most capacity packets. Deadlines are
+// compared as the wrapping millis, so they have to be within 32 seconds.
+// Packets with the same deadline leave in any order.
+class DccHeap {
+
+private:
+	DccPacket**	items;
+	byte		capacity;
+	byte		count;
+
+public:
+	DccHeap(DccPacket* items[], byte capacity);
+
+	// Returns false, when the heap is full
+	boolean 	add(DccPacket* packet, word deadline);
+	DccPacket* 	next();
+
+	DccPacket* 	getFirst();
+	
+	byte 		size();
+	boolean 	isEmpty();
+	boolean 	isFull();
+
+	// Deadline of the first packet has come
+	boolean 	isDue(word now);
+
+private:
+	static boolean isBefore(DccPacket* packet, DccPacket* than);
+	void 		siftUp(byte i);
+	void 		siftDown(byte i);
+};
+
+inline DccPacket* DccHeap::getFirst() {
+	return count > 0 ? items[0] : NULL;
+}
+
+inline byte DccHeap::size() {
+	return count;
+}
+
+inline boolean DccHeap::isEmpty() {
+	return count == 0;
+}
+
+inline boolean DccHeap::isFull() {
+	return count == capacity;
+}
 
+inline boolean DccHeap::isDue(word now) {
+	return count > 0 && (int16_t)(now - items[0]->deadline) >= 0;
+}
+
+inline boolean DccHeap::isBefore(DccPacket* packet, DccPacket* than) {
+	return (int16_t)(packet->deadline - than->deadline) < 0;
+}
 
 #endif //__DCC_QUEUE_H__
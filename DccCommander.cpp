@@ -15,20 +15,52 @@
 #include "DccProtocol.h"
 #include "DccStateKeeper.h"
 
+#if DCC_SCHEDULE_RESERVE_COUNT <= DCC_STATE_PACKET_MAX_COUNT || DCC_SCHEDULE_RESERVE_COUNT >= DCC_QUEUE_MAX_COUNT
+#error DCC_SCHEDULE_RESERVE_COUNT has to fit the refresh of one state and leave packets for the batches
+#endif
+
+// Same CRC-8 as the state log
+#define DCC_SNAPSHOT_CRC_INIT	(0xFF)
+
+// Longest result lines with the terminator. U: 5 names (40 chars) and percents up to 100.
+// I: "S=" and 9 more names (" X="), 5 unsigned long (10 digits), 3 words (5 digits),
+// 4 bytes (3 digits) of Q and P with their '/'.
+#define DCC_TRAFFIC_LINE_MAX	(40 + 5 * 3 + 1)
+#define DCC_STATISTICS_LINE_MAX	(2 + 9 * 3 + 5 * 10 + 3 * 5 + 4 * 3 + 2 + 1)
+
+static_assert(DCC_TRAFFIC_LINE_MAX <= DCC_REPLY_LINE_SIZE && DCC_STATISTICS_LINE_MAX <= DCC_REPLY_LINE_SIZE,
+	"DCC_REPLY_LINE_SIZE has to fit the U and I lines");
+
 DccCommander DccCmd;
 
 DccPacket	 IDLE;
 
 DccPacket	 heap[DCC_QUEUE_MAX_COUNT];
 
+DccPacket*	 timed[DCC_QUEUE_MAX_COUNT];
+
 const char* DccCommander::ACKNOWLEDGE 	= "Acknowledge";
 const char* DccCommander::QUEUED 		= "Queued";
 const char* DccCommander::ERROR     	= "ERROR";
 const char* DccCommander::UNKNOWN     	= "UNKNOWN";
 
 DccCommander::DccCommander() 
-	:	recycle(heap, DCC_QUEUE_MAX_COUNT) {
+	:	recycle(heap, DCC_QUEUE_MAX_COUNT),
+		scheduled(timed, DCC_QUEUE_MAX_COUNT) {
 	IDLE.idle();
+	traceHandler = NULL;
+	tracing = false;
+	traceHead = traceTail = 0;
+	traceLost = 0;
+	cvJobTurn = false;
+	importing = false;
+	memset((void*) trafficBits, 0, sizeof(trafficBits));
+	memset(trafficWindows, 0, sizeof(trafficWindows));
+	trafficWindow = 0;
+	trafficStart = 0;
+	sentCount = repeatCount = idleCount = 0;
+	loopCount = loopRate = 0;
+	errorCount = 0;
 }
 
 void DccCommander::begin() {
@@ -38,63 +70,327 @@ void DccCommander::begin() {
 }
 
 void DccCommander::loop() {
+	traceLoop();
+	trafficLoop();
+	DccState.loop();
+
+	word now = millis();
+	while (scheduled.isDue(now))
+		send(scheduled.next());
+
 	if (!queue.isEmpty())
 		return;
+
+	// States are restored first after power on
+	if (DccState.isRestoring()) {
+		readNextState();
+		return;
+	}
+
+	cvJobTurn = !cvJobTurn && cvJob.isPending();
+	if (cvJobTurn) {
+		DccPacket* packet = cvJob.nextPacket(recycle);
+		if (packet != NULL) {
+			packet->traffic = DCC_TRAFFIC_SERVICE;
+			queue.add(packet);
+			return;
+		}
+	}
 		
-	DccState.readNextState(queue, recycle);
+	readNextState();
+}
+
+// Refresh packets are tagged before the interrupt could take them
+void DccCommander::readNextState() {
+	DccQueue batch;
+	DccState.readNextState(batch, recycle);
+	while (!batch.isEmpty()) {
+		DccPacket* packet = batch.next();
+		packet->traffic = DCC_TRAFFIC_REFRESH;
+		queue.add(packet);
+	}
 }
 
 // P0  - power off
 // P1  - power on
+// T0  - trace off
+// T1  - trace on
 // RA  - reset All
 // RQ  - reset Queue
 // RS  - reset Speed State
+// JC  - cancel CV job
+// JXX...XX - CV job: "Jm3W1D3W29D34"
+// SX  - export state snapshot
+// SB  - begin state import
+// SRXX...XX - import state record
+// SCXXXXYY  - end state import
+// U   - rail utilization
+// I   - statistics
 // HXX...XX - DCC Hex Command
 // mXX...XX - DCC Text Command
 // MXX...XX - DCC Text Command
 // BXX...XX - DCC Text Command
 // EXX...XX - DCC Text Command
+// DNNNNN;XX...XX - Delayed packet commands: "D1500;M3f10"
+// Packet commands could be batched: "M3f10;M3A10000;H0312345678"
 const char* DccCommander::handleTextCommand(const char* command) {
+	return handleTextCommand(command, NULL);
+}
+
+const char* DccCommander::handleTextCommand(const char* command, Print* reply) {
+	const char* result = handleTextResult(command, reply);
+	if (result == ERROR || result == UNKNOWN)
+		++errorCount;
+	return result;
+}
+
+const char* DccCommander::handleTextResult(const char* command, Print* reply) {
 	switch(*command) {
 		case 'P': power(DccPacket::parseBoolean(*(command + 1))); return ACKNOWLEDGE; 
+		case 'T': trace(DccPacket::parseBoolean(*(command + 1))); return ACKNOWLEDGE; 
 		case 'R': switch(*(command+1)) {
 					case 'A': resetAll(); return ACKNOWLEDGE;
 					case 'Q': resetQueue(); return ACKNOWLEDGE;
 					case 'S': resetSpeedStates(); return ACKNOWLEDGE;
 				};
 				break;
-		case 'H': {
-				DccPacket* packet = newPacket();
-				if (packet == NULL)
-					return ERROR;
-					
-				packet = packet->parseDccHexCommand(command + 1);
-				if (packet == NULL)
-					return UNKNOWN;
-					
-				send(packet);
-				return QUEUED;
-				};
+		case 'J': return handleTextCvJob(command + 1);
+		case 'S': return handleTextSnapshot(command + 1, reply);
+		case 'D': return handleTextDelay(command + 1);
+		case 'U': return handleTextTraffic();
+		case 'I': return handleTextStatistics();
+		case 'H':				
 		case 'm':				
 		case 'M':				
 		case 'B':				
-		case 'E': {
-				DccPacket* packet = newPacket();
-				if (packet == NULL)
-					return ERROR;
-					
-				packet = packet->parseDccTextCommand(command);
-				if (packet == NULL)
-					return UNKNOWN;
-					
-				send(packet);
-				return QUEUED;
-				};
+		case 'E': return handleTextBatch(command, 0);
 	}
 	return UNKNOWN;
 }
 
+byte DccCommander::handleTextPipeline(const char* commands, char separator, Print& reply) {
+	char command[DCC_LINE_MAX_SIZE + 1];
+	byte count = 0;
+	
+	while (*commands) {
+		byte length = 0;
+		boolean tooLong = false;
+		for (; *commands && *commands != separator; ++commands) {
+			if (length < DCC_LINE_MAX_SIZE)
+				command[length++] = *commands;
+			else
+				tooLong = true;
+		}
+		if (*commands)
+			++commands;
+		if (length == 0)
+			continue;
+		command[length] = '\0';
+
+		const char* result = ERROR;
+		if (tooLong)
+			++errorCount;
+		else
+			result = handleTextCommand(command, &reply);
+		
+		char code = statusCode(result);
+		if (code)
+			reply.println(code);
+		else
+			reply.println(result);
+		++count;
+	}
+	return count;
+}
+
+char DccCommander::statusCode(const char* result) {
+	if (result == ACKNOWLEDGE)	return DCC_STATUS_ACKNOWLEDGE;
+	if (result == QUEUED)		return DCC_STATUS_QUEUED;
+	if (result == ERROR)		return DCC_STATUS_ERROR;
+	if (result == UNKNOWN)		return DCC_STATUS_UNKNOWN;
+	return 0;
+}
+
+// Parse all packet commands of the batch into the packets taken from recycle stack first,
+// and only when every command is parsed, send them all. Otherwise return packets back.
+const char* DccCommander::handleTextBatch(const char* command, word delayMs) {
+	DccQueue 	batch;
+	const char* result = QUEUED;
+	byte		reserve = delayMs > 0 ? DCC_SCHEDULE_RESERVE_COUNT : 0;
+	
+	for(;;) {
+		if (recycle.size() <= reserve) {
+			result = ERROR;
+			break;
+		}
+		DccPacket* packet = parsePacketCommand(command);
+		if (packet == NULL) {
+			result = UNKNOWN;
+			break;
+		}
+		batch.add(packet);
+		
+		// Successfully parsed command stops at the terminator
+		if (*command != DCC_COMMAND_SEPARATOR || DccPacket::isTerminator(*(++command)))
+			break;
+	}
+	
+	if (result != QUEUED) {
+		while(!batch.isEmpty())
+			recyclePacket(batch.next());
+		return result;
+	}
+	
+	while(!batch.isEmpty())
+		schedule(batch.next(), delayMs);
+		
+	return QUEUED;
+}
+
+const char* DccCommander::handleTextDelay(const char* command) {
+	word delayMs = 0;
+	if (!DccPacket::isDigit(*command) || DccPacket::parseNumber(command, DCC_SCHEDULE_MAX_MS, delayMs) != DCC_PARSE_OK)
+		return ERROR;
+	if (*command != DCC_COMMAND_SEPARATOR)
+		return UNKNOWN;
+	return handleTextBatch(command + 1, delayMs);
+}
+
+const char* DccCommander::handleTextCvJob(const char* command) {
+	if (*command == 'C') {
+		cvJob.cancel();
+		return ACKNOWLEDGE;
+	}
+	if (cvJob.isPending())
+		return ERROR;
+
+	return cvJob.parse(command) == DCC_PARSE_OK ? QUEUED : UNKNOWN;
+}
+
+const char* DccCommander::handleTextSnapshot(const char* command, Print* reply) {
+	switch(*command) {
+		case 'X': return exportSnapshot(reply);
+		case 'B': 
+			DccState.beginImport();
+			importing = true;
+			importCount = 0;
+			importCrc = DCC_SNAPSHOT_CRC_INIT;
+			return ACKNOWLEDGE;
+		case 'R': 
+		case 'C': 
+			if (!importing)
+				return ERROR;
+			return importSnapshot(command);
+	}
+	return UNKNOWN;
+}
+
+static void printHex(byte value, Print* out) {
+	out->print("0123456789ABCDEF"[value >> 4]);
+	out->print("0123456789ABCDEF"[value & 0xF]);
+}
+
+// Parses hex bytes up to the terminator, returns the count or 0xFF for the invalid hex
+static byte parseHexBytes(const char* s, byte* data, byte max) {
+	byte count = 0;
+	for (; !DccPacket::isTerminator(*s); s += 2, ++count) {
+		if (count == max || !DccPacket::isHex(s[0]) || !DccPacket::isHex(s[1]))
+			return 0xFF;
+		data[count] = (DccPacket::parseHex(s[0]) << 4) | DccPacket::parseHex(s[1]);
+	}
+	return count;
+}
+
+const char* DccCommander::exportSnapshot(Print* reply) {
+	if (reply == NULL)
+		return ERROR;
+
+	byte data[DCC_STATE_RECORD_MAX_SIZE];
+	byte crc 	= DCC_SNAPSHOT_CRC_INIT;
+	word count 	= 0;
+	DccStateSlot cursor = DccState.exportFirst();
+	while (cursor != DCC_STATE_NONE) {
+		byte size = DccState.exportState(cursor, data);
+		if (size == 0)
+			continue;
+
+		byte line = DCC_SNAPSHOT_CRC_INIT;
+		reply->print("SR");
+		for (byte i = 0; i < size; ++i) {
+			printHex(data[i], reply);
+			line = DccStateKeeper::crc8(line, data[i]);
+			crc  = DccStateKeeper::crc8(crc, data[i]);
+		}
+		printHex(line, reply);
+		reply->println();
+		++count;
+	}
+	reply->print("SC");
+	printHex(count >> 8, reply);
+	printHex(count & 0xFF, reply);
+	printHex(crc, reply);
+	reply->println();
+	return ACKNOWLEDGE;
+}
+
+const char* DccCommander::importSnapshot(const char* command) {
+	byte data[DCC_STATE_RECORD_MAX_SIZE + 1];
+	byte size = parseHexBytes(command + 1, data, sizeof(data));
+
+	if (*command == 'C') {
+		importing = false;
+		if (size != 3 || word(data[0] << 8 | data[1]) != importCount || data[2] != importCrc) {
+			DccState.endImport(false);
+			return ERROR;
+		}
+		DccState.endImport(true);
+		DccState.restore();
+		return ACKNOWLEDGE;
+	}
+
+	if (size == 0xFF || size == 0)
+		return ERROR;
+
+	// Last byte is CRC of the record
+	byte line = DCC_SNAPSHOT_CRC_INIT;
+	for (byte i = 0; i < size; ++i)
+		line = DccStateKeeper::crc8(line, data[i]);
+	if (line != 0 || !DccState.importState(data, size - 1))
+		return ERROR;
+
+	for (byte i = 0; i < size - 1; ++i)
+		importCrc = DccStateKeeper::crc8(importCrc, data[i]);
+	++importCount;
+	return ACKNOWLEDGE;
+}
+
+DccPacket* DccCommander::parsePacketCommand(const char*& command) {
+	DccPacket* packet = newPacket();
+	byte result = DCC_PARSE_UNKNOWN_ADDRESS;
+	switch(*command) {
+		case 'H': result = packet->parseDccHex(++command); break;
+		case 'm':				
+		case 'M':				
+		case 'B':				
+		case 'E': result = packet->parseDccText(command); break;
+	}
+	if (result == DCC_PARSE_OK)
+		return packet;
+
+	recyclePacket(packet);
+	return NULL;
+}
+
 DccPacket* DccCommander::nextPacketToSend(DccPacket* sent) {
+	DccPacket* packet = selectPacketToSend(sent);
+	trafficCount(packet, sent);
+	if (tracing)
+		tracePacket(packet);
+
+	return packet;
+}
+
+DccPacket* DccCommander::selectPacketToSend(DccPacket* sent) {
 	if (sent != NULL && sent != &IDLE) {
 	 	if (sent->decrementRepeat())
 			return sent;
@@ -110,21 +406,34 @@ DccPacket* DccCommander::nextPacketToSend(DccPacket* sent) {
 }
 
 void DccCommander::returnBack(DccPacket* unprocessed) {
-	if (unprocessed != &IDLE)
+	if (unprocessed != NULL && unprocessed != &IDLE)
 		queue.push(unprocessed);
 }
 
 void DccCommander::send(DccPacket* packet) {
+	packet->traffic = DCC_TRAFFIC_COMMAND;
 	DccState.saveState(packet);
 	queue.add(packet);
 }
 
+// Heap has room for every packet of the pool, so add() fails only for the foreign packet
+void DccCommander::schedule(DccPacket* packet, word delayMs) {
+	if (delayMs == 0 || !scheduled.add(packet, (word) millis() + delayMs))
+		send(packet);
+}
+
 boolean DccCommander::power() {
 	return DccRails.power();
 }
 
+// States are restored only when the rails are switched on, a repeated P1 keeps the refresh order
 void DccCommander::power(boolean on) {
+	boolean wasOn = DccRails.power();
 	DccRails.power(on);
+	if (!on)
+		DccState.flush();
+	else if (!wasOn)
+		DccState.restore();
 }
 
 void DccCommander::resetAll() {
@@ -134,15 +443,201 @@ void DccCommander::resetAll() {
 	power(true);
 }
 
+// The interrupt takes from the queue and pushes to the recycle stack too
 void DccCommander::resetQueue() {
+	cvJob.cancel();
+	noInterrupts();
 	while(!queue.isEmpty())
 		recycle.push(queue.next());
+	while(!scheduled.isEmpty())
+		recycle.push(scheduled.next());
+	interrupts();
+}
+
+void DccCommander::recyclePacket(DccPacket* packet) {
+	noInterrupts();
+	recycle.push(packet);
+	interrupts();
 }
 
 void DccCommander::resetSpeedStates() {
 	DccState.resetSpeed();
 }
 
+DccCvJob* DccCommander::newCvJob() {
+	return cvJob.isPending() ? NULL : &cvJob;
+}
+
+boolean DccCommander::cvJobPending() {
+	return cvJob.isPending();
+}
+
+void DccCommander::trace(DccTraceHandler handler) {
+	tracing = false;
+	traceHandler = handler;
+	traceTail = traceHead;
+	tracing = (handler != NULL);
+}
+
+void DccCommander::trace(boolean on) {
+	tracing = on && (traceHandler != NULL);
+}
+
+// Word counter of the interrupt is read with the interrupts off
+word DccCommander::traceLostCount() {
+	noInterrupts();
+	word lost = traceLost;
+	interrupts();
+	return lost;
+}
+
+// Called from the interrupt
+void DccCommander::tracePacket(DccPacket* packet) {
+	byte head = traceHead;
+	byte next = (head + 1) % DCC_TRACE_BUFFER_COUNT;
+	if (next == traceTail) {
+		++traceLost;
+		return;
+	}
+	traceBuffer[head] = *packet;
+	traceHead = next;
+}
 
+void DccCommander::traceLoop() {
+	DccTraceHandler handler = traceHandler;
+	while (traceTail != traceHead) {
+		if (handler != NULL)
+			handler(&traceBuffer[traceTail]);
+		traceTail = (traceTail + 1) % DCC_TRACE_BUFFER_COUNT;
+	}
+}
+
+// Called from the interrupt. Preamble, start bit and 8 bits of every byte, end bit.
+// Repeats of the refresh and CV job packets stay in their category.
+void DccCommander::trafficCount(DccPacket* packet, DccPacket* sent) {
+	byte category = packet->traffic;
+	++sentCount;
+	if (packet == &IDLE) {
+		category = DCC_TRAFFIC_IDLE;
+		++idleCount;
+	} else if (packet == sent) {
+		++repeatCount;
+		if (category == DCC_TRAFFIC_COMMAND)
+			category = DCC_TRAFFIC_REPEAT;
+	}
+	trafficBits[category] += DCC_PREAMBULE_SIZE + 9 * packet->size() + 1;
+}
+
+void DccCommander::trafficLoop() {
+	++loopCount;
+	unsigned long now = millis();
+	if (now - trafficStart < DCC_TRAFFIC_WINDOW_MS)
+		return;
+	loopRate = loopCount * 1000 / (now - trafficStart);
+	loopCount = 0;
+	trafficStart = now;
+
+	unsigned long bits[DCC_TRAFFIC_COUNT];
+	noInterrupts();
+	for (byte i = 0; i < DCC_TRAFFIC_COUNT; ++i) {
+		bits[i] = trafficBits[i];
+		trafficBits[i] = 0;
+	}
+	interrupts();
 
+	// The shares of the categories are kept, when the late window doesn't fit
+	unsigned long largest = 0;
+	for (byte i = 0; i < DCC_TRAFFIC_COUNT; ++i)
+		if (bits[i] > largest)
+			largest = bits[i];
+	byte shift = 0;
+	while ((largest >> shift) > 0xFFFF)
+		++shift;
 
+	word* window = trafficWindows[trafficWindow];
+	for (byte i = 0; i < DCC_TRAFFIC_COUNT; ++i)
+		window[i] = bits[i] >> shift;
+	trafficWindow = (trafficWindow + 1) % DCC_TRAFFIC_WINDOW_COUNT;
+}
+
+byte DccCommander::trafficPercent(byte category) {
+	unsigned long bits = 0;
+	unsigned long total = 0;
+	for (byte w = 0; w < DCC_TRAFFIC_WINDOW_COUNT; ++w) {
+		for (byte i = 0; i < DCC_TRAFFIC_COUNT; ++i)
+			total += trafficWindows[w][i];
+		bits += trafficWindows[w][category];
+	}
+	return total == 0 ? 0 : (bits * 100 + total / 2) / total;
+}
+
+static char* printText(char* s, const char* text) {
+	while (*text)
+		*s++ = *text++;
+	return s;
+}
+
+static char* printNumber(char* s, unsigned long value) {
+	char digits[10];
+	byte count = 0;
+	do {
+		digits[count++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	while (count)
+		*s++ = digits[--count];
+	return s;
+}
+
+const char* DccCommander::handleTextTraffic() {
+	static const char* names[DCC_TRAFFIC_COUNT] = {"idle=", " command=", " repeat=", " refresh=", " service="};
+	char* s = replyLine;
+	for (byte i = 0; i < DCC_TRAFFIC_COUNT; ++i) {
+		s = printText(s, names[i]);
+		s = printNumber(s, trafficPercent(i));
+	}
+	*s = '\0';
+	return replyLine;
+}
+
+const char* DccCommander::handleTextStatistics() {
+	noInterrupts();
+	unsigned long sent 		= sentCount;
+	unsigned long repeats 	= repeatCount;
+	unsigned long idles 	= idleCount;
+	word lost 				= traceLost;
+	byte queued				= queue.size();
+	byte queuedMax			= queue.highWater();
+	byte pool				= recycle.size();
+	byte poolMin			= recycle.lowWater();
+	word exhausted			= recycle.exhaustedCount();
+	interrupts();
+
+	char* s = replyLine;
+	s = printText(s, "S=");
+	s = printNumber(s, sent);
+	s = printText(s, " R=");
+	s = printNumber(s, repeats);
+	s = printText(s, " I=");
+	s = printNumber(s, idles);
+	s = printText(s, " Q=");
+	s = printNumber(s, queued);
+	s = printText(s, "/");
+	s = printNumber(s, queuedMax);
+	s = printText(s, " P=");
+	s = printNumber(s, pool);
+	s = printText(s, "/");
+	s = printNumber(s, poolMin);
+	s = printText(s, " X=");
+	s = printNumber(s, exhausted);
+	s = printText(s, " W=");
+	s = printNumber(s, DccState.writeCount());
+	s = printText(s, " E=");
+	s = printNumber(s, errorCount);
+	s = printText(s, " L=");
+	s = printNumber(s, loopRate);
+	s = printText(s, " T=");
+	s = printNumber(s, lost);
+	*s = '\0';
+	return replyLine;
+}
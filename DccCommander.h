@@ -15,11 +15,64 @@
 #include <Arduino.h>
 #include "DccPacket.h"
 #include "DccCollection.h"
+#include "DccConfig.h"
+#include "DccCvJob.h"
+
+// Longest delay of the scheduled packet, deadlines are kept in word millis
+#define DCC_SCHEDULE_MAX_MS		(30000)
+
+// Traffic categories of the transmitted packets
+#define DCC_TRAFFIC_IDLE		(0)
+#define DCC_TRAFFIC_COMMAND		(1)
+#define DCC_TRAFFIC_REPEAT		(2)
+#define DCC_TRAFFIC_REFRESH		(3)
+#define DCC_TRAFFIC_SERVICE		(4)
+#define DCC_TRAFFIC_COUNT		(5)
+
+// Compact status codes of the pipelined commands, see handleTextPipeline(..)
+#define DCC_STATUS_ACKNOWLEDGE	('A')
+#define DCC_STATUS_QUEUED		('Q')
+#define DCC_STATUS_ERROR		('E')
+#define DCC_STATUS_UNKNOWN		('U')
+
+typedef void (*DccTraceHandler)(DccPacket* packet);
 
 class DccCommander {
 private:
 	DccStack	recycle;
 	DccQueue 	queue;
+	DccHeap		scheduled;
+
+	DccCvJob	cvJob;
+	boolean		cvJobTurn;
+
+	boolean		importing;
+	word		importCount;
+	byte		importCrc;
+
+	DccTraceHandler	traceHandler;
+	volatile boolean tracing;
+	DccPacket		traceBuffer[DCC_TRACE_BUFFER_COUNT];
+	volatile byte	traceHead;
+	volatile byte	traceTail;
+	volatile word	traceLost;
+
+	// Bits of the current window are counted in the interrupt. The window is as long
+	// as loop() is late, and it is scaled down to fit the word counts of the windows.
+	volatile unsigned long	trafficBits[DCC_TRAFFIC_COUNT];
+	word			trafficWindows[DCC_TRAFFIC_WINDOW_COUNT][DCC_TRAFFIC_COUNT];
+	byte			trafficWindow;
+	unsigned long	trafficStart;
+
+	// Packets are counted in the interrupt, loops and errors in loop()
+	volatile unsigned long	sentCount;
+	volatile unsigned long	repeatCount;
+	volatile unsigned long	idleCount;
+	unsigned long	loopCount;
+	unsigned long	loopRate;
+	word			errorCount;
+
+	char			replyLine[DCC_REPLY_LINE_SIZE];
 
 public:
 	DccCommander();
@@ -38,25 +91,99 @@ public:
 
 	DccPacket*  newPacket();
 	void 		send(DccPacket*);
+
+	// Packet is sent, when delay (up to DCC_SCHEDULE_MAX_MS) is over. Earliest deadline goes first.
+	// Scheduled packets should leave DCC_SCHEDULE_RESERVE_COUNT packets of the pool free.
+	void 		schedule(DccPacket* packet, word delayMs);
 	
 	// P0  - power off
 	// P1  - power on
+	// T0  - trace off
+	// T1  - trace on
 	// RQ  - reset Queue
 	// RSA - reset All States
 	// RSS - reset Speed State
+	// JC  - cancel CV job
+	// JXX...XX - CV job, see DccCvJob::parse(..) function description.
+	// SX  - export state snapshot, requires reply: one SR line per state and SC line
+	// SB  - begin state import, the imported states replace all the states
+	// SRXX...XX - import state: packed state record and CRC-8 of the record, in hex
+	// SCXXXXYY  - end state import: state count (XXXX) and CRC-8 (YY) of all the records, in hex.
+	//             The states before SB are read back from the storage, when the import doesn't match.
+	//             The storage is not written between SB and SC.
+	// U   - rail utilization: "idle=40 command=10 repeat=15 refresh=30 service=5", see trafficPercent(..)
+	// I   - statistics: "S=1200 R=2400 I=300 Q=2/7 P=18/9 X=0 W=12 E=1 L=25000 T=0"
+	//       S - packets sent, R - repeats, I - idle packets, Q - queue size/largest size,
+	//       P - free packets/fewest free packets, X - packet pool exhausted, W - state log writes,
+	//       E - failed text commands, L - loop() calls per second, T - trace lost packets
+	//       U and I results are kept in one buffer, valid until the next command.
 	// HXX...XX - DCC Hex Command
 	// mXX...XX - DCC Text Command. See DccPacket::parseDccTextCommand(..) function description.
 	// MXX...XX - DCC Text Command. See DccPacket::parseDccTextCommand(..) function description.
 	// BXX...XX - DCC Text Command. See DccPacket::parseDccTextCommand(..) function description.
 	// EXX...XX - DCC Text Command. See DccPacket::parseDccTextCommand(..) function description.
+	// DNNNNN;XX...XX - Packet commands sent after the delay of NNNNN milliseconds (decimal).
+	//                  Error, when the batch would take the DCC_SCHEDULE_RESERVE_COUNT packets.
+	//
+	// Packet commands (H, m, M, B, E) could be batched in one line, separated by DCC_COMMAND_SEPARATOR.
+	// The batch is all or nothing: either every packet is queued, or none of them.
 	const char*  handleTextCommand(const char* command);
+
+	// Commands with more than a result line (SX) print the lines to reply first
+	const char*  handleTextCommand(const char* command, Print* reply);
+
+	// Several commands in one request, separated by the separator: "/M3f10/M5F0;M5f20/U" with '/'.
+	// Every command is answered in order with a reply line: status code (DCC_STATUS_XXX)
+	// or the result text (U, I). Empty commands are skipped, commands longer than
+	// DCC_LINE_MAX_SIZE fail. Returns the count of the answered commands.
+	byte  		 handleTextPipeline(const char* commands, char separator, Print& reply);
 	
+	// Power on restores all the states on the rails, power off writes them to the storage
 	boolean power();
 	void 	power(boolean on);
 
 	void	resetAll();
 	void	resetQueue();
 	void	resetSpeedStates();
+
+	// Operations Mode programming of the whole decoder profile.
+	// Job instructions are sent only when queue is empty, taking turns with the state refresh,
+	// so the trains keep running. newCvJob() returns NULL while the previous job is pending,
+	// otherwise the job to be filled with DccCvJob::start(..) and add(..).
+	DccCvJob*	newCvJob();
+	boolean		cvJobPending();
+
+	// Every transmitted packet (including repeats and idle) is copied in the interrupt,
+	// and passed to the handler from loop(). DccDisassembler could be used to log it.
+	// Packets that don't fit into DCC_TRACE_BUFFER_COUNT are counted as lost.
+	void	trace(DccTraceHandler handler);
+	void	trace(boolean on);
+	word	traceLostCount();
+
+	// Percent of the bits transmitted in the last DCC_TRAFFIC_WINDOW_COUNT windows by the category:
+	// idle packets, new commands, their repeats, state refresh and CV jobs.
+	byte	trafficPercent(byte category);
+
+private:
+	DccPacket*	selectPacketToSend(DccPacket* sent);
+	void		tracePacket(DccPacket* packet);
+	void		traceLoop();
+	void		trafficCount(DccPacket* packet, DccPacket* sent);
+	void		trafficLoop();
+	void		readNextState();
+	void		recyclePacket(DccPacket* packet);
+
+	const char* handleTextResult(const char* command, Print* reply);
+	static char statusCode(const char* result);
+	const char* handleTextBatch(const char* command, word delayMs);
+	const char* handleTextDelay(const char* command);
+	const char* handleTextCvJob(const char* command);
+	const char* handleTextSnapshot(const char* command, Print* reply);
+	const char* exportSnapshot(Print* reply);
+	const char* importSnapshot(const char* command);
+	const char* handleTextTraffic();
+	const char* handleTextStatistics();
+	DccPacket*  parsePacketCommand(const char*& command);
 };
 
 extern DccCommander DccCmd;
@@ -25,20 +25,137 @@
 // DCC set it minimum to 14
 #define DCC_PREAMBULE_SIZE (15)
 
+// RAM of the board in KB: ATmega168 has 1 KB, ATmega328P 2 KB, Teensy 3.0 16 KB.
+// Tables below are smaller on the small boards, so the sketch and its network stack fit.
+// Could be set by the build, e.g. -DDCC_RAM_KB=1 runs the host tests with the ATmega168 tables.
+#ifndef DCC_RAM_KB
+#if defined(__AVR_ATmega168__) || defined(__AVR_ATmega168P__)
+#define DCC_RAM_KB (1)
+#elif defined(__AVR_ATmega328P__)
+#define DCC_RAM_KB (2)
+#else
+#define DCC_RAM_KB (16)
+#endif
+#endif
+
 // State Keeper configuration
+// EEPROM region of the state log. It has to fit more entries (20 bytes) than DCC_STATE_MAX_COUNT,
+// the more entries fit, the less each EEPROM cell is written.
+// The region goes to the end of the EEPROM, E2END is its last address (<avr/io.h> of the board):
+// 896 bytes on ATmega328P, 384 bytes on ATmega168.
 #define DCC_STATE_EEPROM_ADDR (128)
+#define DCC_STATE_EEPROM_SIZE (E2END + 1 - DCC_STATE_EEPROM_ADDR)
 
+// All the states are kept in RAM (about 20 bytes each on AVR). Storage other than the internal EEPROM
+// is set by DccStateKeeper::storage(..), states that don't fit the storage log are not kept.
+// ATmega328P keeps the 40 states, its trace, traffic windows and CV job are smaller instead.
+// Could be set by the build, e.g. -DDCC_STATE_MAX_COUNT=1000 for 1000 states (about 25 KB of RAM
+// on 32 bit boards) in the log of an external storage.
+#ifndef DCC_STATE_MAX_COUNT
+#if DCC_RAM_KB < 2
+#define DCC_STATE_MAX_COUNT   (8)
+#else
 #define DCC_STATE_MAX_COUNT   (40)
+#endif
+#endif
+
+// Address to state index in RAM, power of 2 and larger than DCC_STATE_MAX_COUNT.
+#ifndef DCC_STATE_INDEX_SIZE
+#if DCC_STATE_MAX_COUNT < 16
+#define DCC_STATE_INDEX_SIZE  (16)
+#elif DCC_STATE_MAX_COUNT < 64
+#define DCC_STATE_INDEX_SIZE  (64)
+#elif DCC_STATE_MAX_COUNT < 256
+#define DCC_STATE_INDEX_SIZE  (256)
+#elif DCC_STATE_MAX_COUNT < 1024
+#define DCC_STATE_INDEX_SIZE  (1024)
+#elif DCC_STATE_MAX_COUNT < 4096
+#define DCC_STATE_INDEX_SIZE  (4096)
+#else
+#define DCC_STATE_INDEX_SIZE  (8192)
+#endif
+#endif
+
+// Entries of the log used at most (up to 0x1FFF). RAM keeps the log position of every state,
+// one byte below 255, so the small boards use at most 254 entries of a larger storage.
+#if DCC_RAM_KB < 4
+#define DCC_STATE_LOG_MAX_COUNT (254)
+#else
+#define DCC_STATE_LOG_MAX_COUNT (0x1FFF)
+#endif
+
+// Running locomotives, and the states changed in the last ACTIVE_COUNT refreshes are refreshed every pass.
+// Stopped locomotives not changed lately are refreshed every IDLE_RATIO passes.
+#define DCC_STATE_ACTIVE_COUNT     (8)
+#define DCC_STATE_IDLE_RATIO       (8)
 
+// States are changed in RAM, and written to EEPROM when no state was changed for IDLE ms, 
+// but at least every MAX ms while states keep changing. Power off writes them immediately.
+#define DCC_STATE_FLUSH_IDLE_MS   (2000)
+#define DCC_STATE_FLUSH_MAX_MS    (30000)
 
-// Commander configuration
+
+// Commander configuration. Packet pool, 12 bytes each on AVR.
+#if DCC_RAM_KB < 2
+#define DCC_QUEUE_MAX_COUNT   (14)
+#else
 #define DCC_QUEUE_MAX_COUNT   (20)
+#endif
+
+// Packets of the pool, that delayed batches can't take, so the commands and the refresh
+// go on while the batches wait. More than the refresh packets of one state (11).
+#define DCC_SCHEDULE_RESERVE_COUNT (12)
+
+// CV instructions in one programming job
+#if DCC_RAM_KB < 4
+#define DCC_CV_JOB_MAX_COUNT  (8)
+#else
+#define DCC_CV_JOB_MAX_COUNT  (16)
+#endif
+
+// Transmitted packets waiting for the trace handler
+#if DCC_RAM_KB < 4
+#define DCC_TRACE_BUFFER_COUNT (2)
+#else
+#define DCC_TRACE_BUFFER_COUNT (8)
+#endif
+
+// Rail traffic is counted in bits per window, utilization is reported for the last COUNT windows
+#define DCC_TRAFFIC_WINDOW_MS    (1000)
+#if DCC_RAM_KB < 4
+#define DCC_TRAFFIC_WINDOW_COUNT (2)
+#else
+#define DCC_TRAFFIC_WINDOW_COUNT (4)
+#endif
+
+// Received text command lines: ring of all the waiting lines, and the longest line
+#if DCC_RAM_KB < 2
+#define DCC_LINE_BUFFER_SIZE     (64)
+#else
+#define DCC_LINE_BUFFER_SIZE     (128)
+#endif
+#define DCC_LINE_MAX_SIZE        (48)
+
+// Z21 LAN clients, that are forgotten after TIMEOUT ms without a message,
+// and turnouts (function addresses from 0), whose last output is reported
+#define DCC_Z21_CLIENT_COUNT      (4)
+#define DCC_Z21_CLIENT_TIMEOUT_MS (60000)
+#define DCC_Z21_TURNOUT_COUNT     (128)
+#define DCC_Z21_SERIAL_NUMBER     (0x00010000UL)
+
+// Tasks of DccScheduler
+#define DCC_SCHEDULER_TASK_COUNT (8)
+
+// Statistics and utilization text command results
+#define DCC_REPLY_LINE_SIZE      (112)
 
 // Repeat
 #define DCC_REPEAT_STOP    		(5)
 #define DCC_REPEAT_SPEED   		(3)
 #define DCC_REPEAT_FUNCTION		(3)
 #define DCC_REPEAT_ACCESSORY    (2)
+// Decoder writes CV after two identical packets
+#define DCC_REPEAT_CV    		(2)
 
 #endif //__DCC_CONFIG_H__
 
@@ -0,0 +1,76 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#include <Arduino.h>
+#include "DccConfig.h"
+#include "DccStandard.h"
+#include "DccCvJob.h"
+
+DccCvJob::DccCvJob() {
+	address0 = address1 = 0;
+	count = sent = 0;
+}
+
+void DccCvJob::start(byte a0, byte a1) {
+	address0 = a0;
+	address1 = a1;
+	count = sent = 0;
+}
+
+void DccCvJob::cancel() {
+	count = sent = 0;
+}
+
+boolean DccCvJob::add(DccPacket* packet) {
+	if (count >= DCC_CV_JOB_MAX_COUNT || packet->kind() != DCC_KIND_CV_LONG)
+		return false;
+
+	byte* command = packet->dcc_data + packet->mfCommandIndex();
+	instruction[count][0] = command[0];
+	instruction[count][1] = command[1];
+	instruction[count][2] = command[2];
+	++count;
+	return true;
+}
+
+byte DccCvJob::parse(const char*& s) {
+	DccPacket packet;
+	byte result = packet.parseDccTextAddress(s);
+	if (result != DCC_PARSE_OK)
+		return result;
+
+	start(packet.dcc_data[0], packet.isAddressShort() ? 0 : packet.dcc_data[1]);
+	do {
+		result = packet.parseDccTextMF(s);
+		if (result == DCC_PARSE_OK && packet.kind() != DCC_KIND_CV_LONG)
+			result = DCC_PARSE_UNKNOWN_COMMAND;
+		else if (result == DCC_PARSE_OK && !add(&packet))
+			result = DCC_PARSE_OUT_OF_RANGE;
+
+		if (result != DCC_PARSE_OK) {
+			cancel();
+			return result;
+		}
+	} while (!DccPacket::isTerminator(*s));
+
+	return DCC_PARSE_OK;
+}
+
+DccPacket* DccCvJob::nextPacket(DccStack& heap) {
+	if (!isPending() || heap.isEmpty())
+		return NULL;
+
+	DccPacket* packet = heap.pop();
+	packet->dcc_info = DCC_INFO_NO_ACKNOWLEDGE 
+					 | (DCC_REPEAT_CV & DCC_INFO_REPEAT_MASK);
+	byte* command = instruction[sent++];
+	return packet->mfAddress(address0, address1).mfCommand3(command[0], command[1], command[2]);
+}
@@ -0,0 +1,63 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#ifndef __DCC_CV_JOB_H__
+#define __DCC_CV_JOB_H__
+
+#include <Arduino.h>
+#include "DccConfig.h"
+#include "DccPacket.h"
+#include "DccCollection.h"
+
+// Operations Mode CV instructions to one decoder, sent one by one between the other packets.
+// Only the instruction bytes are kept, so the whole decoder profile fits into a few bytes per CV.
+class DccCvJob {
+private:
+	byte 	address0;
+	byte 	address1;
+	byte 	instruction[DCC_CV_JOB_MAX_COUNT][3];
+	byte 	count;
+	byte 	sent;
+
+public:
+	DccCvJob();
+
+	// Starts the new job for the decoder, pending instructions are dropped
+	void 		start(byte address0, byte address1);
+	void 		cancel();
+
+	// Adds CV Long Form instruction of the packet to the job
+	// Returns false if job is full, or packet is not CV Long Form instruction.
+	boolean 	add(DccPacket* packet);
+
+	// Text job: Multi Function address, followed by CV commands to it.
+	// See DccPacket::parseDccTextCommand(..) for the address and CV commands syntax.
+	// "M3000W1D3W29D34X29B5D1" - write CV1 = 3, CV29 = 34, and set bit 5 of CV29
+	// Returns DCC_PARSE_XXX, and DCC_PARSE_OUT_OF_RANGE if commands don't fit into the job.
+	byte 		parse(const char*& s);
+
+	boolean 	isPending();
+	byte 		pendingCount();
+
+	// Takes packet from the heap, and builds next instruction of the job.
+	// Returns NULL if job is complete, or heap is empty.
+	DccPacket* 	nextPacket(DccStack& heap);
+};
+
+inline boolean DccCvJob::isPending() {
+	return sent < count;
+}
+
+inline byte DccCvJob::pendingCount() {
+	return count - sent;
+}
+
+#endif //__DCC_CV_JOB_H__
@@ -0,0 +1,237 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#include <Arduino.h>
+#include "DccStandard.h"
+#include "DccDisassembler.h"
+
+class DccBufferPrint : public Print {
+private:
+	char* buffer;
+	byte  size;
+	byte  length;
+
+public:
+	DccBufferPrint(char* b, byte s) : buffer(b), size(s), length(0) {
+		if (size > 0)
+			buffer[0] = '\0';
+	}
+
+	virtual size_t write(uint8_t ch) {
+		if (length + 1 >= size)
+			return 0;
+		buffer[length++] = ch;
+		buffer[length] = '\0';
+		return 1;
+	}
+
+	byte printed() {
+		return length;
+	}
+};
+
+void DccDisassembler::decode(DccPacket* packet, DccPacketInfo& info) {
+	memset(&info, 0, sizeof(info));
+	info.kind = packet->kind();
+
+	byte* data = packet->dcc_data;
+	if (packet->isIdle()) {
+		info.addressKind = DCC_ADDRESS_KIND_IDLE;
+	} else if (packet->isMultiFunction()) {
+		decodeMultiFunction(packet, info);
+	} else if (packet->isAccessory()) {
+		info.address = (data[0] & DCC_BA_ADDRESS_MASK_1)
+					 | (((data[1] & DCC_BA_ADDRESS_MASK_2) ^ DCC_BA_ADDRESS_MASK_2) << DCC_BA_ADDRESS_SHIFT);
+		if (packet->isBasicAccessory()) {
+			info.addressKind = DCC_ADDRESS_KIND_BASIC_ACCESSORY;
+			info.port 	= (data[1] & DCC_BA_ADDRESS_PAIR_MASK) >> DCC_BA_ADDRESS_PAIR_SHIFT;
+			info.output = (data[1] & DCC_BA_ADDRESS_OUTPUT_MASK);
+			info.on 	= (data[1] & DCC_BA_ACTIVATE_MASK) == DCC_BA_ACTIVATE;
+		} else {
+			info.addressKind = DCC_ADDRESS_KIND_EXTENDED_ACCESSORY;
+			info.address |= (word)(data[1] & DCC_EA_ADDRESS_MASK_3) << DCC_EA_ADDRESS_SHIFT_3;
+			info.value = data[2] & DCC_EA_STATE_MASK;
+		}
+	} else {
+		info.addressKind = DCC_ADDRESS_KIND_RESERVED;
+	}
+}
+
+void DccDisassembler::decodeMultiFunction(DccPacket* packet, DccPacketInfo& info) {
+	byte* data = packet->dcc_data;
+	if (packet->isMultiFunctionBroadcast()) {
+		info.addressKind = DCC_ADDRESS_KIND_BROADCAST;
+	} else if (packet->isAddressShort()) {
+		info.addressKind = DCC_ADDRESS_KIND_SHORT;
+		info.address = data[0];
+	} else {
+		info.addressKind = DCC_ADDRESS_KIND_LONG;
+		info.address = ((word)(data[0] - DCC_ADDRESS_LONG_MIN) << 8) | data[1];
+	}
+
+	byte* command = data + packet->mfCommandIndex();
+	switch(info.kind) {
+		case DCC_KIND_SPEED_28:
+					info.on 	= (command[0] & DCC_MF_KIND3_MASK) == DCC_MF_KIND3_FORWARD_OPERATION;
+					info.value 	= ((command[0] & DCC_MF_SPEED_28_HBIT_MASK) << DCC_MF_SPEED_28_HBIT_SHIFT)
+								| ((command[0] & DCC_MF_SPEED_28_LBIT_MASK) >> DCC_MF_SPEED_28_LBIT_SHIFT);
+					break;
+		case DCC_KIND_SPEED_128:
+					info.on 	= (command[1] & DCC_MF_SPEED_128_DIRECTION_MASK) == DCC_MF_SPEED_128_FORWARD;
+					info.value 	= command[1] & DCC_MF_SPEED_128_MASK;
+					break;
+		case DCC_KIND_F0_F4:
+					info.value 	= ((command[0] & DCC_MF_FUNCTION_F0) >> 4) | ((command[0] & (DCC_MF_FUNCTION_F0_F4_MASK & ~DCC_MF_FUNCTION_F0)) << 1);
+					break;
+		case DCC_KIND_F5_F8:
+		case DCC_KIND_F9_F12:
+					info.value 	= command[0] & DCC_MF_FUNCTION_F5_F8_MASK;
+					break;
+		case DCC_KIND_F13_F20:
+		case DCC_KIND_F21_F28:
+		case DCC_KIND_F29_F36:
+		case DCC_KIND_F37_F44:
+		case DCC_KIND_F45_F52:
+		case DCC_KIND_F53_F60:
+		case DCC_KIND_F61_F68:
+					info.value 	= command[1];
+					break;
+		case DCC_KIND_BINARY_STATE_SHORT:
+					info.on 	= (command[1] & DCC_MF_BINARY_STATE_ON) != 0;
+					info.state 	= command[1] & DCC_MF_BINARY_STATE_MASK;
+					break;
+		case DCC_KIND_BINARY_STATE_LONG:
+					info.on 	= (command[1] & DCC_MF_BINARY_STATE_ON) != 0;
+					info.state 	= (command[1] & DCC_MF_BINARY_STATE_MASK) | ((word)command[2] << DCC_MF_BINARY_STATE_LONG_SHIFT);
+					break;
+		case DCC_KIND_CV_SHORT:
+					info.value 	= command[1];
+					info.cvOperation = command[0] & DCC_MF_CV_SHORT_MASK;
+					break;
+		case DCC_KIND_CV_LONG:
+					info.cvOperation = command[0] & DCC_CV_LONG_OP_MASK;
+					info.cv 	= ((((word)command[0] & DCC_CV_MASK_1) << 8) | command[1]) + 1;
+					info.value 	= command[2];
+					break;
+	}
+}
+
+void DccDisassembler::print(DccPacket* packet, Print& out) {
+	DccPacketInfo info;
+	decode(packet, info);
+
+	switch(info.kind) {
+		case DCC_KIND_BINARY_STATE_LONG:
+					// Text command selects the short form for these states
+					if (info.state <= DCC_MF_BINARY_STATE_SHORT_MAX) {
+						printHex(packet, out);
+						return;
+					}
+					//fall through
+		case DCC_KIND_CV_LONG:
+					// Reserved operation, or bit manipulation with wrong data
+					if (info.kind == DCC_KIND_CV_LONG 
+						&& (   info.cvOperation == 0 
+							|| (info.cvOperation == DCC_CV_BIT_OP && (info.value & DCC_CV_BIT_DATA_MASK) != DCC_CV_BIT_DATA))) {
+						printHex(packet, out);
+						return;
+					}
+					//fall through
+		case DCC_KIND_SPEED_28:
+		case DCC_KIND_SPEED_128:
+		case DCC_KIND_F0_F4:
+		case DCC_KIND_F5_F8:
+		case DCC_KIND_F9_F12:
+		case DCC_KIND_F13_F20:
+		case DCC_KIND_F21_F28:
+		case DCC_KIND_F29_F36:
+		case DCC_KIND_F37_F44:
+		case DCC_KIND_F45_F52:
+		case DCC_KIND_F53_F60:
+		case DCC_KIND_F61_F68:
+		case DCC_KIND_BINARY_STATE_SHORT:
+					out.print(info.addressKind == DCC_ADDRESS_KIND_LONG ? 'M' : 'm');
+					out.print(info.address);
+					break;
+		case DCC_KIND_BA_OUTPUT:
+					out.print('B');
+					out.print(info.address);
+					out.print('P');
+					out.print(info.port);
+					out.print('O');
+					out.print(info.output);
+					out.print(info.on ? 'A' : 'D');
+					return;
+		case DCC_KIND_EA_STATE:
+					out.print('E');
+					out.print(info.address);
+					out.print('S');
+					out.print(info.value);
+					return;
+		default:
+					printHex(packet, out);
+					return;
+	}
+
+	switch(info.kind) {
+		case DCC_KIND_SPEED_28:		out.print(info.on ? 'f' : 'r'); out.print(info.value); break;
+		case DCC_KIND_SPEED_128:	out.print(info.on ? 'F' : 'R'); out.print(info.value); break;
+		case DCC_KIND_F0_F4:		out.print('A'); printBits(info.value, 5, out); break;
+		case DCC_KIND_F5_F8:		out.print('B'); printBits(info.value, 4, out); break;
+		case DCC_KIND_F9_F12:		out.print('C'); printBits(info.value, 4, out); break;
+		case DCC_KIND_F13_F20:		out.print('D'); printBits(info.value, 8, out); break;
+		case DCC_KIND_F21_F28:		out.print('E'); printBits(info.value, 8, out); break;
+		case DCC_KIND_F29_F36:		out.print('G'); printBits(info.value, 8, out); break;
+		case DCC_KIND_F37_F44:		out.print('H'); printBits(info.value, 8, out); break;
+		case DCC_KIND_F45_F52:		out.print('I'); printBits(info.value, 8, out); break;
+		case DCC_KIND_F53_F60:		out.print('J'); printBits(info.value, 8, out); break;
+		case DCC_KIND_F61_F68:		out.print('K'); printBits(info.value, 8, out); break;
+		case DCC_KIND_BINARY_STATE_SHORT:
+		case DCC_KIND_BINARY_STATE_LONG:
+									out.print('S'); out.print(info.state); out.print(info.on ? "V1" : "V0"); break;
+		case DCC_KIND_CV_LONG:
+					if (info.cvOperation == DCC_CV_BIT_OP) {
+						out.print((info.value & DCC_CV_BIT_OP_MASK) == DCC_CV_BIT_WRITE ? 'X' : 'Y');
+						out.print(info.cv);
+						out.print('B');
+						out.print(info.value & DCC_CV_BIT_MASK);
+						out.print((info.value & DCC_CV_BIT_VALUE_1) ? "D1" : "D0");
+					} else {
+						out.print(info.cvOperation == DCC_CV_WRITE ? 'W' : 'V');
+						out.print(info.cv);
+						out.print('D');
+						out.print(info.value);
+					}
+					break;
+	}
+}
+
+byte DccDisassembler::format(DccPacket* packet, char* buffer, byte size) {
+	DccBufferPrint out(buffer, size);
+	print(packet, out);
+	return out.printed();
+}
+
+void DccDisassembler::printHex(DccPacket* packet, Print& out) {
+	out.print('H');
+	byte count = packet->size();
+	for (byte i = 0; i < count; ++i) {
+		// Error byte is calculated by Hex Command, instead dcc_info is printed first
+		byte v = (i == 0) ? packet->dcc_info : packet->dcc_data[i - 1];
+		out.print("0123456789ABCDEF"[v >> 4]);
+		out.print("0123456789ABCDEF"[v & 0xF]);
+	}
+}
+
+void DccDisassembler::printBits(byte bits, byte count, Print& out) {
+	for (byte i = 0; i < count; ++i, bits >>= 1)
+		out.print((bits & 0x01) ? '1' : '0');
+}
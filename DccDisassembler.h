@@ -0,0 +1,81 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#ifndef __DCC_DISASSEMBLER_H__
+#define __DCC_DISASSEMBLER_H__
+
+#include <Arduino.h>
+#include "DccPacket.h"
+
+// Dcc Address Kind
+//======================================================
+#define DCC_ADDRESS_KIND_IDLE                (0)
+#define DCC_ADDRESS_KIND_BROADCAST           (1)
+#define DCC_ADDRESS_KIND_SHORT               (2)
+#define DCC_ADDRESS_KIND_LONG                (3)
+#define DCC_ADDRESS_KIND_BASIC_ACCESSORY     (4)
+#define DCC_ADDRESS_KIND_EXTENDED_ACCESSORY  (5)
+#define DCC_ADDRESS_KIND_RESERVED            (6)
+
+struct DccPacketInfo {
+	// DCC_KIND_XXX, see DccPacket::kind()
+	byte 		kind;
+
+	// DCC_ADDRESS_KIND_XXX
+	byte 		addressKind;
+
+	// Decoder address. Accessory broadcast is 511 for Basic and 2047 for Extended Accessory.
+	word 		address;
+
+	// DCC_KIND_SPEED_28, DCC_KIND_SPEED_128: direction
+	// DCC_KIND_BA_OUTPUT: activate
+	// DCC_KIND_BINARY_STATE_XXX: state on
+	boolean 	on;
+
+	// DCC_KIND_SPEED_28: 	speed 0-31, as in text command f###
+	// DCC_KIND_SPEED_128: 	speed 0-127
+	// DCC_KIND_FX_FY:		function bits, bit 0 is the lowest function of the group (F0 for F0-F4)
+	// DCC_KIND_EA_STATE:	state
+	// DCC_KIND_CV_XXX:		data byte
+	byte 		value;
+
+	// DCC_KIND_BA_OUTPUT: port 0-3 and output 0-1
+	byte 		port;
+	byte 		output;
+
+	// DCC_KIND_CV_LONG: CV number starting from 1, and DCC_CV_VERIFY, DCC_CV_WRITE or DCC_CV_BIT_OP
+	// DCC_KIND_CV_SHORT: DCC_MF_CV_SHORT_XXX in cvOperation
+	word 		cv;
+	byte 		cvOperation;
+
+	// DCC_KIND_BINARY_STATE_XXX: binary state number, 0 - all states
+	word 		state;
+};
+
+class DccDisassembler {
+public:
+	// Fills info from dcc_data. Cheap enough to be called for every transmitted packet.
+	static void decode(DccPacket* packet, DccPacketInfo& info);
+
+	// Prints the packet as the text command, that will produce the same packet.
+	// See DccPacket::parseDccTextCommand(..). Packets without text command are printed as Hex Command "HXX...XX".
+	static void print(DccPacket* packet, Print& out);
+
+	// Same as print(..), but into zero terminated buffer. Returns printed length.
+	static byte format(DccPacket* packet, char* buffer, byte size);
+
+private:
+	static void decodeMultiFunction(DccPacket* packet, DccPacketInfo& info);
+	static void printHex(DccPacket* packet, Print& out);
+	static void printBits(byte bits, byte count, Print& out);
+};
+
+#endif //__DCC_DISASSEMBLER_H__
@@ -0,0 +1,54 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#ifndef ARDUINO
+
+#include "DccFileStorage.h"
+
+DccFileStorage::DccFileStorage(const char* path, unsigned long length) 
+	: length(length) {
+	file = fopen(path, "r+b");
+	if (file == NULL)
+		file = fopen(path, "w+b");
+	if (file == NULL)
+		return;
+
+	fseek(file, 0, SEEK_END);
+	for (long end = ftell(file); end >= 0 && (unsigned long) end < length; ++end)
+		fputc(0xFF, file);
+	fflush(file);
+}
+
+DccFileStorage::~DccFileStorage() {
+	if (file != NULL)
+		fclose(file);
+}
+
+unsigned long DccFileStorage::size() {
+	return file != NULL ? length : 0;
+}
+
+void DccFileStorage::read(unsigned long address, byte* data, byte count) {
+	memset(data, 0xFF, count);
+	if (file == NULL || fseek(file, address, SEEK_SET) != 0)
+		return;
+	if (fread(data, 1, count, file) != count)
+		memset(data, 0xFF, count);
+}
+
+void DccFileStorage::write(unsigned long address, const byte* data, byte count) {
+	if (file == NULL || fseek(file, address, SEEK_SET) != 0)
+		return;
+	fwrite(data, 1, count, file);
+	fflush(file);
+}
+
+#endif //ARDUINO
@@ -0,0 +1,39 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#ifndef __DCC_FILE_STORAGE_H__
+#define __DCC_FILE_STORAGE_H__
+
+// Host builds only, stands in for the EEPROM or FRAM in the tests
+#ifndef ARDUINO
+
+#include <stdio.h>
+#include <Arduino.h>
+#include "DccStorage.h"
+
+// File is created erased (0xFF), when it does not exist or is shorter than length
+class DccFileStorage : public DccStorage {
+private:
+	FILE*			file;
+	unsigned long	length;
+
+public:
+	DccFileStorage(const char* path, unsigned long length);
+	~DccFileStorage();
+
+	virtual unsigned long size();
+
+	virtual void read (unsigned long address, byte* data, byte count);
+	virtual void write(unsigned long address, const byte* data, byte count);
+};
+
+#endif //ARDUINO
+#endif //__DCC_FILE_STORAGE_H__
@@ -0,0 +1,60 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#include <Arduino.h>
+#include <Wire.h>
+
+#include "DccFramStorage.h"
+
+// Wire buffer holds the memory address and the data of one transmission
+#define DCC_FRAM_CHUNK_SIZE			(BUFFER_LENGTH - 2)
+
+DccFramStorage::DccFramStorage(unsigned long length, byte device) 
+	: device(device), length(length) {
+}
+
+unsigned long DccFramStorage::size() {
+	return length;
+}
+
+void DccFramStorage::beginTransmission(unsigned long address) {
+	Wire.beginTransmission(device);
+	Wire.write((byte) (address >> 8));
+	Wire.write((byte) address);
+}
+
+void DccFramStorage::read(unsigned long address, byte* data, byte count) {
+	while (count > 0) {
+		byte chunk = count < DCC_FRAM_CHUNK_SIZE ? count : DCC_FRAM_CHUNK_SIZE;
+		beginTransmission(address);
+		Wire.endTransmission(false);
+		Wire.requestFrom(device, chunk);
+		for (byte i = 0; i < chunk; ++i)
+			data[i] = Wire.available() ? Wire.read() : 0xFF;
+
+		address += chunk;
+		data 	+= chunk;
+		count 	-= chunk;
+	}
+}
+
+void DccFramStorage::write(unsigned long address, const byte* data, byte count) {
+	while (count > 0) {
+		byte chunk = count < DCC_FRAM_CHUNK_SIZE ? count : DCC_FRAM_CHUNK_SIZE;
+		beginTransmission(address);
+		Wire.write(data, chunk);
+		Wire.endTransmission();
+
+		address += chunk;
+		data 	+= chunk;
+		count 	-= chunk;
+	}
+}
@@ -0,0 +1,40 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#ifndef __DCC_FRAM_STORAGE_H__
+#define __DCC_FRAM_STORAGE_H__
+
+#include <Arduino.h>
+#include "DccStorage.h"
+
+#define DCC_FRAM_DEVICE_ADDRESS		(0x50)
+
+// I2C FRAM with 16 bit memory address (MB85RC64 .. MB85RC512, FM24C64 .. FM24CL64). 
+// Writes are immediate and unlimited, so the whole device could hold the state log.
+// Wire.begin() has to be called before DccStateKeeper::begin().
+class DccFramStorage : public DccStorage {
+private:
+	byte			device;
+	unsigned long	length;
+
+public:
+	DccFramStorage(unsigned long length, byte device = DCC_FRAM_DEVICE_ADDRESS);
+
+	virtual unsigned long size();
+
+	virtual void read (unsigned long address, byte* data, byte count);
+	virtual void write(unsigned long address, const byte* data, byte count);
+
+private:
+	void	beginTransmission(unsigned long address);
+};
+
+#endif //__DCC_FRAM_STORAGE_H__
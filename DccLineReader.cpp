@@ -0,0 +1,86 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#include <Arduino.h>
+#include "DccLineReader.h"
+
+DccLineReader::DccLineReader(Stream& stream) 
+	: stream(&stream) {
+	head = tail = lineStart = 0;
+	lineLength = 0;
+	lines = 0;
+	dropping = false;
+	dropped = 0;
+}
+
+void DccLineReader::loop() {
+	while (stream->available() > 0) {
+		int ch = stream->read();
+		if (ch < 0)
+			break;
+		receive(ch);
+	}
+}
+
+void DccLineReader::receive(char ch) {
+	if (ch == '\r')
+		return;
+
+	if (ch == '\n') {
+		if (dropping) {
+			dropping = false;
+			return;
+		}
+		// Empty lines are skipped
+		if (lineLength == 0)
+			return;
+		ring[head] = '\0';
+		head = (head + 1) % DCC_LINE_BUFFER_SIZE;
+		lineStart = head;
+		lineLength = 0;
+		++lines;
+		return;
+	}
+
+	if (dropping)
+		return;
+
+	// Room for the terminator is kept, and head never reaches the tail
+	byte next = (head + 1) % DCC_LINE_BUFFER_SIZE;
+	if (lineLength == DCC_LINE_MAX_SIZE || (next + 1) % DCC_LINE_BUFFER_SIZE == tail || next == tail) {
+		drop();
+		return;
+	}
+	ring[head] = ch;
+	head = next;
+	++lineLength;
+}
+
+void DccLineReader::drop() {
+	head = lineStart;
+	lineLength = 0;
+	dropping = true;
+	++dropped;
+}
+
+boolean DccLineReader::readLine(char* line) {
+	if (lines == 0)
+		return false;
+
+	while (ring[tail] != '\0') {
+		*line++ = ring[tail];
+		tail = (tail + 1) % DCC_LINE_BUFFER_SIZE;
+	}
+	*line = '\0';
+	tail = (tail + 1) % DCC_LINE_BUFFER_SIZE;
+	--lines;
+	return true;
+}
@@ -0,0 +1,59 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#ifndef __DCC_LINE_READER_H__
+#define __DCC_LINE_READER_H__
+
+#include <Arduino.h>
+#include "DccConfig.h"
+
+// Collects text command lines from the stream without blocking. loop() moves all the received
+// characters from the serial RX buffer (filled in the interrupt) into the ring, so several
+// lines could wait there, while the earlier one is handled. Lines end with '\n', '\r' is ignored.
+// Line longer than DCC_LINE_MAX_SIZE, or not fitting into the ring, is dropped as a whole.
+class DccLineReader {
+private:
+	Stream*	stream;
+	char	ring[DCC_LINE_BUFFER_SIZE];
+	byte	head;		// next character is written here
+	byte	tail;		// first character of the oldest line
+	byte	lineStart;	// first character of the line being received
+	byte	lineLength;
+	byte	lines;		// complete lines in the ring
+	boolean	dropping;	// rest of the dropped line is skipped
+	word	dropped;
+
+public:
+	DccLineReader(Stream& stream);
+
+	void 	loop();
+
+	// Copies the oldest complete line with the terminating '\0' into line,
+	// which has to have DCC_LINE_MAX_SIZE + 1 characters. Returns false if there is no line.
+	boolean readLine(char* line);
+	boolean hasLine();
+
+	word 	droppedCount();
+
+private:
+	void 	receive(char ch);
+	void 	drop();
+};
+
+inline boolean DccLineReader::hasLine() {
+	return lines > 0;
+}
+
+inline word DccLineReader::droppedCount() {
+	return dropped;
+}
+
+#endif //__DCC_LINE_READER_H__
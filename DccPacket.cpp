@@ -14,20 +14,281 @@
 #include "DccStandard.h"
 #include "DccPacket.h"
 
+byte DccPacket::kind() {
+	if (isIdle())
+		return DCC_KIND_IDLE;
+
+	if (isMultiFunction()) {
+		byte command = dcc_data[mfCommandIndex()];
+		switch(command & DCC_MF_KIND3_MASK) {
+			case DCC_MF_KIND3_CONTROL:				
+							if ((command & DCC_MF_KIND4_MASK) == DCC_MF_KIND4_CONSIST_CONTROL)
+								return DCC_KIND_CONSIST_CONTROL;
+							switch(command) {
+								case DCC_MF_DECODER_SOFT_RESET: return DCC_KIND_DECODER_RESET;
+								case DCC_MF_DECODER_HARD_RESET: return DCC_KIND_DECODER_HARD_RESET;
+							}
+							return DCC_KIND_DECODER_CONTROL;
+			case DCC_MF_KIND3_ADVANCED_OPERATION: 	return (command == DCC_MF_KIND8_SPEED_128) ? DCC_KIND_SPEED_128 : DCC_KIND_UNKNOWN; 
+			case DCC_MF_KIND3_REVERSE_OPERATION:
+			case DCC_MF_KIND3_FORWARD_OPERATION: 	return DCC_KIND_SPEED_28;
+			case DCC_MF_KIND3_F0_F4: 				return DCC_KIND_F0_F4;
+			case DCC_MF_KIND3_F5_F12: 				return ((command & DCC_MF_KIND4_MASK) == DCC_MF_KIND4_F5_F8) ? DCC_KIND_F5_F8 : DCC_KIND_F9_F12;
+			case DCC_MF_KIND3_FUTURE_EXPANSION:		
+							switch(command) {
+								case DCC_MF_KIND8_F13_F20: return DCC_KIND_F13_F20;
+								case DCC_MF_KIND8_F21_F28: return DCC_KIND_F21_F28;
+								case DCC_MF_KIND8_F29_F36: return DCC_KIND_F29_F36;
+								case DCC_MF_KIND8_F37_F44: return DCC_KIND_F37_F44;
+								case DCC_MF_KIND8_F45_F52: return DCC_KIND_F45_F52;
+								case DCC_MF_KIND8_F53_F60: return DCC_KIND_F53_F60;
+								case DCC_MF_KIND8_F61_F68: return DCC_KIND_F61_F68;
+								case DCC_MF_KIND8_SHORT_STATE_CONTROL: return DCC_KIND_BINARY_STATE_SHORT;
+								case DCC_MF_KIND8_LONG_STATE_CONTROL:  return DCC_KIND_BINARY_STATE_LONG;
+							}
+							return DCC_KIND_UNKNOWN;	
+			case DCC_MF_KIND3_CONFIG_VARIABLE_ACCESS:	
+							return ((command & DCC_MF_KIND4_MASK) == DCC_MF_KIND4_CV_LONG_ACCESS) ? DCC_KIND_CV_LONG : DCC_KIND_CV_SHORT;
+		}
+	} else if (isBasicAccessory()) {
+		return size() == 3 ? DCC_KIND_BA_OUTPUT : DCC_KIND_UNKNOWN;
+	} else if (isExtendedAccessory()) {
+		return size() == 4 ? DCC_KIND_EA_STATE : DCC_KIND_UNKNOWN;
+	}
+	return DCC_KIND_UNKNOWN;
+}
+
+// Text Command Grammar
+//======================================================
+// Each rule is a letter of the command in the group, followed by the argument:
+//    TEXT_ARG_NONE          - no argument
+//    TEXT_ARG_NUMBER        - decimal number from 0 to max. Missing number is 0
+//    TEXT_ARG_NUMBER_OR_MAX - decimal number from 0 to max. Missing number is max (broadcast)
+//    TEXT_ARG_BITS          - exactly max boolean characters, first character is bit 0
+#define TEXT_GROUP_ADDRESS				(0)
+#define TEXT_GROUP_MF					(1)
+#define TEXT_GROUP_BA_PORT				(2)
+#define TEXT_GROUP_BA_OUTPUT			(3)
+#define TEXT_GROUP_BA					(4)
+#define TEXT_GROUP_EA					(5)
+#define TEXT_GROUP_MF_STATE_VALUE		(6)
+#define TEXT_GROUP_CV_BIT				(7)
+#define TEXT_GROUP_CV_DATA				(8)
+#define TEXT_GROUP_CV_BIT_DATA			(9)
+
+#define TEXT_ARG_NONE					(0)
+#define TEXT_ARG_NUMBER					(1)
+#define TEXT_ARG_NUMBER_OR_MAX			(2)
+#define TEXT_ARG_BITS					(3)
+
+#define TEXT_OP_NONE					(0)
+#define TEXT_OP_MF_ADDRESS_7			(1)
+#define TEXT_OP_MF_ADDRESS_14			(2)
+#define TEXT_OP_BA_ADDRESS				(3)
+#define TEXT_OP_EA_ADDRESS				(4)
+#define TEXT_OP_SPEED_28_FORWARD		(5)
+#define TEXT_OP_SPEED_28_REVERSE		(6)
+#define TEXT_OP_SPEED_128_FORWARD		(7)
+#define TEXT_OP_SPEED_128_REVERSE		(8)
+#define TEXT_OP_F0_F4					(9)
+#define TEXT_OP_F5_F8					(10)
+#define TEXT_OP_F9_F12					(11)
+#define TEXT_OP_F13_F20					(12)
+#define TEXT_OP_F21_F28					(13)
+#define TEXT_OP_ACTIVATE				(14)
+#define TEXT_OP_DEACTIVATE				(15)
+#define TEXT_OP_STATE					(16)
+#define TEXT_OP_F29_F36					(17)
+#define TEXT_OP_F37_F44					(18)
+#define TEXT_OP_F45_F52					(19)
+#define TEXT_OP_F53_F60					(20)
+#define TEXT_OP_F61_F68					(21)
+#define TEXT_OP_BINARY_STATE			(22)
+#define TEXT_OP_CV_WRITE				(23)
+#define TEXT_OP_CV_VERIFY				(24)
+#define TEXT_OP_CV_BIT_WRITE			(25)
+#define TEXT_OP_CV_BIT_VERIFY			(26)
+
+#define TEXT_ADDRESS_MF_14_MAX			(((word)(DCC_ADDRESS_LONG_MAX - DCC_ADDRESS_LONG_MIN) << 8) | 0xFF)
+
+struct DccTextRule {
+	byte group;
+	char letter;
+	byte op;
+	byte argument;
+	word max;
+};
+
+// Rules are grouped in the group order and sorted by the letter inside a group
+static constexpr DccTextRule TEXT_GRAMMAR[] PROGMEM = {
+	{TEXT_GROUP_ADDRESS, 	'B', TEXT_OP_BA_ADDRESS,		TEXT_ARG_NUMBER_OR_MAX,	DCC_BA_ADDRESS_BROADCAST},
+	{TEXT_GROUP_ADDRESS, 	'E', TEXT_OP_EA_ADDRESS,		TEXT_ARG_NUMBER_OR_MAX,	DCC_EA_ADDRESS_BROADCAST},
+	{TEXT_GROUP_ADDRESS, 	'M', TEXT_OP_MF_ADDRESS_14,		TEXT_ARG_NUMBER,		TEXT_ADDRESS_MF_14_MAX},
+	{TEXT_GROUP_ADDRESS, 	'm', TEXT_OP_MF_ADDRESS_7,		TEXT_ARG_NUMBER,		DCC_ADDRESS_SHORT_MAX},
+
+	{TEXT_GROUP_MF, 		'A', TEXT_OP_F0_F4,				TEXT_ARG_BITS,			5},
+	{TEXT_GROUP_MF, 		'B', TEXT_OP_F5_F8,				TEXT_ARG_BITS,			4},
+	{TEXT_GROUP_MF, 		'C', TEXT_OP_F9_F12,			TEXT_ARG_BITS,			4},
+	{TEXT_GROUP_MF, 		'D', TEXT_OP_F13_F20,			TEXT_ARG_BITS,			8},
+	{TEXT_GROUP_MF, 		'E', TEXT_OP_F21_F28,			TEXT_ARG_BITS,			8},
+	{TEXT_GROUP_MF, 		'F', TEXT_OP_SPEED_128_FORWARD,	TEXT_ARG_NUMBER,		DCC_MF_SPEED_128_MAX},
+	{TEXT_GROUP_MF, 		'G', TEXT_OP_F29_F36,			TEXT_ARG_BITS,			8},
+	{TEXT_GROUP_MF, 		'H', TEXT_OP_F37_F44,			TEXT_ARG_BITS,			8},
+	{TEXT_GROUP_MF, 		'I', TEXT_OP_F45_F52,			TEXT_ARG_BITS,			8},
+	{TEXT_GROUP_MF, 		'J', TEXT_OP_F53_F60,			TEXT_ARG_BITS,			8},
+	{TEXT_GROUP_MF, 		'K', TEXT_OP_F61_F68,			TEXT_ARG_BITS,			8},
+	{TEXT_GROUP_MF, 		'R', TEXT_OP_SPEED_128_REVERSE,	TEXT_ARG_NUMBER,		DCC_MF_SPEED_128_MAX},
+	{TEXT_GROUP_MF, 		'S', TEXT_OP_BINARY_STATE,		TEXT_ARG_NUMBER,		DCC_MF_BINARY_STATE_LONG_MAX},
+	{TEXT_GROUP_MF, 		'V', TEXT_OP_CV_VERIFY,			TEXT_ARG_NUMBER,		DCC_CV_MAX},
+	{TEXT_GROUP_MF, 		'W', TEXT_OP_CV_WRITE,			TEXT_ARG_NUMBER,		DCC_CV_MAX},
+	{TEXT_GROUP_MF, 		'X', TEXT_OP_CV_BIT_WRITE,		TEXT_ARG_NUMBER,		DCC_CV_MAX},
+	{TEXT_GROUP_MF, 		'Y', TEXT_OP_CV_BIT_VERIFY,		TEXT_ARG_NUMBER,		DCC_CV_MAX},
+	{TEXT_GROUP_MF, 		'f', TEXT_OP_SPEED_28_FORWARD,	TEXT_ARG_NUMBER,		DCC_MF_SPEED_28_MAX},
+	{TEXT_GROUP_MF, 		'r', TEXT_OP_SPEED_28_REVERSE,	TEXT_ARG_NUMBER,		DCC_MF_SPEED_28_MAX},
+
+	{TEXT_GROUP_BA_PORT, 	'P', TEXT_OP_NONE,				TEXT_ARG_NUMBER,		DCC_BA_ADDRESS_PAIR_MASK >> DCC_BA_ADDRESS_PAIR_SHIFT},
+	{TEXT_GROUP_BA_OUTPUT, 	'O', TEXT_OP_NONE,				TEXT_ARG_NUMBER,		DCC_BA_ADDRESS_OUTPUT_MASK},
+	{TEXT_GROUP_BA, 		'A', TEXT_OP_ACTIVATE,			TEXT_ARG_NONE,			0},
+	{TEXT_GROUP_BA, 		'D', TEXT_OP_DEACTIVATE,		TEXT_ARG_NONE,			0},
+
+	{TEXT_GROUP_EA, 		'S', TEXT_OP_STATE,				TEXT_ARG_NUMBER,		DCC_EA_STATE_MAX},
+
+	{TEXT_GROUP_MF_STATE_VALUE,'V', TEXT_OP_NONE,			TEXT_ARG_BITS,			1},
+	{TEXT_GROUP_CV_BIT, 	'B', TEXT_OP_NONE,				TEXT_ARG_NUMBER,		DCC_CV_BIT_MASK},
+	{TEXT_GROUP_CV_DATA, 	'D', TEXT_OP_NONE,				TEXT_ARG_NUMBER,		0xFF},
+	{TEXT_GROUP_CV_BIT_DATA,'D', TEXT_OP_NONE,				TEXT_ARG_NUMBER,		1},
+};
+
+#define TEXT_GRAMMAR_SIZE (sizeof(TEXT_GRAMMAR)/sizeof(TEXT_GRAMMAR[0]))
+
+// Index of the first rule of the group, or TEXT_GRAMMAR_SIZE past the last group
+static constexpr byte textGroupFirst(byte group, byte i = 0) {
+	return (i < TEXT_GRAMMAR_SIZE && TEXT_GRAMMAR[i].group < group) ? textGroupFirst(group, i + 1) : i;
+}
+
+static constexpr boolean isTextGrammarSorted(byte i = 1) {
+	return i >= TEXT_GRAMMAR_SIZE
+		|| ((TEXT_GRAMMAR[i - 1].group < TEXT_GRAMMAR[i].group
+			|| (TEXT_GRAMMAR[i - 1].group == TEXT_GRAMMAR[i].group && TEXT_GRAMMAR[i - 1].letter < TEXT_GRAMMAR[i].letter))
+			&& isTextGrammarSorted(i + 1));
+}
+
+static_assert(isTextGrammarSorted(), "TEXT_GRAMMAR must be sorted by the group, and by the letter inside a group");
+static_assert(TEXT_GRAMMAR[TEXT_GRAMMAR_SIZE - 1].group == TEXT_GROUP_CV_BIT_DATA, "TEXT_GRAMMAR must end with the last group");
+
+// Index of the first rule of every group, the last entry closes the last group
+static const byte TEXT_GROUP_FIRST[] PROGMEM = {
+	textGroupFirst(TEXT_GROUP_ADDRESS),
+	textGroupFirst(TEXT_GROUP_MF),
+	textGroupFirst(TEXT_GROUP_BA_PORT),
+	textGroupFirst(TEXT_GROUP_BA_OUTPUT),
+	textGroupFirst(TEXT_GROUP_BA),
+	textGroupFirst(TEXT_GROUP_EA),
+	textGroupFirst(TEXT_GROUP_MF_STATE_VALUE),
+	textGroupFirst(TEXT_GROUP_CV_BIT),
+	textGroupFirst(TEXT_GROUP_CV_DATA),
+	textGroupFirst(TEXT_GROUP_CV_BIT_DATA),
+	textGroupFirst(TEXT_GROUP_CV_BIT_DATA + 1)
+};
+
+static_assert(sizeof(TEXT_GROUP_FIRST) == TEXT_GROUP_CV_BIT_DATA + 2, "TEXT_GROUP_FIRST must cover every group");
+
+// Finds the grammar rule of the group by the current character, and parses its argument.
+// Rules of a group are sorted by the letter, so the group is searched by halves.
+inline byte DccPacket::parseToken(byte group, const char*& s, byte& op, word& value) {
+	byte first = pgm_read_byte(&TEXT_GROUP_FIRST[group]);
+	byte last = pgm_read_byte(&TEXT_GROUP_FIRST[group + 1]);
+	const DccTextRule* rule = NULL;
+	while (first < last) {
+		byte middle = (first + last) >> 1;
+		char letter = pgm_read_byte(&TEXT_GRAMMAR[middle].letter);
+		if (letter == *s) {
+			rule = &TEXT_GRAMMAR[middle];
+			break;
+		}
+		if (letter < *s)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+	if (rule != NULL) {
+		++s;
+		op = pgm_read_byte(&rule->op);
+		word max = pgm_read_word(&rule->max);
+		switch(pgm_read_byte(&rule->argument)) {
+			case TEXT_ARG_NUMBER: 			
+					value = 0;
+					return parseNumber(s, max, value);
+			case TEXT_ARG_NUMBER_OR_MAX: 	
+					value = max;
+					return parseNumber(s, max, value);
+			case TEXT_ARG_BITS: 			
+					return parseBits(s, max, value);
+		}
+		value = 0;
+		return DCC_PARSE_OK;
+	}
+	if (isTerminator(*s))
+		return DCC_PARSE_MISSING_ARGUMENT;
+
+	return (group == TEXT_GROUP_ADDRESS) ? DCC_PARSE_UNKNOWN_ADDRESS : DCC_PARSE_UNKNOWN_COMMAND;
+}
+
+// Missing number leaves value unchanged
+byte DccPacket::parseNumber(const char*& s, word max, word& value) {
+	if (!isDigit(*s))
+		return DCC_PARSE_OK;
+
+	// v * 10 + 9 can not overflow below the bound, so no division is needed per digit
+	word v = 0;
+	while (isDigit(*s)) {
+		if (v > (0xFFFF - 9) / 10)
+			return DCC_PARSE_OUT_OF_RANGE;
+		v = v * 10 + (*s - '0');
+		if (v > max)
+			return DCC_PARSE_OUT_OF_RANGE;
+		++s;
+	}
+	value = v;
+	return DCC_PARSE_OK;
+}
+
+inline byte DccPacket::parseBits(const char*& s, byte count, word& value) {
+	value = 0;
+	for (byte i = 0; i < count; ++i, ++s) {
+		if (isTerminator(*s))
+			return DCC_PARSE_MISSING_ARGUMENT;
+		if (parseBoolean(*s))
+			value |= (1 << i);
+	}
+	return DCC_PARSE_OK;
+}
+
+
 // Process Dcc Hex Command
 // All Hex Characters are CAPITAL
 // dcc_info, dcc_data[0], ..., dcc_data[dcc_info_size-2]
 DccPacket* DccPacket::parseDccHexCommand(const char* s) {
+	return parseDccHex(s) == DCC_PARSE_OK ? this : NULL;
+}
+
+byte DccPacket::parseDccHex(const char*& s) {
+	if (!isHex(s[0]) || !isHex(s[1]))
+		return isTerminator(s[0]) || isTerminator(s[1]) ? DCC_PARSE_MISSING_ARGUMENT : DCC_PARSE_INVALID_HEX;
+
 	dcc_info  = parseHex(*s++) << 4;
 	dcc_info |= parseHex(*s++);
-	int e = size() - 1;
+	byte e = size() - 1;
 	dcc_data[e] = 0;
-	for(int i = 0; i < e; ++i) {
+	for(byte i = 0; i < e; ++i) {
+		if (!isHex(s[0]) || !isHex(s[1]))
+			return isTerminator(s[0]) || isTerminator(s[1]) ? DCC_PARSE_MISSING_ARGUMENT : DCC_PARSE_INVALID_HEX;
+
 		dcc_data[i]  = parseHex(*s++) << 4;
 		dcc_data[i] |= parseHex(*s++);
 		dcc_data[e] ^= dcc_data[i];
 	}
-	return this;
+	return isTerminator(*s) ? DCC_PARSE_OK : DCC_PARSE_EXTRA_CHARACTERS;
 }
 
 // Address:
@@ -36,31 +297,26 @@ DccPacket* DccPacket::parseDccHexCommand(const char* s) {
 // B####P#O# - Basic Accessory Decoder Address (9bit), Port, Output. Missing # or 511 - Broadcast
 // E#### - Extended Accessory Decoder Address (11bit). Missing # or 2047 - Broadcast
 DccPacket*  DccPacket::parseDccTextCommand(const char* s) {
-	switch(*s++) {
-		case 'm': 	if (!mfAddress7(parseNumber(s)).parseDccTextMFCommand(s))
-						break;
-				  	return this;
-		case 'M': 	if (!mfAddress14(parseNumber(s)).parseDccTextMFCommand(s))
-					  	break;
-				  	return this;
-		case 'B': 	{
-				  	word address = (isDigit(*(s)) ? parseNumber(s) : DCC_BA_ADDRESS_BROADCAST);
-				  	if (*s++ != 'P')
-				  		break;
-				  	byte port = parseNumber(s);		
-				  	if (*s++ != 'O')
-				  		break;
-				  	byte output = parseNumber(s);
-				  	if (!baAddress(address, port, output).parseDccTextBACommand(s))
-				  		break;
-				  	return this;
-				  }
-		case 'E': 	if (!eaAddress(isDigit(*(s)) ? parseNumber(s) : DCC_EA_ADDRESS_BROADCAST).parseDccTextEACommand(s))
-				  		break;
-				  	return this;
+	return parseDccText(s) == DCC_PARSE_OK ? this : NULL;
+}
 
+byte DccPacket::parseDccText(const char*& s) {
+	byte op;
+	word address;
+	byte result = parseToken(TEXT_GROUP_ADDRESS, s, op, address);
+	if (result != DCC_PARSE_OK)
+		return result;
+
+	switch(op) {
+		case TEXT_OP_MF_ADDRESS_7: 	result = mfAddress7(address).parseDccTextMF(s); break;
+		case TEXT_OP_MF_ADDRESS_14:	result = mfAddress14(address).parseDccTextMF(s); break;
+		case TEXT_OP_BA_ADDRESS:	result = parseDccTextBACommand(address, s); break;
+		case TEXT_OP_EA_ADDRESS:	result = eaAddress(address).parseDccTextEACommand(s); break;
 	}
-	return NULL;
+	if (result != DCC_PARSE_OK)
+		return result;
+
+	return isTerminator(*s) ? DCC_PARSE_OK : DCC_PARSE_EXTRA_CHARACTERS;
 }
 
 // Command for Multi Function:
@@ -73,43 +329,137 @@ DccPacket*  DccPacket::parseDccTextCommand(const char* s) {
 // C####:  	  Function Set F9,  F10, F11, F12  	  					  (0/1 per position)
 // D########: Function Set F13, F14, F15, F16, F17, F18, F19, F20  	  (0/1 per position)
 // E########: Function Set F21, F22, F23, F24, F25, F26, F27, F28  	  (0/1 per position)
-boolean DccPacket::parseDccTextMFCommand(const char*& s) {
-	switch(*s++) {
-		case 'f': speed28(true, parseNumber(s)); return true;
-		case 'r': speed28(false, parseNumber(s)); return true;
-		case 'F': speed128(true, parseNumber(s)); return true;
-		case 'R': speed128(false, parseNumber(s)); return true;
-		case 'A': functionF0_F4(parseBoolean(s[0]), parseBoolean(s[1]), parseBoolean(s[2]), parseBoolean(s[3]), parseBoolean(s[4])); s+=5; return true;
-		case 'B': functionF5_F8(parseBoolean(s[0]), parseBoolean(s[1]), parseBoolean(s[2]), parseBoolean(s[3])); s+=4; return true;
-		case 'C': functionF9_F12(parseBoolean(s[0]), parseBoolean(s[1]), parseBoolean(s[2]), parseBoolean(s[3])); s+=4; return true;
-		case 'D': functionF13_F20(parseBoolean(s[0]), parseBoolean(s[1]), parseBoolean(s[2]), parseBoolean(s[3]), parseBoolean(s[4]), parseBoolean(s[5]), parseBoolean(s[6]), parseBoolean(s[7])); s+=8; return true;
-		case 'E': functionF21_F28(parseBoolean(s[0]), parseBoolean(s[1]), parseBoolean(s[2]), parseBoolean(s[3]), parseBoolean(s[4]), parseBoolean(s[5]), parseBoolean(s[6]), parseBoolean(s[7])); s+=8; return true;
-		default: break;
+// G########: Function Set F29 - F36  								  (0/1 per position)
+// H########: Function Set F37 - F44  								  (0/1 per position)
+// I########: Function Set F45 - F52  								  (0/1 per position)
+// J########: Function Set F53 - F60  								  (0/1 per position)
+// K########: Function Set F61 - F68  								  (0/1 per position)
+// S#####V#:  Binary State Off/On
+// W####D###: Write CV byte
+// V####D###: Verify CV byte
+// X####B#D#: Write CV bit
+// Y####B#D#: Verify CV bit
+byte DccPacket::parseDccTextMF(const char*& s) {
+	byte op;
+	word value;
+	byte result = parseToken(TEXT_GROUP_MF, s, op, value);
+	if (result != DCC_PARSE_OK)
+		return result;
+
+	switch(op) {
+		case TEXT_OP_SPEED_28_FORWARD: 	speed28(true, value); break;
+		case TEXT_OP_SPEED_28_REVERSE: 	speed28(false, value); break;
+		case TEXT_OP_SPEED_128_FORWARD:	speed128(true, value); break;
+		case TEXT_OP_SPEED_128_REVERSE:	speed128(false, value); break;
+		// Text position 0 is F0, but in the packet F0 is the bit 4 
+		case TEXT_OP_F0_F4:				functionF0_F4(((value & 0x01) << 4) | (value >> 1)); break;
+		case TEXT_OP_F5_F8:				functionF5_F8(value); break;
+		case TEXT_OP_F9_F12:			functionF9_F12(value); break;
+		case TEXT_OP_F13_F20:			functionF13_F20(value); break;
+		case TEXT_OP_F21_F28:			functionF21_F28(value); break;
+		case TEXT_OP_F29_F36:			functionF29_F36(value); break;
+		case TEXT_OP_F37_F44:			functionF37_F44(value); break;
+		case TEXT_OP_F45_F52:			functionF45_F52(value); break;
+		case TEXT_OP_F53_F60:			functionF53_F60(value); break;
+		case TEXT_OP_F61_F68:			functionF61_F68(value); break;
+		case TEXT_OP_BINARY_STATE: {
+						word on;
+						result = parseToken(TEXT_GROUP_MF_STATE_VALUE, s, op, on);
+						if (result != DCC_PARSE_OK)
+							return result;
+						binaryState(value, on != 0);
+						break;
+		}
+		case TEXT_OP_CV_WRITE:
+		case TEXT_OP_CV_VERIFY: {
+						if (value < DCC_CV_MIN)
+							return DCC_PARSE_OUT_OF_RANGE;
+						word data;
+						byte cvOp = op;
+						result = parseToken(TEXT_GROUP_CV_DATA, s, op, data);
+						if (result != DCC_PARSE_OK)
+							return result;
+						if (cvOp == TEXT_OP_CV_WRITE)
+							cvWrite(value, data);
+						else
+							cvVerify(value, data);
+						break;
+		}
+		case TEXT_OP_CV_BIT_WRITE:
+		case TEXT_OP_CV_BIT_VERIFY: {
+						if (value < DCC_CV_MIN)
+							return DCC_PARSE_OUT_OF_RANGE;
+						word bit;
+						word data;
+						byte cvOp = op;
+						result = parseToken(TEXT_GROUP_CV_BIT, s, op, bit);
+						if (result == DCC_PARSE_OK)
+							result = parseToken(TEXT_GROUP_CV_BIT_DATA, s, op, data);
+						if (result != DCC_PARSE_OK)
+							return result;
+						if (cvOp == TEXT_OP_CV_BIT_WRITE)
+							cvBitWrite(value, bit, data != 0);
+						else
+							cvBitVerify(value, bit, data != 0);
+						break;
+		}
+	}
+	return DCC_PARSE_OK;
+}
+
+byte DccPacket::parseDccTextAddress(const char*& s) {
+	byte op;
+	word address;
+	byte result = parseToken(TEXT_GROUP_ADDRESS, s, op, address);
+	if (result != DCC_PARSE_OK)
+		return result;
+
+	switch(op) {
+		case TEXT_OP_MF_ADDRESS_7: 	mfAddress7(address); return DCC_PARSE_OK;
+		case TEXT_OP_MF_ADDRESS_14:	mfAddress14(address); return DCC_PARSE_OK;
 	}
-	return false;
+	return DCC_PARSE_UNKNOWN_ADDRESS;
 }
 
 // Command for Basic Accessory:
 // A:    Activate Basic Accessory
 // D:    Deactivate Basic Accessory
-boolean DccPacket::parseDccTextBACommand(const char*& s) {
-	switch(*s) {
-		case 'A': activate(true); return true;
-		case 'D': activate(false); return true;
-	}
-	return false;
+byte DccPacket::parseDccTextBACommand(word address, const char*& s) {
+	byte op;
+	word port;
+	word output;
+	byte result = parseToken(TEXT_GROUP_BA_PORT, s, op, port);
+	if (result == DCC_PARSE_OK)
+		result = parseToken(TEXT_GROUP_BA_OUTPUT, s, op, output);
+	if (result != DCC_PARSE_OK)
+		return result;
+
+	baAddress(address, port, output);
+
+	word none;
+	result = parseToken(TEXT_GROUP_BA, s, op, none);
+	if (result != DCC_PARSE_OK)
+		return result;
+
+	activate(op == TEXT_OP_ACTIVATE);
+	return DCC_PARSE_OK;
 }
 
 // Command for Extended Accessory:
 // S##:  Set State
-boolean DccPacket::parseDccTextEACommand(const char*& s) {
-	switch(*s++) {
-		case 'S': state(parseNumber(s)); return true;
-	}
-	return false;
+byte DccPacket::parseDccTextEACommand(const char*& s) {
+	byte op;
+	word value;
+	byte result = parseToken(TEXT_GROUP_EA, s, op, value);
+	if (result != DCC_PARSE_OK)
+		return result;
+
+	state(value);
+	return DCC_PARSE_OK;
 }
 
 
+
 //Idle
 DccPacket* DccPacket::idle() {
 	dcc_info = DCC_INFO_SIZE_3 | DCC_INFO_NO_ACKNOWLEDGE | DCC_INFO_NO_REPEAT;
@@ -143,6 +493,10 @@ DccPacket& DccPacket::mfAddress(byte address0, byte address1) {
 	return *this;
 }
 
+DccPacket& DccPacket::mfAddress(word address) {
+	return (address <= DCC_ADDRESS_SHORT_MAX) ? mfAddress7(address) : mfAddress14(address);
+}
+
 DccPacket* DccPacket::speed14 (boolean forward, byte speed) {
 	dcc_info = DCC_INFO_NO_ACKNOWLEDGE 
    	         | ((speed < DCC_MF_SPEED_14_MIN ? DCC_REPEAT_STOP : DCC_REPEAT_SPEED) & DCC_INFO_REPEAT_MASK);
@@ -295,6 +649,115 @@ DccPacket* DccPacket::functionF21_F28(byte dcc_bits) {
 	return mfCommand2(DCC_MF_KIND8_F21_F28, dcc_bits);
 }
 
+DccPacket* DccPacket::functionF29_F36(byte dcc_bits) {
+	dcc_info = DCC_INFO_NO_ACKNOWLEDGE 
+   	         | (DCC_REPEAT_FUNCTION & DCC_INFO_REPEAT_MASK);
+	
+	return mfCommand2(DCC_MF_KIND8_F29_F36, dcc_bits);
+}
+
+DccPacket* DccPacket::functionF37_F44(byte dcc_bits) {
+	dcc_info = DCC_INFO_NO_ACKNOWLEDGE 
+   	         | (DCC_REPEAT_FUNCTION & DCC_INFO_REPEAT_MASK);
+	
+	return mfCommand2(DCC_MF_KIND8_F37_F44, dcc_bits);
+}
+
+DccPacket* DccPacket::functionF45_F52(byte dcc_bits) {
+	dcc_info = DCC_INFO_NO_ACKNOWLEDGE 
+   	         | (DCC_REPEAT_FUNCTION & DCC_INFO_REPEAT_MASK);
+	
+	return mfCommand2(DCC_MF_KIND8_F45_F52, dcc_bits);
+}
+
+DccPacket* DccPacket::functionF53_F60(byte dcc_bits) {
+	dcc_info = DCC_INFO_NO_ACKNOWLEDGE 
+   	         | (DCC_REPEAT_FUNCTION & DCC_INFO_REPEAT_MASK);
+	
+	return mfCommand2(DCC_MF_KIND8_F53_F60, dcc_bits);
+}
+
+DccPacket* DccPacket::functionF61_F68(byte dcc_bits) {
+	dcc_info = DCC_INFO_NO_ACKNOWLEDGE 
+   	         | (DCC_REPEAT_FUNCTION & DCC_INFO_REPEAT_MASK);
+	
+	return mfCommand2(DCC_MF_KIND8_F61_F68, dcc_bits);
+}
+
+DccPacket* DccPacket::functionGroup(byte function, unsigned long functions) {
+	if (function <= 4)
+		return functionF0_F4(((functions & 1) ? DCC_MF_FUNCTION_F0 : 0) 
+						   | ((functions >> 1) & (DCC_MF_FUNCTION_F1 | DCC_MF_FUNCTION_F2 | DCC_MF_FUNCTION_F3 | DCC_MF_FUNCTION_F4)));
+	if (function <= 8)
+		return functionF5_F8((functions >> 5) & DCC_MF_FUNCTION_F5_F8_MASK);
+	if (function <= 12)
+		return functionF9_F12((functions >> 9) & DCC_MF_FUNCTION_F9_F12_MASK);
+	if (function <= 20)
+		return functionF13_F20((functions >> 13) & 0xFF);
+	return functionF21_F28((functions >> 21) & 0xFF);
+}
+
+DccPacket* DccPacket::binaryState(word number, boolean on) {
+	if (number > DCC_MF_BINARY_STATE_SHORT_MAX)
+		return binaryStateLong(number, on);
+
+	dcc_info = DCC_INFO_NO_ACKNOWLEDGE 
+   	         | (DCC_REPEAT_FUNCTION & DCC_INFO_REPEAT_MASK);
+
+	return mfCommand2(DCC_MF_KIND8_SHORT_STATE_CONTROL, (on ? DCC_MF_BINARY_STATE_ON : 0) | (number & DCC_MF_BINARY_STATE_MASK));
+}
+
+DccPacket* DccPacket::binaryStateLong(word number, boolean on) {
+	dcc_info = DCC_INFO_NO_ACKNOWLEDGE 
+   	         | (DCC_REPEAT_FUNCTION & DCC_INFO_REPEAT_MASK);
+
+	return mfCommand3(DCC_MF_KIND8_LONG_STATE_CONTROL, 
+					  (on ? DCC_MF_BINARY_STATE_ON : 0) | (number & DCC_MF_BINARY_STATE_MASK),
+					  (number >> DCC_MF_BINARY_STATE_LONG_SHIFT) & 0xFF);
+}
+
+DccPacket* DccPacket::cvVerify(word cv, byte value) {
+	return cvAccess(DCC_CV_VERIFY, cv, value);
+}
+
+DccPacket* DccPacket::cvWrite(word cv, byte value) {
+	return cvAccess(DCC_CV_WRITE, cv, value);
+}
+
+DccPacket* DccPacket::cvBitVerify(word cv, byte bit, boolean value) {
+	byte data = DCC_CV_BIT_DATA 
+			  | DCC_CV_BIT_VERIFY 
+			  | (value ? DCC_CV_BIT_VALUE_1 : DCC_CV_BIT_VALUE_0) 
+			  | (bit & DCC_CV_BIT_MASK);
+	return cvAccess(DCC_CV_BIT_OP, cv, data);
+}
+
+DccPacket* DccPacket::cvBitWrite(word cv, byte bit, boolean value) {
+	byte data = DCC_CV_BIT_DATA 
+			  | DCC_CV_BIT_WRITE 
+			  | (value ? DCC_CV_BIT_VALUE_1 : DCC_CV_BIT_VALUE_0) 
+			  | (bit & DCC_CV_BIT_MASK);
+	return cvAccess(DCC_CV_BIT_OP, cv, data);
+}
+
+// CV#1 is sent as 0
+DccPacket* DccPacket::cvAccess(byte operation, word cv, byte data) {
+	dcc_info = DCC_INFO_NO_ACKNOWLEDGE 
+   	         | (DCC_REPEAT_CV & DCC_INFO_REPEAT_MASK);
+
+	cv -= DCC_CV_MIN;
+	return mfCommand3(DCC_MF_KIND4_CV_LONG_ACCESS | operation | ((cv >> 8) & DCC_CV_MASK_1), 
+					  cv & DCC_CV_MASK_2, 
+					  data);
+}
+
+void DccPacket::updateErrorByte() {
+	byte e = size() - 1;
+	dcc_data[e] = 0;
+	for (byte i = 0; i < e; ++i)
+		dcc_data[e] ^= dcc_data[i];
+}
+
 DccPacket* DccPacket::mfCommand1(byte command) {
 	if (isAddressShort()) {
 		dcc_info |= DCC_INFO_SIZE_3;
@@ -323,6 +786,23 @@ DccPacket* DccPacket::mfCommand2(byte command1, byte command2) {
 	return this;
 }
 
+DccPacket* DccPacket::mfCommand3(byte command1, byte command2, byte command3) {
+	if (isAddressShort()) {
+		dcc_info |= DCC_INFO_SIZE_5;
+		dcc_data[1] = command1;
+		dcc_data[2] = command2;
+		dcc_data[3] = command3;
+		dcc_data[4] = dcc_data[0] ^ dcc_data[1] ^ dcc_data[2] ^ dcc_data[3];
+	} else {
+		dcc_info |= DCC_INFO_SIZE_6;
+		dcc_data[2] = command1;
+		dcc_data[3] = command2;
+		dcc_data[4] = command3;
+		dcc_data[5] = dcc_data[0] ^ dcc_data[1] ^ dcc_data[2] ^ dcc_data[3] ^ dcc_data[4];
+	}
+	return this;
+}
+
 	// Basic Accessory
 DccPacket& DccPacket::baBroadcast(byte port, byte output) {
 	dcc_data[0] = DCC_ADDRESS_ACCESSORY_MIN + DCC_BA_ADDRESS_BROADCAST_1;
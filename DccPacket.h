@@ -61,6 +61,47 @@
 #define DCC_INFO_REPEAT_7                  (0x07)
 #define DCC_INFO_REPEAT_MAX                (0x0F)
 
+// Dcc Command Parse Result
+//======================================================
+#define DCC_PARSE_OK                       (0)
+#define DCC_PARSE_UNKNOWN_ADDRESS          (1)
+#define DCC_PARSE_UNKNOWN_COMMAND          (2)
+#define DCC_PARSE_MISSING_ARGUMENT         (3)
+#define DCC_PARSE_OUT_OF_RANGE             (4)
+#define DCC_PARSE_INVALID_HEX              (5)
+#define DCC_PARSE_EXTRA_CHARACTERS         (6)
+
+// Dcc Packet Kind
+//======================================================
+// Result of DccPacket::kind(), the single classification of the packet instruction
+#define DCC_KIND_UNKNOWN                   (0)
+#define DCC_KIND_IDLE                      (1)
+#define DCC_KIND_DECODER_RESET             (2)
+#define DCC_KIND_DECODER_HARD_RESET        (3)
+#define DCC_KIND_DECODER_CONTROL           (4)
+#define DCC_KIND_CONSIST_CONTROL           (5)
+#define DCC_KIND_SPEED_28                  (6)
+#define DCC_KIND_SPEED_128                 (7)
+#define DCC_KIND_F0_F4                     (8)
+#define DCC_KIND_F5_F8                     (9)
+#define DCC_KIND_F9_F12                    (10)
+#define DCC_KIND_F13_F20                   (11)
+#define DCC_KIND_F21_F28                   (12)
+#define DCC_KIND_CV_SHORT                  (13)
+#define DCC_KIND_CV_LONG                   (14)
+#define DCC_KIND_BA_OUTPUT                 (15)
+#define DCC_KIND_EA_STATE                  (16)
+#define DCC_KIND_F29_F36                   (17)
+#define DCC_KIND_F37_F44                   (18)
+#define DCC_KIND_F45_F52                   (19)
+#define DCC_KIND_F53_F60                   (20)
+#define DCC_KIND_F61_F68                   (21)
+#define DCC_KIND_BINARY_STATE_SHORT        (22)
+#define DCC_KIND_BINARY_STATE_LONG         (23)
+
+// Separates commands in a batch line: "M3f10;M3A10000;B12P0O1A"
+#define DCC_COMMAND_SEPARATOR              (';')
+
 struct DccPacket {
 
 public:
@@ -80,6 +121,16 @@ public:
     //+----------------------------------------------------+
     DccPacket*                 next;
 
+    //+----------------------------------------------------+
+    //| Time (millis) to send the packet from DccHeap      |
+    //+----------------------------------------------------+
+    word                       deadline;
+
+    //+----------------------------------------------------+
+    //| Traffic category, set by DccCommander              |
+    //+----------------------------------------------------+
+    byte                       traffic;
+
 public:
 	// dcc_info functions
 	byte 		size();
@@ -107,6 +158,11 @@ public:
 
 	boolean 	isBroadcast();
 
+	// Returns DCC_KIND_XXX of the packet
+	byte 		kind();
+	// Index of the first instruction byte for Multi Function packet
+	byte 		mfCommandIndex();
+
 public:
 	// Building Functions
 
@@ -115,6 +171,10 @@ public:
 	// dcc_info, dcc_data[0], ..., dcc_data[dcc_info_size-1]
 	DccPacket*  parseDccHexCommand(const char*s);
 
+	// Same as parseDccHexCommand(..), but returns DCC_PARSE_XXX result,
+	// and leaves s pointing to the first unprocessed (or erroneous) character.
+	byte  		parseDccHex(const char*& s);
+
 	// Process Dcc Text Command
 	// All Numbers are decimal
 	// Has to parts: Address, and Command
@@ -135,6 +195,16 @@ public:
 	// C####:  	  Function Set F9,  F10, F11, F12  	  					  (0/1 per position)
 	// D########: Function Set F13, F14, F15, F16, F17, F18, F19, F20  	  (0/1 per position)
 	// E########: Function Set F21, F22, F23, F24, F25, F26, F27, F28  	  (0/1 per position)
+	// G########: Function Set F29 - F36  								  (0/1 per position)
+	// H########: Function Set F37 - F44  								  (0/1 per position)
+	// I########: Function Set F45 - F52  								  (0/1 per position)
+	// J########: Function Set F53 - F60  								  (0/1 per position)
+	// K########: Function Set F61 - F68  								  (0/1 per position)
+	// S#####V#:  Binary State 0 - 32767 Off/On. 0 - all states. Short form is used for states below 128
+	// W####D###: Write CV 1 - 1024 byte (Operations Mode)
+	// V####D###: Verify CV 1 - 1024 byte (Operations Mode)
+	// X####B#D#: Write CV 1 - 1024 bit 0 - 7 (Operations Mode)
+	// Y####B#D#: Verify CV 1 - 1024 bit 0 - 7 (Operations Mode)
 
 	// Command for Basic Accessory:
 	// A:    Activate Basic Accessory
@@ -143,8 +213,20 @@ public:
 	// Command for Extended Accessory:
 	// S##:  Set State
 
+	// Numbers out of the range, missing function bits, or characters after the command 
+	// (except the end of line and DCC_COMMAND_SEPARATOR) are rejected.
 	DccPacket*  parseDccTextCommand(const char* s);
 
+	// Same as parseDccTextCommand(..), but returns DCC_PARSE_XXX result,
+	// and leaves s pointing to the first unprocessed (or erroneous) character.
+	byte  		parseDccText(const char*& s);
+
+	// Parts of the Multi Function text command, for several commands to the same decoder:
+	// parseDccTextAddress(..) accepts m### and M#### only, 
+	// parseDccTextMF(..) parses one command to the address already set.
+	byte  		parseDccTextAddress(const char*& s);
+	byte  		parseDccTextMF(const char*& s);
+
 	//Idle
 	DccPacket* idle();
 
@@ -153,6 +235,8 @@ public:
 	DccPacket& mfAddress7 (byte address);
 	DccPacket& mfAddress14(word address);
 	DccPacket& mfAddress(byte address0, byte address1);
+	// Short form for the addresses up to DCC_ADDRESS_SHORT_MAX, long form above
+	DccPacket& mfAddress(word address);
 
 	DccPacket* speed14 (boolean forward, byte speed);
 	DccPacket* speed28 (boolean forward, byte speed);
@@ -170,9 +254,35 @@ public:
 	DccPacket* functionF9_F12 (byte dcc_bits);
 	DccPacket* functionF13_F20(byte dcc_bits);
 	DccPacket* functionF21_F28(byte dcc_bits);
+	DccPacket* functionF29_F36(byte dcc_bits);
+	DccPacket* functionF37_F44(byte dcc_bits);
+	DccPacket* functionF45_F52(byte dcc_bits);
+	DccPacket* functionF53_F60(byte dcc_bits);
+	DccPacket* functionF61_F68(byte dcc_bits);
+
+	// Function group instruction of the function F0 - F28, the bits of the whole group
+	// are taken from functions, bit N is FN.
+	DccPacket* functionGroup(byte function, unsigned long functions);
+
+	// Selects the short form for states below 128. State 0 sets all short form states,
+	// use binaryStateLong(0, on) to set all 32767 states. Binary states are never refreshed,
+	// so the packet is repeated as the function command.
+	DccPacket* binaryState    (word number, boolean on);
+	DccPacket* binaryStateLong(word number, boolean on);
+
+	// Operations Mode CV access. CV from 1 to 1024.
+	// Decoder acts on two identical packets, so the packet is repeated DCC_REPEAT_CV times.
+	DccPacket* cvVerify   (word cv, byte value);
+	DccPacket* cvWrite    (word cv, byte value);
+	DccPacket* cvBitVerify(word cv, byte bit, boolean value);
+	DccPacket* cvBitWrite (word cv, byte bit, boolean value);
 
 	DccPacket* mfCommand1(byte command);
 	DccPacket* mfCommand2(byte command1, byte command2);
+	DccPacket* mfCommand3(byte command1, byte command2, byte command3);
+
+	// Error byte of the packet size, after dcc_data is changed in place
+	void 		updateErrorByte();
 
 	// Basic Accessory
 	DccPacket& baBroadcast(byte port, byte output);
@@ -186,15 +296,21 @@ public:
 
 	DccPacket* state(byte newState);
 
-public:
-	boolean parseDccTextMFCommand(const char*& s);
-	boolean parseDccTextBACommand(const char*& s);
-	boolean parseDccTextEACommand(const char*& s);
+private:
+	byte parseDccTextBACommand(word address, const char*& s);
+	byte parseDccTextEACommand(const char*& s);
+
+	DccPacket* cvAccess(byte operation, word cv, byte data);
 
+public:
 	static byte 	parseHex(char ch);
+	static boolean 	isHex(char ch);
 	static boolean 	isDigit(char ch);
+	static boolean 	isTerminator(char ch);
 	static boolean  parseBoolean(char ch);
-	static word 	parseNumber(const char*& ch);
+	static byte 	parseNumber(const char*& ch, word max, word& value);
+	static byte 	parseBits(const char*& ch, byte count, word& value);
+	static byte 	parseToken(byte group, const char*& ch, byte& op, word& value);
 
 };
 
@@ -279,21 +395,31 @@ inline boolean DccPacket::isBroadcast() {
 		|| (dcc_data[1] == (DCC_ACCESSORY_EXTENDED | DCC_EA_ADDRESS_BROADCAST_2 | DCC_EA_ADDRESS_BROADCAST_3));
 }
 
+inline byte DccPacket::mfCommandIndex() {
+	return isAddressShort() ? 1 : 2;
+}
+
 inline byte DccPacket::parseHex(char ch) {
     return 0xF & (('0' <= ch && ch <= '9') ? (uint8_t)(ch - '0') : (uint8_t)(ch - 'A' + 10));
 };
 
+inline boolean DccPacket::isHex(char ch) {
+	return ('0' <= ch && ch <= '9') || ('A' <= ch && ch <= 'F');
+}
+
 inline boolean DccPacket::isDigit(char ch) {
 	return ('0' <= ch && ch <= '9');
 }
 
-inline word DccPacket::parseNumber(const char*& ch) {
-	int v = 0;
-	while (isDigit(*ch)) {
-		v = (v * 10) + *ch++ -'0';
+inline boolean DccPacket::isTerminator(char ch) {
+	switch(ch) {
+		case '\0':
+		case '\r':
+		case '\n':
+		case DCC_COMMAND_SEPARATOR: return true;
 	}
-    return v;
-};
+	return false;
+}
 
 inline boolean DccPacket::parseBoolean(char ch) {
 	switch(ch) {
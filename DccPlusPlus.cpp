@@ -0,0 +1,334 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#include <Arduino.h>
+#include "DccConfig.h"
+#include "DccPlusPlus.h"
+#include "DccCommander.h"
+#include "DccStateKeeper.h"
+
+// Parser states
+#define DCC_PLUS_STATE_IDLE		(0)		// waiting for '<'
+#define DCC_PLUS_STATE_OPCODE	(1)		// waiting for the opcode
+#define DCC_PLUS_STATE_SPACE	(2)		// waiting for the parameter
+#define DCC_PLUS_STATE_NUMBER	(3)		// in the parameter
+
+static DccPacket* newLocoPacket(long cab) {
+	DccPacket* packet = DccCmd.newPacket();
+	if (packet == NULL)
+		return NULL;
+	packet->mfAddress((word) cab);
+	return packet;
+}
+
+// 28 steps 01DCSSSS: CSSSS 0 - 1 stop, 2 - 3 emergency stop, 4 - 31 speed 1 - 28 scaled to 2 - 127
+static byte speed28To128(byte speed) {
+	byte step = ((speed & DCC_MF_SPEED_28_HBIT_MASK) << DCC_MF_SPEED_28_HBIT_SHIFT)
+			  | ((speed & DCC_MF_SPEED_28_LBIT_MASK) >> DCC_MF_SPEED_28_LBIT_SHIFT);
+	byte direction = (speed & DCC_MF_KIND3_MASK) == DCC_MF_KIND3_FORWARD_OPERATION
+				   ? DCC_MF_SPEED_128_FORWARD : DCC_MF_SPEED_128_REVERSE;
+	if (step < DCC_MF_SPEED_28_EMERGENCY_STOP)
+		return direction | DCC_MF_SPEED_128_STOP;
+	if (step < DCC_MF_SPEED_28_MIN)
+		return direction | DCC_MF_SPEED_128_EMERGENCY_STOP;
+	return direction | ((step - DCC_MF_SPEED_28_MIN + 1) * (DCC_MF_SPEED_128_MAX - 1) / (DCC_MF_SPEED_28_MAX - DCC_MF_SPEED_28_MIN + 1) + 1);
+}
+
+static boolean isCab(long cab) {
+	return cab > 0 && cab <= DCC_PLUS_CAB_MAX;
+}
+
+static boolean isBit(long value) {
+	return value == 0 || value == 1;
+}
+
+DccPlusPlus::DccPlusPlus(Stream& stream)
+	: stream(&stream) {
+	paramCount = 0;
+	opcode = 0;
+	state = DCC_PLUS_STATE_IDLE;
+	negative = false;
+	failed = false;
+}
+
+void DccPlusPlus::loop() {
+	while (stream->available() > 0)
+		receive(stream->read());
+}
+
+void DccPlusPlus::receive(char ch) {
+	if (ch == DCC_PLUS_COMMAND_START) {
+		paramCount = 0;
+		opcode = 0;
+		state = DCC_PLUS_STATE_OPCODE;
+		failed = false;
+		return;
+	}
+	if (state == DCC_PLUS_STATE_IDLE)
+		return;
+
+	if (ch == DCC_PLUS_COMMAND_END) {
+		if (state == DCC_PLUS_STATE_NUMBER)
+			endParam();
+		state = DCC_PLUS_STATE_IDLE;
+		execute();
+		return;
+	}
+
+	boolean space = (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n');
+	switch (state) {
+		case DCC_PLUS_STATE_OPCODE:
+			if (!space) {
+				opcode = ch;
+				state = DCC_PLUS_STATE_SPACE;
+			}
+			break;
+		case DCC_PLUS_STATE_SPACE:
+			if (!space)
+				startParam(ch);
+			break;
+		case DCC_PLUS_STATE_NUMBER:
+			if (space)
+				endParam();
+			else
+				addDigit(ch);
+			break;
+	}
+}
+
+void DccPlusPlus::startParam(char ch) {
+	state = DCC_PLUS_STATE_NUMBER;
+	if (paramCount == DCC_PLUS_PARAM_MAX_COUNT) {
+		failed = true;
+		return;
+	}
+	params[paramCount++] = 0;
+	negative = (ch == '-');
+	if (!negative)
+		addDigit(ch);
+}
+
+// Value is kept positive while parsed, the sign is applied at the end
+void DccPlusPlus::addDigit(char ch) {
+	if (ch < '0' || ch > '9' || failed) {
+		failed = true;
+		return;
+	}
+	long& value = params[paramCount - 1];
+	value = value * 10 + (ch - '0');
+	if (value > DCC_PLUS_PARAM_MAX)
+		failed = true;
+}
+
+void DccPlusPlus::endParam() {
+	state = DCC_PLUS_STATE_SPACE;
+	if (failed || !negative)
+		return;
+	long& value = params[paramCount - 1];
+	if (value == 0)
+		failed = true;
+	value = -value;
+}
+
+void DccPlusPlus::execute() {
+	boolean done = false;
+	if (!failed) {
+		switch (opcode) {
+			case DCC_PLUS_THROTTLE:			done = handleThrottle(); break;
+			case DCC_PLUS_FUNCTION:			done = handleFunction(); break;
+			case DCC_PLUS_FUNCTION_ONE:		done = handleFunctionOne(); break;
+			case DCC_PLUS_ACCESSORY:		done = handleAccessory(); break;
+			case DCC_PLUS_CV_WRITE:			done = handleCvWrite(); break;
+			case DCC_PLUS_CV_BIT_WRITE:		done = handleCvBitWrite(); break;
+			case DCC_PLUS_POWER_ON:			done = handlePower(true); break;
+			case DCC_PLUS_POWER_OFF:		done = handlePower(false); break;
+			case DCC_PLUS_STATUS:			done = handleStatus(); break;
+			case DCC_PLUS_EMERGENCY_STOP:	done = handleEmergencyStop(); break;
+		}
+	}
+	if (!done)
+		stream->print(DCC_PLUS_REPLY_FAILED);
+}
+
+// Speed -1 is sent as the emergency stop 1, speed 1 - 126 as 2 - 127
+boolean DccPlusPlus::handleThrottle() {
+	if (paramCount < 3 || paramCount > 4)
+		return false;
+	const long* p = params + paramCount - 3;
+	long cab = p[0];
+	long speed = p[1];
+	long direction = p[2];
+	if (!isCab(cab) || speed < -1 || speed > DCC_MF_SPEED_128_MAX - 1 || !isBit(direction))
+		return false;
+
+	DccPacket* packet = newLocoPacket(cab);
+	if (packet == NULL)
+		return false;
+	byte dccSpeed = speed < 0 ? DCC_MF_SPEED_128_EMERGENCY_STOP : speed + (speed > 0);
+	DccCmd.send(packet->speed128(direction, dccSpeed));
+
+	if (paramCount == 3) {
+		printLocoState(cab);
+		return true;
+	}
+	stream->print("<T ");
+	stream->print(params[0]);
+	stream->print(' ');
+	stream->print(speed < 0 ? 0 : speed);
+	stream->print(' ');
+	stream->print(direction);
+	stream->print('>');
+	return true;
+}
+
+// BYTE1: 100DDDDD - F0 F4 F3 F2 F1, 1011DDDD - F8 - F5, 1010DDDD - F12 - F9
+boolean DccPlusPlus::handleFunction() {
+	if (paramCount < 2 || !isCab(params[0]) || params[1] < 0 || params[1] > 0xFF)
+		return false;
+	byte command = params[1];
+
+	if (paramCount == 3) {
+		if ((command != DCC_PLUS_FUNCTION_F13_F20 && command != DCC_PLUS_FUNCTION_F21_F28)
+		 || params[2] < 0 || params[2] > 0xFF)
+			return false;
+		DccPacket* packet = newLocoPacket(params[0]);
+		if (packet == NULL)
+			return false;
+		if (command == DCC_PLUS_FUNCTION_F13_F20)
+			packet->functionF13_F20(params[2]);
+		else
+			packet->functionF21_F28(params[2]);
+		DccCmd.send(packet);
+		return true;
+	}
+
+	boolean f0_f4 = (command & DCC_MF_KIND3_MASK) == DCC_MF_KIND3_F0_F4;
+	boolean f5_f8 = (command & DCC_MF_KIND4_MASK) == DCC_MF_KIND4_F5_F8;
+	boolean f9_f12 = (command & DCC_MF_KIND4_MASK) == DCC_MF_KIND4_F9_F12;
+	if (paramCount != 2 || !(f0_f4 || f5_f8 || f9_f12))
+		return false;
+	DccPacket* packet = newLocoPacket(params[0]);
+	if (packet == NULL)
+		return false;
+	if (f0_f4)
+		packet->functionF0_F4(command & DCC_MF_FUNCTION_F0_F4_MASK);
+	else if (f5_f8)
+		packet->functionF5_F8(command & DCC_MF_FUNCTION_F5_F8_MASK);
+	else
+		packet->functionF9_F12(command & DCC_MF_FUNCTION_F9_F12_MASK);
+	DccCmd.send(packet);
+	return true;
+}
+
+// Whole function group is sent, the others are kept from the state
+boolean DccPlusPlus::handleFunctionOne() {
+	if (paramCount != 3 || !isCab(params[0]) || params[1] < 0 || params[1] > DCC_PLUS_FUNCTION_MAX || !isBit(params[2]))
+		return false;
+	DccPacket* packet = newLocoPacket(params[0]);
+	if (packet == NULL)
+		return false;
+	DccCmd.send(DccState.locoFunction(packet, params[1], params[2] ? DCC_STATE_FUNCTION_ON : DCC_STATE_FUNCTION_OFF));
+
+	printLocoState(params[0]);
+	return true;
+}
+
+// Activates the output, DCC++ doesn't deactivate it
+boolean DccPlusPlus::handleAccessory() {
+	long address;
+	long subaddress;
+	if (paramCount == 3) {
+		address = params[0];
+		subaddress = params[1];
+	} else if (paramCount == 2 && params[0] > 0 && params[0] <= DCC_PLUS_ACCESSORY_LINEAR_MAX) {
+		address = (params[0] - 1) / 4 + 1;
+		subaddress = (params[0] - 1) % 4;
+	} else
+		return false;
+
+	long output = params[paramCount - 1];
+	if (address < 0 || address > DCC_PLUS_ACCESSORY_ADDRESS_MAX || subaddress < 0 || subaddress > 3 || !isBit(output))
+		return false;
+	DccPacket* packet = DccCmd.newPacket();
+	if (packet == NULL)
+		return false;
+	DccCmd.send(packet->baAddress(address, subaddress, output).activate(true));
+	return true;
+}
+
+boolean DccPlusPlus::handleCvWrite() {
+	if (paramCount != 3 || !isCab(params[0]) || params[1] < 1 || params[1] > DCC_CV_MAX || params[2] < 0 || params[2] > 0xFF)
+		return false;
+	DccPacket* packet = newLocoPacket(params[0]);
+	if (packet == NULL)
+		return false;
+	DccCmd.send(packet->cvWrite(params[1], params[2]));
+	return true;
+}
+
+boolean DccPlusPlus::handleCvBitWrite() {
+	if (paramCount != 4 || !isCab(params[0]) || params[1] < 1 || params[1] > DCC_CV_MAX
+	 || params[2] < 0 || params[2] > 7 || !isBit(params[3]))
+		return false;
+	DccPacket* packet = newLocoPacket(params[0]);
+	if (packet == NULL)
+		return false;
+	DccCmd.send(packet->cvBitWrite(params[1], params[2], params[3]));
+	return true;
+}
+
+boolean DccPlusPlus::handlePower(boolean on) {
+	if (paramCount != 0)
+		return false;
+	DccCmd.power(on);
+	stream->print(on ? "<p1>" : "<p0>");
+	return true;
+}
+
+boolean DccPlusPlus::handleStatus() {
+	if (paramCount != 0)
+		return false;
+	stream->print(DccCmd.power() ? "<p1>" : "<p0>");
+	stream->print(DCC_PLUS_REPLY_INFO);
+	return true;
+}
+
+boolean DccPlusPlus::handleEmergencyStop() {
+	if (paramCount != 0)
+		return false;
+	DccPacket* packet = DccCmd.newPacket();
+	if (packet == NULL)
+		return false;
+	DccCmd.send(packet->mfBroadcast().speed28(true, DCC_MF_SPEED_28_EMERGENCY_STOP));
+	return true;
+}
+
+// <l CAB 0 SPEED_BYTE FUNCTIONS>: SPEED_BYTE is DRRRRRRR, D - forward, R - speed in 128 steps (1 - emergency stop)
+void DccPlusPlus::printLocoState(word cab) {
+	DccPacket packet;
+	packet.mfAddress(cab);
+
+	byte speed;
+	boolean speed128;
+	unsigned long functions;
+	DccState.locoState(&packet, speed, speed128, functions);
+
+	if (!speed128)
+		speed = speed28To128(speed);
+
+	stream->print("<l ");
+	stream->print((unsigned int) cab);
+	stream->print(" 0 ");
+	stream->print((unsigned int) speed);
+	stream->print(' ');
+	stream->print(functions);
+	stream->print('>');
+}
@@ -0,0 +1,99 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#ifndef __DCC_PLUS_PLUS_H__
+#define __DCC_PLUS_PLUS_H__
+
+#include <Arduino.h>
+#include "DccConfig.h"
+
+// DCC++ Serial Protocol
+//======================================================
+// Command is "<" opcode, integer parameters separated by spaces, ">".
+// The first parameter could follow the opcode without the space: <t1 3 20 1>.
+#define DCC_PLUS_COMMAND_START			('<')
+#define DCC_PLUS_COMMAND_END			('>')
+#define DCC_PLUS_PARAM_MAX_COUNT		(5)
+#define DCC_PLUS_PARAM_MAX				(32767)
+
+// <t REG CAB SPEED DIR> replies <T REG SPEED DIR>, <t CAB SPEED DIR> replies <l CAB 0 SPEED_BYTE FUNCTIONS>.
+// SPEED -1 is the emergency stop, 0 - 126 the speed in 128 steps. DIR 1 is forward.
+#define DCC_PLUS_THROTTLE				('t')
+// <f CAB BYTE1> for F0 - F12 with the DCC instruction byte, <f CAB 222|223 BYTE2> for F13 - F20 and F21 - F28
+#define DCC_PLUS_FUNCTION				('f')
+#define DCC_PLUS_FUNCTION_F13_F20		(222)
+#define DCC_PLUS_FUNCTION_F21_F28		(223)
+// <F CAB FUNCTION 0|1> replies <l CAB 0 SPEED_BYTE FUNCTIONS>
+#define DCC_PLUS_FUNCTION_ONE			('F')
+// <a ADDRESS SUBADDRESS 0|1> or <a LINEAR_ADDRESS 0|1>, linear address from 1
+#define DCC_PLUS_ACCESSORY				('a')
+#define DCC_PLUS_ACCESSORY_ADDRESS_MAX	(511)
+#define DCC_PLUS_ACCESSORY_LINEAR_MAX	(2044)
+// <w CAB CV VALUE>, <b CAB CV BIT VALUE> on the main track
+#define DCC_PLUS_CV_WRITE				('w')
+#define DCC_PLUS_CV_BIT_WRITE			('b')
+// <1>, <0> reply <p1>, <p0>. <s> replies the power and the station info.
+#define DCC_PLUS_POWER_ON				('1')
+#define DCC_PLUS_POWER_OFF				('0')
+#define DCC_PLUS_STATUS					('s')
+// <!> stops all the locomotives, the track power stays on
+#define DCC_PLUS_EMERGENCY_STOP			('!')
+
+#define DCC_PLUS_CAB_MAX				(10239)
+#define DCC_PLUS_FUNCTION_MAX			(28)
+
+#define DCC_PLUS_REPLY_FAILED			"<X>"
+#define DCC_PLUS_REPLY_INFO				"<iDCC++ BASE STATION FOR ARDUINO DCC LIBRARY / SERIAL: V-1.0>"
+
+// DCC++ and DCC-EX serial commands of JMRI and the throttles, in front of DccCommander.
+// The commands are parsed character by character as they come, without a line buffer,
+// so any stream and any line ending work, and the text outside of <> is ignored.
+// Locomotive and accessory commands are built into packets and passed to DccCommander::send(),
+// locomotive replies are read from DccStateKeeper. Invalid or unsupported command replies <X>.
+class DccPlusPlus {
+private:
+	Stream*	stream;
+	long	params[DCC_PLUS_PARAM_MAX_COUNT];
+	byte	paramCount;
+	char	opcode;
+	byte	state;
+	boolean	negative;
+	boolean	failed;		// rest of the command is skipped, <X> is replied at the end
+
+public:
+	DccPlusPlus(Stream& stream);
+
+	// Handles all the characters received from the stream
+	void 	loop();
+
+	// Handles one character of the command, the replies go to the stream
+	void 	receive(char ch);
+
+private:
+	void 	startParam(char ch);
+	void 	addDigit(char ch);
+	void 	endParam();
+	void 	execute();
+
+	boolean handleThrottle();
+	boolean handleFunction();
+	boolean handleFunctionOne();
+	boolean handleAccessory();
+	boolean handleCvWrite();
+	boolean handleCvBitWrite();
+	boolean handlePower(boolean on);
+	boolean handleStatus();
+	boolean handleEmergencyStop();
+
+	void 	printLocoState(word cab);
+};
+
+#endif //__DCC_PLUS_PLUS_H__
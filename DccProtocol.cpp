@@ -52,13 +52,14 @@ void DccProtocol::startTest() {
 
 void DccProtocol::power(boolean on) {
 	if (on) {
-    	if (state != STATE_POWER_OFF)
-        	return;
+		if (state != STATE_POWER_OFF)
+			return;
+
 		state = STATE_CUTOUT_RUN;
 		enableTimer();
 	} else {
 		disableTimer();
-    	state = STATE_POWER_OFF;
+		state = STATE_POWER_OFF;
 		digitalWrite(DCC_PIN_OUT_A, LOW);
 		digitalWrite(DCC_PIN_OUT_B, LOW);
 		
@@ -68,7 +69,7 @@ void DccProtocol::power(boolean on) {
 }
 
 boolean DccProtocol::power() {
-	return state == STATE_POWER_OFF;
+	return state != STATE_POWER_OFF;
 }
 
 #if defined(__AVR_ATmega168__) || defined(__AVR_ATmega168P__) || defined(__AVR_ATmega328P__)
@@ -210,6 +211,25 @@ void DCC_FTM_ISR(void) {
 #define RESET_INTERRUPT() DCC_FTM_SC &= ~(FTM_SC_TOF)
 #define SET_COUNTER(v) DCC_FTM_MOD = (v)
 
+#elif defined(DCC_HOST)
+
+word DccHostTimerCount;
+
+void DccProtocol::configureTimer() {
+	DccHostTimerCount = TIMER_COUNT_SEND_1;
+}
+
+void DccProtocol::enableTimer() {
+	DccHostTimerCount = TIMER_COUNT_SEND_1;
+	dcc_positive = true;
+}
+
+void DccProtocol::disableTimer() {
+}
+
+#define RESET_INTERRUPT()
+#define SET_COUNTER(v) DccHostTimerCount = (v)
+
 #endif
 
 void DccProtocol::timerInterrupt() {
@@ -43,4 +43,9 @@ public:
 
 extern DccProtocol DccRails;
 
+#ifdef DCC_HOST
+// Timer counter of the host build
+extern word DccHostTimerCount;
+#endif
+
 #endif
\ No newline at end of file
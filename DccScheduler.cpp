@@ -0,0 +1,45 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#include <Arduino.h>
+#include "DccScheduler.h"
+
+DccScheduler DccTasks;
+
+DccScheduler::DccScheduler() {
+	count = 0;
+}
+
+boolean DccScheduler::add(DccTaskFunction run, word periodMs) {
+	if (count == DCC_SCHEDULER_TASK_COUNT || run == NULL)
+		return false;
+
+	DccTask& task = tasks[count++];
+	task.run 	= run;
+	task.period = periodMs;
+	task.due 	= millis();
+	return true;
+}
+
+void DccScheduler::loop() {
+	for (byte i = 0; i < count; ++i) {
+		DccTask& task = tasks[i];
+		word now = millis();
+		if ((int16_t)(now - task.due) < 0)
+			continue;
+
+		// Missed periods are skipped, not run back to back
+		task.due += task.period;
+		if ((int16_t)(now - task.due) >= 0)
+			task.due = now + task.period;
+		task.run();
+	}
+}
@@ -0,0 +1,52 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#ifndef __DCC_SCHEDULER_H__
+#define __DCC_SCHEDULER_H__
+
+#include <Arduino.h>
+#include "DccConfig.h"
+
+typedef void (*DccTaskFunction)();
+
+// Cooperative tasks of the sketch loop(). Every task runs to completion, so it has to
+// return quickly instead of waiting with delay(). Task with the period 0 runs on every loop,
+// others run when the period is over. Periods are word millis, up to 32 seconds.
+class DccScheduler {
+private:
+	struct DccTask {
+		DccTaskFunction	run;
+		word			period;
+		word			due;
+	};
+
+	DccTask	tasks[DCC_SCHEDULER_TASK_COUNT];
+	byte	count;
+
+public:
+	DccScheduler();
+
+	// Returns false, when DCC_SCHEDULER_TASK_COUNT tasks are added already
+	boolean add(DccTaskFunction run, word periodMs);
+
+	// Runs every due task once, in the order they were added
+	void 	loop();
+
+	byte 	size();
+};
+
+extern DccScheduler DccTasks;
+
+inline byte DccScheduler::size() {
+	return count;
+}
+
+#endif //__DCC_SCHEDULER_H__
@@ -107,6 +107,17 @@
 
 #endif //F_CPU
 
+#elif defined(DCC_HOST)
+
+/** Host build (extras/host) has no timer. DccProtocol keeps the counter in DccHostTimerCount,
+ *  tests call the interrupt function directly. Counts are the same as ATmega at 16MHz.
+ */
+#define  TIMER_COUNT_SEND_0       (199) 
+#define  TIMER_COUNT_SEND_1       (115) 
+#define  TIMER_COUNT_CUTOUT_START  (55) 
+#define  TIMER_COUNT_CUTOUT_END_1 (391) 
+#define  TIMER_COUNT_CUTOUT_END_2 (553) 
+
 #elif defined(__MK20DX128__)
 
 /** There are 2 timers on MK20DX128:
@@ -670,6 +681,12 @@
 */
 #define DCC_MF_KIND8_SHORT_STATE_CONTROL 		(0xDD)
 
+#define DCC_MF_BINARY_STATE_ON					(0x80)
+#define DCC_MF_BINARY_STATE_MASK				(0x7F)
+#define DCC_MF_BINARY_STATE_SHORT_MAX			(127)
+#define DCC_MF_BINARY_STATE_LONG_MAX			(32767)
+#define DCC_MF_BINARY_STATE_LONG_SHIFT			(7)
+
 /**						
 		CCCCC = 11110:  F13-F20 Function Control – Sub-instruction “11110” is a two byte instruction and provides for 
 						control of eight (8) additional auxiliary functions F13-F20.  The single byte following this instruction byte indicates 
@@ -719,6 +736,23 @@
 #define DCC_MF_FUNCTION_F27					(0x40) 
 #define DCC_MF_FUNCTION_F28					(0x80) 
 
+/**
+		Later revision of the standard (S-9.2.1, 2012) assigns five more of the reserved sub-instructions to the 
+		function groups F29-F68. They follow the F13-F20 format: two byte instruction, Bit 0 of the data byte controls 
+		the lowest function of the group, and Bit 7 the highest. These functions are not refreshed either.
+
+		CCCCC = 11000:  F29-F36 Function Control
+		CCCCC = 11001:  F37-F44 Function Control
+		CCCCC = 11010:  F45-F52 Function Control
+		CCCCC = 11011:  F53-F60 Function Control
+		CCCCC = 11100:  F61-F68 Function Control
+*/
+#define DCC_MF_KIND8_F29_F36 				(0xD8)
+#define DCC_MF_KIND8_F37_F44 				(0xD9)
+#define DCC_MF_KIND8_F45_F52 				(0xDA)
+#define DCC_MF_KIND8_F53_F60 				(0xDB)
+#define DCC_MF_KIND8_F61_F68 				(0xDC)
+
 /**
 		The remaining 28 sub-instructions are reserved by the NMRA for future use. The NMRA shall not issue a NMRA Conformance Warrant 
 		for any product that uses an instruction or subinstruction that has been reserved by the NMRA.
@@ -827,6 +861,12 @@
 #define DCC_CV_MASK_1					(0x03)
 #define DCC_CV_MASK_2					(0xFF)
 
+#define DCC_CV_MIN						(1)
+#define DCC_CV_MAX						(1024)
+
+#define DCC_CV_BIT_DATA					(0xE0) 
+#define DCC_CV_BIT_DATA_MASK			(0xE0) 
+
 #define DCC_CV_BIT_OP_MASK				(0x10) 
 #define DCC_CV_BIT_VERIFY				(0x00) 
 #define DCC_CV_BIT_WRITE				(0x10) 
@@ -10,53 +10,81 @@
  **/
 
 #include <Arduino.h>
-#include <EEPROM.h>
 
 #include "DccConfig.h"
 #include "DccStateKeeper.h"
-
-
-#define DCC_EEPROM_ADDR_COUNT 			(DCC_STATE_EEPROM_ADDR)
-#define DCC_EEPROM_ADDR_GENERATION 		(DCC_STATE_EEPROM_ADDR + 1)
-
-#define DCC_EEPROM_ADDR_STATE_0	   		(DCC_STATE_EEPROM_ADDR + 2)
-#define DCC_EEPROM_STATE_SIZE	   		(6)
-
-//First DccAddress byte
-#define DCC_EEPROM_STATE_ADDRESS_0		(0)
-
-//Second DccAddress byte if present
-#define DCC_EEPROM_STATE_ADDRESS_1		(1)
-
-//Generation number when state was changed
-#define DCC_EEPROM_STATE_ACCESSED		(2)
-
+#include "DccStorage.h"
+
+
+// State Log Entry
+//======================================================
+// Sequence number increments with every entry written.
+// Latest valid entry of the slot is the slot state. 
+// Reset entry drops all entries written before it, it has no record.
+// Record has variable length, CRC follows the last byte written.
+#define DCC_LOG_ENTRY_SEQUENCE			(0)
+#define DCC_LOG_ENTRY_SLOT				(2)
+#define DCC_LOG_ENTRY_RECORD			(4)
+#define DCC_LOG_ENTRY_SIZE				(DCC_LOG_ENTRY_RECORD + DCC_LOG_RECORD_MAX_SIZE + 1)
+
+// Log Record
+//======================================================
+// Fixed part is followed by one byte for each bit set in DCC_LOG_RECORD_GROUPS,
+// bit 0 for f5_f12, bit 1 for group 0 (F13-F20) ... bit 7 for group 6 (F61-F68).
+#define DCC_LOG_RECORD_ADDRESS0			(0)
+#define DCC_LOG_RECORD_ADDRESS1			(1)
+#define DCC_LOG_RECORD_ACCESSED			(2)
+#define DCC_LOG_RECORD_SPEED			(4)
+#define DCC_LOG_RECORD_INFO_F0_F4		(5)
+#define DCC_LOG_RECORD_GROUPS			(6)
+#define DCC_LOG_RECORD_FIXED_SIZE		(7)
+#define DCC_LOG_RECORD_MAX_SIZE			(DCC_STATE_RECORD_MAX_SIZE)
+
+#define DCC_LOG_GROUP_F5_F12			(0x01)
+
+// Sequence numbers are compared within the half of their range. A pass of the head over the log
+// writes up to 2 entries per position (live entries are copied), and entries are up to 2 passes old.
+#define DCC_LOG_ENTRY_COUNT_MAX			(DCC_STATE_LOG_MAX_COUNT)
+static_assert(DCC_LOG_ENTRY_COUNT_MAX <= 0x1FFF, "DCC_STATE_LOG_MAX_COUNT is up to 0x1FFF");
+
+#define DCC_STATE_INDEX_EMPTY			DCC_STATE_NONE
+#define DCC_STATE_INDEX_MASK			(DCC_STATE_INDEX_SIZE - 1)
+
+static_assert((DCC_STATE_INDEX_SIZE & DCC_STATE_INDEX_MASK) == 0 && DCC_STATE_INDEX_SIZE > DCC_STATE_MAX_COUNT, 
+	"DCC_STATE_INDEX_SIZE has to be power of 2 larger than DCC_STATE_MAX_COUNT");
+
+#define DCC_LOG_SLOT_RESET				(0xFFFF)
+#define DCC_LOG_POSITION_NONE			((DccLogPosition) ~0)
+
+// Erased (0xFF) and cleared (0x00) storage never has valid CRC
+#define DCC_LOG_CRC_INIT				(0xFF)
+#define DCC_LOG_CRC_POLYNOMIAL			(0x31)
+
+//DccStateRecord::speed
 //Always active
 //Speed format base on DCC_EEPROM_STATE_INFO bits
-#define DCC_EEPROM_STATE_SPEED			(3)	 
 
+//DccStateRecord::info_f0_f4
 //Also include:
-//1 bit 0x80 speed format 128 or 28
-//1 bit 0x40 F5-F8  active
-//1 bit 0x20 F9-F12 active
-#define DCC_EEPROM_STATE_INFO			(4)   
+//1 bit 0x80 speed format 128, or 28 and 14 sharing the same instruction
 #define DCC_EEPROM_STATE_INFO_MASK		(0xE0)   
 #define DCC_EEPROM_STATE_SPEED_128		(0x80)   
-#define DCC_EEPROM_STATE_ACTIVE_F5_F8	(0x40)   
-#define DCC_EEPROM_STATE_ACTIVE_F9_F12	(0x20)   
 
 //Always active
-#define DCC_EEPROM_STATE_F0_F4			(4)   
 #define DCC_EEPROM_STATE_F0_F4_MASK		(0x1F)   
 
-//Active base on DCC_EEPROM_STATE_INFO bits
-#define DCC_EEPROM_STATE_F5_F12			(5)
+//DccStateRecord::f5_f12
+//Refreshed, when the group is not 0
 #define DCC_EEPROM_STATE_F5_F8_MASK 	(0xF0)
 #define DCC_EEPROM_STATE_F5_F8_SHIFT 	(4)
 
 #define DCC_EEPROM_STATE_F9_F12_MASK 	(0x0F)
 
-#define GENERATION_COUNT				DCC_STATE_MAX_COUNT
+//DccStateRecord::group
+//One byte per group F13-F20, F21-F28, ..., F61-F68. Refreshed, when the group is not 0.
+
+//DccStateRecord::accessed
+//Access clock of the last change, orders the least recently used states after begin()
 
 #define STATE_KIND_UNKNOWN				(0)
 #define STATE_KIND_SPEED_28				(1)
@@ -66,15 +94,103 @@
 #define STATE_KIND_SPEED_F9_F12			(5)
 #define STATE_KIND_RESET_SPEED   		(6)
 #define STATE_KIND_RESET_STATE 			(7)
+#define STATE_KIND_F13_F20				(8)
+#define STATE_KIND_F21_F28				(9)
+#define STATE_KIND_F29_F36				(10)
+#define STATE_KIND_F37_F44				(11)
+#define STATE_KIND_F45_F52				(12)
+#define STATE_KIND_F53_F60				(13)
+#define STATE_KIND_F61_F68				(14)
+
+// Function group instructions in DccStateRecord::group order
+static const byte GROUP_COMMAND[DCC_STATE_GROUP_COUNT] = {
+	DCC_MF_KIND8_F13_F20,
+	DCC_MF_KIND8_F21_F28,
+	DCC_MF_KIND8_F29_F36,
+	DCC_MF_KIND8_F37_F44,
+	DCC_MF_KIND8_F45_F52,
+	DCC_MF_KIND8_F53_F60,
+	DCC_MF_KIND8_F61_F68,
+};
 
 DccStateKeeper DccState;
 
+static DccEepromStorage eepromStorage(DCC_STATE_EEPROM_ADDR, DCC_STATE_EEPROM_SIZE);
+
+byte DccStateKeeper::crc8(byte crc, byte data) {
+	crc ^= data;
+	for (byte i = 0; i < 8; ++i)
+		crc = (crc & 0x80) ? (crc << 1) ^ DCC_LOG_CRC_POLYNOMIAL : (crc << 1);
+	return crc;
+}
+
+boolean DccStateKeeper::locoState(DccPacket* packet, byte& speed, boolean& speed128, unsigned long& functions) {
+	DccStateSlot state = indexFind(packet->dcc_data[0], packet->isAddressShort() ? 0 : packet->dcc_data[1]);
+	DccStateRecord stopped;
+	if (state == DCC_STATE_INDEX_EMPTY)
+		resetState(stopped);
+	DccStateRecord& record = (state == DCC_STATE_INDEX_EMPTY) ? stopped : records[state];
+
+	speed 	 = record.speed;
+	speed128 = (record.info_f0_f4 & DCC_EEPROM_STATE_SPEED_128) != 0;
+	functions = ((record.info_f0_f4 & DCC_MF_FUNCTION_F0) ? 1UL : 0UL)
+			  | ((unsigned long) (record.info_f0_f4 & (DCC_MF_FUNCTION_F1 | DCC_MF_FUNCTION_F2 | DCC_MF_FUNCTION_F3 | DCC_MF_FUNCTION_F4)) << 1)
+			  | ((unsigned long) ((record.f5_f12 & DCC_EEPROM_STATE_F5_F8_MASK) >> DCC_EEPROM_STATE_F5_F8_SHIFT) << 5)
+			  | ((unsigned long) (record.f5_f12 & DCC_EEPROM_STATE_F9_F12_MASK) << 9)
+			  | ((unsigned long) record.group[0] << 13)
+			  | ((unsigned long) record.group[1] << 21);
+	return state != DCC_STATE_INDEX_EMPTY;
+}
+
+DccPacket* DccStateKeeper::locoFunction(DccPacket* packet, byte function, byte change) {
+	byte speed;
+	boolean speed128;
+	unsigned long functions;
+	locoState(packet, speed, speed128, functions);
+
+	unsigned long bit = 1UL << function;
+	switch (change) {
+		case DCC_STATE_FUNCTION_OFF:	functions &= ~bit; break;
+		case DCC_STATE_FUNCTION_ON:		functions |=  bit; break;
+		case DCC_STATE_FUNCTION_TOGGLE:	functions ^=  bit; break;
+	}
+	return packet->functionGroup(function, functions);
+}
+
+// Sequence numbers wrap, but all entries in the log are within DCC_LOG_ENTRY_COUNT_MAX
+static boolean isNewer(word sequence, word than) {
+	return (int16_t)(sequence - than) > 0;
+}
+
+void DccStateKeeper::storage(DccStorage* storage) {
+	store = storage;
+}
+
 void DccStateKeeper::begin() {
+	if (store == NULL)
+		store = &eepromStorage;
+
+	// Live entries are never overwritten, so the log needs a free entry for the head
+	unsigned long count = store->size() / DCC_LOG_ENTRY_SIZE;
+	logCount = count < DCC_LOG_ENTRY_COUNT_MAX ? count : DCC_LOG_ENTRY_COUNT_MAX;
+	state_limit = logCount < DCC_STATE_MAX_COUNT + 2 ? (logCount < 2 ? 0 : logCount - 2) : DCC_STATE_MAX_COUNT;
+
+	importing = false;
+	reload();
+}
+
+// States are read from the storage, changes not written yet are dropped
+void DccStateKeeper::reload() {
 	nextState = 0;
-	state_count = EEPROM.read(DCC_EEPROM_ADDR_COUNT);
-	generation = EEPROM.read(DCC_EEPROM_ADDR_GENERATION);
-	if (state_count > DCC_STATE_MAX_COUNT || generation >= GENERATION_COUNT)
-		resetAll();
+	restoreNext = DCC_STATE_NONE;
+	refreshPass = 0;
+	memset(activity, 0, sizeof(activity));
+	pending = resetPending = false;
+	memset(dirty, 0, sizeof(dirty));
+
+	recover();
+	indexBuild();
+	lruBuild();
 }
 
 void DccStateKeeper::resetSpeed() {
@@ -84,10 +200,16 @@ void DccStateKeeper::resetSpeed() {
 void DccStateKeeper::resetAll() {
 	nextState = 0;
 	state_count = 0;
-	generation = 0;
-
-	EEPROM.write(DCC_EEPROM_ADDR_COUNT, state_count);
-	EEPROM.write(DCC_EEPROM_ADDR_GENERATION, generation);
+	accessClock = 0;
+	lruFirst = lruLast = DCC_STATE_NONE;
+	restoreNext = DCC_STATE_NONE;
+
+	// Log entries before the reset entry are dropped
+	memset(dirty, 0, sizeof(dirty));
+	memset(livePosition, 0xFF, sizeof(livePosition));
+	memset(index, 0xFF, sizeof(index));
+	resetPending = true;
+	markChanged();
 }
 
 
@@ -104,175 +226,697 @@ void DccStateKeeper::saveState(DccPacket* packet) {
 		return;
 	}
 		
-	word eeprom = findEeprom(packet);
-	saveState(eeprom, stateKind, packet);
+	// Repeated commands don't change the state, they are neither written nor stamped
+	DccStateSlot state = indexFind(packet->dcc_data[0], packet->isAddressShort() ? 0 : packet->dcc_data[1]);
+	boolean changed = (state == DCC_STATE_INDEX_EMPTY);
+	if (changed) {
+		state = findState(packet);
+		if (state == DCC_STATE_NONE)
+			return;
+	}
+
+	DccStateRecord& record = records[state];
+	if (saveState(record, stateKind, packet))
+		changed = true;
 	
-	updateAccess(eeprom);
+	if (!changed) {
+		lruMoveFirst(state);
+		return;
+	}
+	updateAccess(state);
+	activity[state] = DCC_STATE_ACTIVE_COUNT;
+	markDirty(state);
+}
+
+void DccStateKeeper::restore() {
+	restoreNext = lruFirst;
+}
+
+static byte packRecord(DccStateRecord& record, byte* data);
+static void unpackRecord(const byte* data, DccStateRecord& record);
+static byte groupCount(byte groups);
+
+byte DccStateKeeper::exportState(DccStateSlot& cursor, byte* data) {
+	DccStateSlot state = cursor;
+	if (state == DCC_STATE_NONE)
+		return 0;
+
+	cursor = lruPrev[state];
+	if (records[state].address0 == DCC_ADDRESS_IDLE)
+		return 0;
+	return packRecord(records[state], data);
+}
+
+boolean DccStateKeeper::importState(const byte* data, byte size) {
+	if (size < DCC_LOG_RECORD_FIXED_SIZE || size != DCC_LOG_RECORD_FIXED_SIZE + groupCount(data[DCC_LOG_RECORD_GROUPS]))
+		return false;
+
+	byte address0 = data[DCC_LOG_RECORD_ADDRESS0];
+	byte address1 = data[DCC_LOG_RECORD_ADDRESS1];
+	boolean valid = (DCC_ADDRESS_SHORT_MIN <= address0 && address0 <= DCC_ADDRESS_SHORT_MAX && address1 == 0)
+				 || (DCC_ADDRESS_LONG_MIN <= address0 && address0 <= DCC_ADDRESS_LONG_MAX);
+	if (!valid)
+		return false;
+
+	DccPacket packet;
+	packet.mfAddress(address0, address1);
+	DccStateSlot state = findState(&packet);
+	if (state == DCC_STATE_NONE)
+		return false;
+
+	unpackRecord(data, records[state]);
+	updateAccess(state);
+	activity[state] = DCC_STATE_ACTIVE_COUNT;
+	markDirty(state);
+	return true;
 }
 
 void DccStateKeeper::readNextState(DccQueue& queue, DccStack& heap) {
-	if (state_count == 0)
-		return;
+	while (restoreNext != DCC_STATE_NONE) {
+		DccStateSlot state = restoreNext;
+
+		// Slot lost by the log, see recover()
+		if (records[state].address0 != DCC_ADDRESS_IDLE) {
+			if (heap.size() < packetCount(records[state]))
+				return;
+			restoreNext = lruNext[state];
+			readState(records[state], queue, heap);
+			return;
+		}
+		restoreNext = lruNext[state];
+	}
 
-	word eeprom = DCC_EEPROM_ADDR_STATE_0 + nextState * DCC_EEPROM_STATE_SIZE;
-	
-	byte address0 	= EEPROM.read(eeprom + DCC_EEPROM_STATE_ADDRESS_0); 
-	byte address1 	= EEPROM.read(eeprom + DCC_EEPROM_STATE_ADDRESS_1); 
-	byte speed 	  	= EEPROM.read(eeprom + DCC_EEPROM_STATE_SPEED); 
-	byte info_f0_f4 = EEPROM.read(eeprom + DCC_EEPROM_STATE_INFO);
-	byte f5_f12 	= EEPROM.read(eeprom + DCC_EEPROM_STATE_F5_F12);
+	for (DccStateSlot visited = 0; visited < state_count; ++visited) {
+		DccStateSlot state = nextState;
+		if (heap.size() < packetCount(records[state]))
+			return;
+
+		boolean due = isRefreshDue(state);
+		if (++nextState >= state_count) {
+			nextState = 0;
+			++refreshPass;
+		}
+
+		if (due) {
+			readState(records[state], queue, heap);
+			return;
+		}
+	}
+}
+
+boolean DccStateKeeper::isRefreshDue(DccStateSlot state) {
+	DccStateRecord& record = records[state];
+
+	// Slot lost by the log, see recover()
+	if (record.address0 == DCC_ADDRESS_IDLE)
+		return false;
+
+	if (activity[state] > 0) {
+		--activity[state];
+		return true;
+	}
+
+	// Stop and emergency stop of 28 steps don't depend on the bit 4, the same as 14 steps
+	boolean running = (record.info_f0_f4 & DCC_EEPROM_STATE_SPEED_128) 
+					? (record.speed & DCC_MF_SPEED_128_MASK) >= DCC_MF_SPEED_128_MIN
+					: (record.speed & DCC_MF_SPEED_14_MASK) >= DCC_MF_SPEED_14_MIN;
+	if (running)
+		return true;
+
+	// Idle states are spread over the passes
+	return (byte) (refreshPass + state) % DCC_STATE_IDLE_RATIO == 0;
+}
+
+// Packets added by readState(..): the speed and the function groups turned on
+byte DccStateKeeper::packetCount(DccStateRecord& record) {
+	byte count = 1;
+	if (record.info_f0_f4 & DCC_EEPROM_STATE_F0_F4_MASK)
+		++count;
+	if (record.f5_f12 & DCC_EEPROM_STATE_F5_F8_MASK)
+		++count;
+	if (record.f5_f12 & DCC_EEPROM_STATE_F9_F12_MASK)
+		++count;
+	for (byte group = 0; group < DCC_STATE_GROUP_COUNT; ++group)
+		if (record.group[group] != 0)
+			++count;
+	return count;
+}
+
+void DccStateKeeper::readState(DccStateRecord& record, DccQueue& queue, DccStack& heap) {
+	byte address0 	= record.address0; 
+	byte address1 	= record.address1; 
+	byte speed 	  	= record.speed; 
+	byte info_f0_f4 = record.info_f0_f4;
+	byte f5_f12 	= record.f5_f12;
 	
 	if (info_f0_f4 & DCC_EEPROM_STATE_SPEED_128)	
 		queue.add(heap.pop()->mfAddress(address0, address1).speed128(speed));
 	else
 		queue.add(heap.pop()->mfAddress(address0, address1).speed28(speed));
 
-	queue.add(heap.pop()->mfAddress(address0, address1).functionF0_F4(info_f0_f4 & DCC_EEPROM_STATE_F0_F4_MASK));
+	// Decoders start with all the functions off, so only the groups turned on are refreshed
+	if (info_f0_f4 & DCC_EEPROM_STATE_F0_F4_MASK)
+		queue.add(heap.pop()->mfAddress(address0, address1).functionF0_F4(info_f0_f4 & DCC_EEPROM_STATE_F0_F4_MASK));
 	
-	if (info_f0_f4 & DCC_EEPROM_STATE_ACTIVE_F5_F8)
+	if (f5_f12 & DCC_EEPROM_STATE_F5_F8_MASK)
 		queue.add(heap.pop()->mfAddress(address0, address1).functionF5_F8((f5_f12 & DCC_EEPROM_STATE_F5_F8_MASK) >> DCC_EEPROM_STATE_F5_F8_SHIFT));
 		
-	if (info_f0_f4 & DCC_EEPROM_STATE_ACTIVE_F9_F12)
+	if (f5_f12 & DCC_EEPROM_STATE_F9_F12_MASK)
 		queue.add(heap.pop()->mfAddress(address0, address1).functionF9_F12(f5_f12 & DCC_EEPROM_STATE_F9_F12_MASK));
-		
-	nextState = (nextState + 1) % state_count;
+
+	for (byte group = 0; group < DCC_STATE_GROUP_COUNT; ++group) {
+		if (record.group[group] == 0)
+			continue;
+
+		DccPacket* p = heap.pop();
+		p->dcc_info = DCC_INFO_NO_ACKNOWLEDGE | (DCC_REPEAT_FUNCTION & DCC_INFO_REPEAT_MASK);
+		queue.add(p->mfAddress(address0, address1).mfCommand2(GROUP_COMMAND[group], record.group[group]));
+	}
+}
+
+void DccStateKeeper::beginImport() {
+	importing = false;
+	flush();
+	resetAll();
+	importing = true;
+}
+
+void DccStateKeeper::endImport(boolean commit) {
+	importing = false;
+	if (!commit)
+		reload();
+}
+
+void DccStateKeeper::loop() {
+	if (!pending)
+		return;
+
+	unsigned long now = millis();
+	if (   (now - lastChange)  < DCC_STATE_FLUSH_IDLE_MS 
+		&& (now - firstChange) < DCC_STATE_FLUSH_MAX_MS)
+		return;
+
+	flushNext();
+}
+
+void DccStateKeeper::flush() {
+	while (flushNext())
+		;
+}
+
+// Writes one log entry. Returns false, when nothing is left to write.
+boolean DccStateKeeper::flushNext() {
+	if (importing)
+		return false;
+
+	if (logCount == 0) {
+		pending = resetPending = false;
+		return false;
+	}
+
+	if (resetPending) {
+		appendEntry(DCC_LOG_SLOT_RESET);
+		resetPending = false;
+		return true;
+	}
+
+	for (word i = 0; i < sizeof(dirty); ++i) {
+		if (dirty[i] == 0)
+			continue;
+
+		DccStateSlot state = i << 3;
+		while ((dirty[i] & (1 << (state & 0x07))) == 0)
+			++state;
+		appendEntry(state);
+		return true;
+	}
+	pending = false;
+	return false;
 }
 
 byte DccStateKeeper::extractStateKind(DccPacket* packet) {
-	byte command = packet->dcc_data[packet->isAddressShort() ? 1 : 2];
-	switch(command & DCC_MF_KIND3_MASK) {
-		case DCC_MF_KIND3_CONTROL:				return (command == DCC_MF_DECODER_SOFT_RESET) ? STATE_KIND_RESET_SPEED : (command == DCC_MF_DECODER_HARD_RESET) ? STATE_KIND_RESET_STATE : STATE_KIND_UNKNOWN;
-		case DCC_MF_KIND3_ADVANCED_OPERATION: 	return (command == DCC_MF_KIND8_SPEED_128) ? STATE_KIND_SPEED_128 : STATE_KIND_UNKNOWN; 
-		case DCC_MF_KIND3_REVERSE_OPERATION:
-		case DCC_MF_KIND3_FORWARD_OPERATION: 	return STATE_KIND_SPEED_28;
-		case DCC_MF_KIND3_F0_F4: 				return STATE_KIND_SPEED_F0_F4;
-		case DCC_MF_KIND3_F5_F12: 				return ((command & DCC_MF_KIND4_MASK) == DCC_MF_KIND4_F5_F8) ? STATE_KIND_SPEED_F5_F8 : STATE_KIND_SPEED_F9_F12;
+	switch(packet->kind()) {
+		case DCC_KIND_DECODER_RESET:		return STATE_KIND_RESET_SPEED;
+		case DCC_KIND_DECODER_HARD_RESET:	return STATE_KIND_RESET_STATE;
+		case DCC_KIND_SPEED_28:				return STATE_KIND_SPEED_28;
+		case DCC_KIND_SPEED_128:			return STATE_KIND_SPEED_128;
+		case DCC_KIND_F0_F4:				return STATE_KIND_SPEED_F0_F4;
+		case DCC_KIND_F5_F8:				return STATE_KIND_SPEED_F5_F8;
+		case DCC_KIND_F9_F12:				return STATE_KIND_SPEED_F9_F12;
+		case DCC_KIND_F13_F20:				return STATE_KIND_F13_F20;
+		case DCC_KIND_F21_F28:				return STATE_KIND_F21_F28;
+		case DCC_KIND_F29_F36:				return STATE_KIND_F29_F36;
+		case DCC_KIND_F37_F44:				return STATE_KIND_F37_F44;
+		case DCC_KIND_F45_F52:				return STATE_KIND_F45_F52;
+		case DCC_KIND_F53_F60:				return STATE_KIND_F53_F60;
+		case DCC_KIND_F61_F68:				return STATE_KIND_F61_F68;
 	}
 	return STATE_KIND_UNKNOWN;
 }
 
 
 void DccStateKeeper::saveBroadcastState(byte stateKind, DccPacket* packet) {
-	for (word eeprom  = DCC_EEPROM_ADDR_STATE_0 + (state_count - 1) * DCC_EEPROM_STATE_SIZE; 
-		 	  eeprom >= DCC_EEPROM_ADDR_STATE_0; 
-		 	  eeprom -= DCC_EEPROM_STATE_SIZE) 
-		saveState(eeprom, stateKind, packet);
+	for (DccStateSlot state = 0; state < state_count; ++state) {
+		if (!saveState(records[state], stateKind, packet))
+			continue;
+		activity[state] = DCC_STATE_ACTIVE_COUNT;
+		markDirty(state);
+	}
 }
 
-void DccStateKeeper::saveState(word eeprom, byte stateKind, DccPacket* packet) {
+// Returns true, when the record has changed
+boolean DccStateKeeper::saveState(DccStateRecord& record, byte stateKind, DccPacket* packet) {
+	DccStateRecord previous = record;
 	switch(stateKind) {
-		case STATE_KIND_SPEED_28:	 	updateSpeed28(eeprom, packet); break;
-		case STATE_KIND_SPEED_128:	 	updateSpeed128(eeprom, packet); break;
-		case STATE_KIND_SPEED_F0_F4:	updateF0_F4(eeprom, packet); break;
-		case STATE_KIND_SPEED_F5_F8:	updateF5_F8(eeprom, packet); break;
-		case STATE_KIND_SPEED_F9_F12:	updateF9_F12(eeprom, packet); break;
-		case STATE_KIND_RESET_SPEED: 	resetSpeed(eeprom); break;
-		case STATE_KIND_RESET_STATE: 	resetState(eeprom); break;
+		case STATE_KIND_SPEED_28:	 	updateSpeed28(record, packet); break;
+		case STATE_KIND_SPEED_128:	 	updateSpeed128(record, packet); break;
+		case STATE_KIND_SPEED_F0_F4:	updateF0_F4(record, packet); break;
+		case STATE_KIND_SPEED_F5_F8:	updateF5_F8(record, packet); break;
+		case STATE_KIND_SPEED_F9_F12:	updateF9_F12(record, packet); break;
+		case STATE_KIND_RESET_SPEED: 	resetSpeed(record); break;
+		case STATE_KIND_RESET_STATE: 	resetState(record); break;
+		case STATE_KIND_F13_F20:
+		case STATE_KIND_F21_F28:
+		case STATE_KIND_F29_F36:
+		case STATE_KIND_F37_F44:
+		case STATE_KIND_F45_F52:
+		case STATE_KIND_F53_F60:
+		case STATE_KIND_F61_F68:		updateGroup(record, stateKind - STATE_KIND_F13_F20, packet); break;
 	}
+	return memcmp(&previous, &record, sizeof(record)) != 0;
 }
 
-word DccStateKeeper::findEeprom(DccPacket* packet) {
+DccStateSlot DccStateKeeper::findState(DccPacket* packet) {
 	byte address0 = packet->dcc_data[0];
 	byte address1 = packet->isAddressShort() ? 0 : packet->dcc_data[1];
 
-	byte oldest_access = generation + GENERATION_COUNT;
-	word oldest_eeprom = -1;
+	DccStateSlot state = indexFind(address0, address1);
+	if (state != DCC_STATE_INDEX_EMPTY)
+		return state;
 	
-	for (word eeprom  = DCC_EEPROM_ADDR_STATE_0 + (state_count - 1) * DCC_EEPROM_STATE_SIZE; 
-		 	  eeprom >= DCC_EEPROM_ADDR_STATE_0; 
-		 	  eeprom -= DCC_EEPROM_STATE_SIZE) {
-		 	  
-		if (   EEPROM.read(eeprom + DCC_EEPROM_STATE_ADDRESS_0) == address0 
-			&& EEPROM.read(eeprom + DCC_EEPROM_STATE_ADDRESS_1) == address1)
-			return eeprom;
-
-		byte access = EEPROM.read(eeprom + DCC_EEPROM_STATE_ACCESSED);
-		if (access <= generation)
-			access += GENERATION_COUNT;
-		if (access <= oldest_access)
-			oldest_eeprom = eeprom;
+	if (state_count < state_limit) {
+		state = appendAddress(packet);
+	} else if (state_limit == 0) {
+		return DCC_STATE_NONE;
+	} else {
+		state = lruLast;
+		indexRemove(state);
+		resetAddress(records[state], packet);
+	}
+	indexAdd(state);
+	return state;
+}
+
+static word indexHash(byte address0, byte address1) {
+	return (address0 * 31 + address1) & DCC_STATE_INDEX_MASK;
+}
+
+// Returns DCC_STATE_INDEX_EMPTY, when the address has no state
+DccStateSlot DccStateKeeper::indexFind(byte address0, byte address1) {
+	for (word i = indexHash(address0, address1); index[i] != DCC_STATE_INDEX_EMPTY; i = (i + 1) & DCC_STATE_INDEX_MASK) {
+		DccStateRecord& record = records[index[i]];
+		if (record.address0 == address0 && record.address1 == address1)
+			return index[i];
+	}
+	return DCC_STATE_INDEX_EMPTY;
+}
+
+void DccStateKeeper::indexAdd(DccStateSlot state) {
+	word i = indexHash(records[state].address0, records[state].address1);
+	while (index[i] != DCC_STATE_INDEX_EMPTY)
+		i = (i + 1) & DCC_STATE_INDEX_MASK;
+	index[i] = state;
+}
+
+// Entries after the removed one are moved back, so no probe sequence is broken
+void DccStateKeeper::indexRemove(DccStateSlot state) {
+	word i = indexHash(records[state].address0, records[state].address1);
+	while (index[i] != state) {
+		if (index[i] == DCC_STATE_INDEX_EMPTY)
+			return;
+		i = (i + 1) & DCC_STATE_INDEX_MASK;
+	}
+
+	word hole = i;
+	for (i = (i + 1) & DCC_STATE_INDEX_MASK; index[i] != DCC_STATE_INDEX_EMPTY; i = (i + 1) & DCC_STATE_INDEX_MASK) {
+		word home = indexHash(records[index[i]].address0, records[index[i]].address1);
+		// Entry can fill the hole, when its home is not between the hole and the entry
+		if (((i - home) & DCC_STATE_INDEX_MASK) >= ((i - hole) & DCC_STATE_INDEX_MASK)) {
+			index[hole] = index[i];
+			hole = i;
+		}
+	}
+	index[hole] = DCC_STATE_INDEX_EMPTY;
+}
+
+void DccStateKeeper::indexBuild() {
+	memset(index, 0xFF, sizeof(index));
+	for (DccStateSlot state = 0; state < state_count; ++state) {
+		DccStateRecord& record = records[state];
+		if (record.address0 != DCC_ADDRESS_IDLE && indexFind(record.address0, record.address1) == DCC_STATE_INDEX_EMPTY)
+			indexAdd(state);
 	}
-	
-	if (state_count < DCC_STATE_MAX_COUNT)
-		return appendAddress(packet);
-		
-	resetAddress(oldest_eeprom, packet);	
-	return oldest_eeprom;
 }
 
-word DccStateKeeper::appendAddress(DccPacket* packet) {
-	word eeprom =  DCC_EEPROM_ADDR_STATE_0 + state_count * DCC_EEPROM_STATE_SIZE;
-	resetAddress(eeprom, packet);
+DccStateSlot DccStateKeeper::appendAddress(DccPacket* packet) {
+	DccStateSlot state = state_count;
+	resetAddress(records[state], packet);
+	lruInsertAfter(state, DCC_STATE_NONE);
 	
 	state_count = state_count + 1;
-	EEPROM.write(DCC_EEPROM_ADDR_COUNT, state_count);
 	
-	return eeprom;
+	return state;
 }
 
-void DccStateKeeper::resetAddress(word eeprom, DccPacket* p) {
-	generation = (generation + 1) % GENERATION_COUNT;
-	EEPROM.write(DCC_EEPROM_ADDR_GENERATION, generation);
+void DccStateKeeper::resetAddress(DccStateRecord& record, DccPacket* p) {
+	record.address0 = p->dcc_data[0];
+	record.address1 = p->isAddressShort() ? 0 : p->dcc_data[1];
 	
-	EEPROM.write(eeprom + DCC_EEPROM_STATE_ADDRESS_0, p->dcc_data[0]);
-	EEPROM.write(eeprom + DCC_EEPROM_STATE_ADDRESS_1, p->isAddressShort() ? 0 : p->dcc_data[1]);
-	
-	resetState(eeprom);
+	resetState(record);
 }
 
-void DccStateKeeper::updateAccess(word eeprom) {
-	EEPROM.write(eeprom + DCC_EEPROM_STATE_ACCESSED, generation);
+void DccStateKeeper::updateAccess(DccStateSlot state) {
+	if (accessClock == 0xFFFF)
+		renumberAccess();
+	records[state].accessed = accessClock++;
+	lruMoveFirst(state);
 }
 
-void DccStateKeeper::updateSpeed28(word eeprom, DccPacket* p) {
-	byte state = EEPROM.read(eeprom + DCC_EEPROM_STATE_INFO) & ~DCC_EEPROM_STATE_SPEED_128;
-	EEPROM.write(eeprom + DCC_EEPROM_STATE_INFO, state);
+void DccStateKeeper::lruMoveFirst(DccStateSlot state) {
+	if (lruFirst != state) {
+		// Restore continues with the next state, not from the front
+		if (restoreNext == state)
+			restoreNext = lruNext[state];
+		lruUnlink(state);
+		lruInsertAfter(state, DCC_STATE_NONE);
+	}
+}
 
-	EEPROM.write(eeprom + DCC_EEPROM_STATE_SPEED, p->dcc_data[p->isAddressShort() ? 1 : 2]);
+void DccStateKeeper::lruUnlink(DccStateSlot state) {
+	DccStateSlot prev = lruPrev[state];
+	DccStateSlot next = lruNext[state];
+	if (prev == DCC_STATE_NONE)
+		lruFirst = next;
+	else
+		lruNext[prev] = next;
+	if (next == DCC_STATE_NONE)
+		lruLast = prev;
+	else
+		lruPrev[next] = prev;
 }
 
-void DccStateKeeper::updateSpeed128(word eeprom, DccPacket* p) {
-	byte state = EEPROM.read(eeprom + DCC_EEPROM_STATE_INFO) | DCC_EEPROM_STATE_SPEED_128;
-	EEPROM.write(eeprom + DCC_EEPROM_STATE_INFO, state);
+// Previous DCC_STATE_NONE inserts the state as the most recently used
+void DccStateKeeper::lruInsertAfter(DccStateSlot state, DccStateSlot previous) {
+	DccStateSlot next = (previous == DCC_STATE_NONE) ? lruFirst : lruNext[previous];
+	lruPrev[state] = previous;
+	lruNext[state] = next;
+	if (previous == DCC_STATE_NONE)
+		lruFirst = state;
+	else
+		lruNext[previous] = state;
+	if (next == DCC_STATE_NONE)
+		lruLast = state;
+	else
+		lruPrev[next] = state;
+}
 
-	EEPROM.write(eeprom + DCC_EEPROM_STATE_SPEED, p->dcc_data[p->isAddressShort() ? 2 : 3]);
+// Orders the recovered states by accessed, lost states are used first
+void DccStateKeeper::lruBuild() {
+	lruFirst = lruLast = DCC_STATE_NONE;
+	accessClock = 0;
+	for (DccStateSlot state = 0; state < state_count; ++state) {
+		word accessed = records[state].accessed;
+		if (accessed >= accessClock)
+			accessClock = accessed + 1;
+
+		DccStateSlot previous = DCC_STATE_NONE;
+		DccStateSlot next = lruFirst;
+		while (next != DCC_STATE_NONE && records[next].accessed > accessed) {
+			previous = next;
+			next = lruNext[next];
+		}
+		lruInsertAfter(state, previous);
+	}
 }
 
-void DccStateKeeper::updateF0_F4(word eeprom, DccPacket* p) {
-	byte state = EEPROM.read(eeprom + DCC_EEPROM_STATE_F0_F4) & ~DCC_EEPROM_STATE_F0_F4_MASK;
-	
-	EEPROM.write(eeprom + DCC_EEPROM_STATE_F0_F4, state | (p->dcc_data[p->isAddressShort() ? 1 : 2] & DCC_MF_FUNCTION_F0_F4_MASK));
+// Access clock starts again from 0, keeping the order. All the states have to be written.
+void DccStateKeeper::renumberAccess() {
+	accessClock = state_count;
+	for (DccStateSlot state = lruFirst; state != DCC_STATE_NONE; state = lruNext[state]) {
+		records[state].accessed = --accessClock;
+		markDirty(state);
+	}
+	accessClock = state_count;
 }
 
-void DccStateKeeper::updateF5_F8(word eeprom, DccPacket* p) {
-	byte state = EEPROM.read(eeprom + DCC_EEPROM_STATE_INFO) | DCC_EEPROM_STATE_ACTIVE_F5_F8;
-	EEPROM.write(eeprom + DCC_EEPROM_STATE_INFO, state);
+void DccStateKeeper::updateSpeed28(DccStateRecord& record, DccPacket* p) {
+	record.info_f0_f4 &= ~DCC_EEPROM_STATE_SPEED_128;
+	record.speed = p->dcc_data[p->isAddressShort() ? 1 : 2];
+}
 
-	state = EEPROM.read(eeprom + DCC_EEPROM_STATE_F5_F12) & ~DCC_EEPROM_STATE_F5_F8_MASK;
-	EEPROM.write(eeprom + DCC_EEPROM_STATE_F5_F12, state | ((p->dcc_data[p->isAddressShort() ? 1 : 2] & DCC_MF_FUNCTION_F5_F8_MASK) << DCC_EEPROM_STATE_F5_F8_SHIFT));
+void DccStateKeeper::updateSpeed128(DccStateRecord& record, DccPacket* p) {
+	record.info_f0_f4 |= DCC_EEPROM_STATE_SPEED_128;
+	record.speed = p->dcc_data[p->isAddressShort() ? 2 : 3];
 }
 
-void DccStateKeeper::updateF9_F12(word eeprom, DccPacket* p) {
-	byte state = EEPROM.read(eeprom + DCC_EEPROM_STATE_INFO) | DCC_EEPROM_STATE_ACTIVE_F9_F12;
-	EEPROM.write(eeprom + DCC_EEPROM_STATE_INFO, state);
+void DccStateKeeper::updateF0_F4(DccStateRecord& record, DccPacket* p) {
+	record.info_f0_f4 = (record.info_f0_f4 & ~DCC_EEPROM_STATE_F0_F4_MASK) 
+					  | (p->dcc_data[p->isAddressShort() ? 1 : 2] & DCC_MF_FUNCTION_F0_F4_MASK);
+}
 
-	state = EEPROM.read(eeprom + DCC_EEPROM_STATE_F5_F12) & ~DCC_EEPROM_STATE_F9_F12_MASK;
-	EEPROM.write(eeprom + DCC_EEPROM_STATE_F5_F12, state | (p->dcc_data[p->isAddressShort() ? 1 : 2] & DCC_MF_FUNCTION_F9_F12_MASK));
+void DccStateKeeper::updateF5_F8(DccStateRecord& record, DccPacket* p) {
+	record.f5_f12 = (record.f5_f12 & ~DCC_EEPROM_STATE_F5_F8_MASK) 
+				  | ((p->dcc_data[p->isAddressShort() ? 1 : 2] & DCC_MF_FUNCTION_F5_F8_MASK) << DCC_EEPROM_STATE_F5_F8_SHIFT);
 }
 
-void DccStateKeeper::resetSpeed(word eeprom) {
-	byte speed = EEPROM.read(eeprom + DCC_EEPROM_STATE_SPEED);
-	if (EEPROM.read(eeprom + DCC_EEPROM_STATE_INFO) & DCC_EEPROM_STATE_SPEED_128)
-		EEPROM.write(eeprom + DCC_EEPROM_STATE_SPEED, speed & DCC_MF_SPEED_128_DIRECTION_MASK);
-	else	
-		EEPROM.write(eeprom + DCC_EEPROM_STATE_SPEED, speed & DCC_MF_KIND3_MASK);
+void DccStateKeeper::updateF9_F12(DccStateRecord& record, DccPacket* p) {
+	record.f5_f12 = (record.f5_f12 & ~DCC_EEPROM_STATE_F9_F12_MASK) 
+				  | (p->dcc_data[p->isAddressShort() ? 1 : 2] & DCC_MF_FUNCTION_F9_F12_MASK);
 }
 
-void DccStateKeeper::resetState(word eeprom) {
-	EEPROM.write(eeprom + DCC_EEPROM_STATE_INFO,  0);
-	EEPROM.write(eeprom + DCC_EEPROM_STATE_SPEED, DCC_MF_KIND3_FORWARD_OPERATION | DCC_MF_SPEED_28_STOP);
-	EEPROM.write(eeprom + DCC_EEPROM_STATE_F0_F4, 0);
-	EEPROM.write(eeprom + DCC_EEPROM_STATE_F5_F12, 0);
+void DccStateKeeper::updateGroup(DccStateRecord& record, byte group, DccPacket* p) {
+	record.group[group] = p->dcc_data[p->isAddressShort() ? 2 : 3];
 }
-	
 
+void DccStateKeeper::resetSpeed(DccStateRecord& record) {
+	if (record.info_f0_f4 & DCC_EEPROM_STATE_SPEED_128)
+		record.speed &= DCC_MF_SPEED_128_DIRECTION_MASK;
+	else	// Stop in 28 steps, F0 is kept in 14 steps
+		record.speed &= DCC_MF_KIND3_MASK | DCC_MF_SPEED_28_LBIT_MASK;
+}
+
+void DccStateKeeper::resetState(DccStateRecord& record) {
+	record.info_f0_f4 	= 0;
+	record.speed 		= DCC_MF_KIND3_FORWARD_OPERATION | DCC_MF_SPEED_28_STOP;
+	record.f5_f12 		= 0;
+	memset(record.group, 0, sizeof(record.group));
+}
+
+void DccStateKeeper::markDirty(DccStateSlot state) {
+	dirty[state >> 3] |= (1 << (state & 0x07));
+	markChanged();
+}
+
+void DccStateKeeper::markChanged() {
+	unsigned long now = millis();
+	if (!pending)
+		firstChange = now;
+	lastChange = now;
+	pending = true;
+}
+
+// Entry with the newest sequence of every slot, after the latest reset entry, is the slot state.
+// Slots, that have lost all the entries (CRC error), are kept with idle address.
+void DccStateKeeper::recover() {
+	state_count = 0;
+	logHead = 0;
+	logSequence = 0;
+	memset(livePosition, 0xFF, sizeof(livePosition));
+
+	boolean found = false;
+	boolean reset = false;
+	word 	resetSequence = 0;
+	word 	sequence;
+	word 	slot;
+	for (word position = 0; position < logCount; ++position) {
+		if (!readEntry(position, sequence, slot, NULL))
+			continue;
+
+		if (!found || isNewer(sequence, logSequence)) {
+			found = true;
+			logSequence = sequence;
+			logHead = position;
+		}
+		if (slot == DCC_LOG_SLOT_RESET && (!reset || isNewer(sequence, resetSequence))) {
+			reset = true;
+			resetSequence = sequence;
+		}
+	}
+	if (!found)
+		return;
+
+	logHead = (logHead + 1) % logCount;
+	++logSequence;
+
+	// Live entries moved from the head are written ahead of it, so the sequences are compared
+	for (word position = 0; position < logCount; ++position) {
+		if (!readEntry(position, sequence, slot, NULL) || slot >= state_limit)
+			continue;
+		if (reset && !isNewer(sequence, resetSequence))
+			continue;
+		if (livePosition[slot] != DCC_LOG_POSITION_NONE && !isNewer(sequence, readSequence(livePosition[slot])))
+			continue;
+
+		livePosition[slot] = position;
+		if (slot >= state_count)
+			state_count = slot + 1;
+	}
+
+	for (slot = 0; slot < state_count; ++slot) {
+		DccStateRecord& record = records[slot];
+		if (livePosition[slot] == DCC_LOG_POSITION_NONE) {
+			memset(&record, 0, sizeof(DccStateRecord));
+			record.address0 = DCC_ADDRESS_IDLE;
+			continue;
+		}
+		word owner;
+		readEntry(livePosition[slot], sequence, owner, &record);
+	}
+}
+
+// Returns variable record size of the state
+static byte packRecord(DccStateRecord& record, byte* data) {
+	data[DCC_LOG_RECORD_ADDRESS0] 		= record.address0;
+	data[DCC_LOG_RECORD_ADDRESS1] 		= record.address1;
+	data[DCC_LOG_RECORD_ACCESSED] 		= record.accessed & 0xFF;
+	data[DCC_LOG_RECORD_ACCESSED + 1] 	= record.accessed >> 8;
+	data[DCC_LOG_RECORD_SPEED] 			= record.speed;
+	data[DCC_LOG_RECORD_INFO_F0_F4] 	= record.info_f0_f4;
+
+	byte groups = 0;
+	byte size 	= DCC_LOG_RECORD_FIXED_SIZE;
+	if (record.f5_f12 != 0) {
+		groups |= DCC_LOG_GROUP_F5_F12;
+		data[size++] = record.f5_f12;
+	}
+	for (byte group = 0; group < DCC_STATE_GROUP_COUNT; ++group) {
+		if (record.group[group] != 0) {
+			groups |= DCC_LOG_GROUP_F5_F12 << (group + 1);
+			data[size++] = record.group[group];
+		}
+	}
+	data[DCC_LOG_RECORD_GROUPS] = groups;
+	return size;
+}
+
+static void unpackRecord(const byte* data, DccStateRecord& record) {
+	record.address0 	= data[DCC_LOG_RECORD_ADDRESS0];
+	record.address1 	= data[DCC_LOG_RECORD_ADDRESS1];
+	record.accessed 	= data[DCC_LOG_RECORD_ACCESSED] | (data[DCC_LOG_RECORD_ACCESSED + 1] << 8);
+	record.speed 		= data[DCC_LOG_RECORD_SPEED];
+	record.info_f0_f4 	= data[DCC_LOG_RECORD_INFO_F0_F4];
+
+	byte groups = data[DCC_LOG_RECORD_GROUPS];
+	byte size 	= DCC_LOG_RECORD_FIXED_SIZE;
+	record.f5_f12 = (groups & DCC_LOG_GROUP_F5_F12) ? data[size++] : 0;
+	for (byte group = 0; group < DCC_STATE_GROUP_COUNT; ++group)
+		record.group[group] = (groups & (DCC_LOG_GROUP_F5_F12 << (group + 1))) ? data[size++] : 0;
+}
+
+static byte groupCount(byte groups) {
+	byte count = 0;
+	for (; groups != 0; groups >>= 1)
+		count += groups & 0x01;
+	return count;
+}
+
+// Record is read only when the entry is valid, and record is not NULL
+boolean DccStateKeeper::readEntry(word position, word& sequence, word& slot, DccStateRecord* record) {
+	byte entry[DCC_LOG_ENTRY_SIZE];
+	unsigned long address = (unsigned long) position * DCC_LOG_ENTRY_SIZE;
+	byte size = DCC_LOG_ENTRY_RECORD;
+	store->read(address, entry, size);
+
+	slot = entry[DCC_LOG_ENTRY_SLOT] | (entry[DCC_LOG_ENTRY_SLOT + 1] << 8);
+	if (slot != DCC_LOG_SLOT_RESET) {
+		store->read(address + size, entry + size, DCC_LOG_RECORD_FIXED_SIZE);
+		size += DCC_LOG_RECORD_FIXED_SIZE;
+
+		byte groups = groupCount(entry[DCC_LOG_ENTRY_RECORD + DCC_LOG_RECORD_GROUPS]);
+		store->read(address + size, entry + size, groups);
+		size += groups;
+	}
+	store->read(address + size, entry + size, 1);
+
+	byte crc = DCC_LOG_CRC_INIT;
+	for (byte i = 0; i < size; ++i)
+		crc = crc8(crc, entry[i]);
+	if (crc != entry[size])
+		return false;
+
+	sequence = entry[DCC_LOG_ENTRY_SEQUENCE] | (entry[DCC_LOG_ENTRY_SEQUENCE + 1] << 8);
+	if (record != NULL && slot != DCC_LOG_SLOT_RESET)
+		unpackRecord(entry + DCC_LOG_ENTRY_RECORD, *record);
+	return true;
+}
+
+// Sequence of the entry already read as valid
+word DccStateKeeper::readSequence(word position) {
+	byte data[2];
+	store->read((unsigned long) position * DCC_LOG_ENTRY_SIZE + DCC_LOG_ENTRY_SEQUENCE, data, 2);
+	return data[0] | (data[1] << 8);
+}
+
+// Live entry at the head is copied to the next free position first, the only copy of a state
+// is never overwritten. Returns false, if the live entry of the other slot was copied.
+boolean DccStateKeeper::appendEntry(word slot) {
+	for (DccStateSlot owner = 0; owner < state_count; ++owner) {
+		if (livePosition[owner] == logHead) {
+			writeEntry(owner, freePosition());
+			return owner == slot;
+		}
+	}
+	writeEntry(slot, logHead);
+	logHead = (logHead + 1) % logCount;
+	return true;
+}
+
+// First position after the head without a live entry. The log has at least 2 entries more than states.
+word DccStateKeeper::freePosition() {
+	word position = logHead;
+	for (;;) {
+		position = (position + 1) % logCount;
+		DccStateSlot owner = 0;
+		while (owner < state_count && livePosition[owner] != position)
+			++owner;
+		if (owner == state_count)
+			return position;
+	}
+}
+
+void DccStateKeeper::writeEntry(word slot, word position) {
+	byte entry[DCC_LOG_ENTRY_SIZE];
+	entry[DCC_LOG_ENTRY_SEQUENCE] 		= logSequence & 0xFF;
+	entry[DCC_LOG_ENTRY_SEQUENCE + 1] 	= logSequence >> 8;
+	entry[DCC_LOG_ENTRY_SLOT] 			= slot & 0xFF;
+	entry[DCC_LOG_ENTRY_SLOT + 1] 		= slot >> 8;
+
+	byte size = DCC_LOG_ENTRY_RECORD;
+	if (slot != DCC_LOG_SLOT_RESET)
+		size += packRecord(records[slot], entry + DCC_LOG_ENTRY_RECORD);
+
+	byte crc = DCC_LOG_CRC_INIT;
+	for (byte i = 0; i < size; ++i)
+		crc = crc8(crc, entry[i]);
+	entry[size++] = crc;
+
+	// Only the used part of the entry is written
+	store->write((unsigned long) position * DCC_LOG_ENTRY_SIZE, entry, size);
+
+	if (slot != DCC_LOG_SLOT_RESET) {
+		livePosition[slot] = position;
+		dirty[slot >> 3] &= ~(1 << (slot & 0x07));
+	}
+	++logSequence;
+	++logWrites;
+}
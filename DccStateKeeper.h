@@ -13,46 +13,222 @@
 #define __DCC_STATE_KEEPER_H__
 
 #include <Arduino.h>
+#include "DccConfig.h"
 #include "DccPacket.h"
 #include "DccCollection.h"
+#include "DccStorage.h"
 
+#define DCC_STATE_GROUP_COUNT	(7)
+
+// Packed record: 7 fixed bytes, F5-F12 and the groups, that are not off
+#define DCC_STATE_RECORD_MAX_SIZE	(7 + 1 + DCC_STATE_GROUP_COUNT)
+
+// Refresh packets of one state: speed, F0 - F4, F5 - F8, F9 - F12 and the groups
+#define DCC_STATE_PACKET_MAX_COUNT	(4 + DCC_STATE_GROUP_COUNT)
+
+// Index of the state. Thousands of states need external storage, and RAM for the state table.
+#if DCC_STATE_MAX_COUNT < 255
+typedef byte DccStateSlot;
+#else
+typedef word DccStateSlot;
+#endif
+
+#define DCC_STATE_NONE	((DccStateSlot) ~0)
+
+// Change of one function, see locoFunction(..)
+#define DCC_STATE_FUNCTION_OFF		(0)
+#define DCC_STATE_FUNCTION_ON		(1)
+#define DCC_STATE_FUNCTION_TOGGLE	(2)
+
+// Position of the state log entry, see DCC_STATE_LOG_MAX_COUNT
+#if DCC_STATE_LOG_MAX_COUNT < 255
+typedef byte DccLogPosition;
+#else
+typedef word DccLogPosition;
+#endif
+
+// State of one decoder. RAM copy of the latest log entry of the slot,
+// the entry keeps only the function groups, that are not off.
+struct DccStateRecord {
+	byte	address0;
+	byte	address1;
+	word	accessed;
+	byte	speed;
+	byte	info_f0_f4;
+	byte	f5_f12;
+	byte	group[DCC_STATE_GROUP_COUNT];
+};
 
 class DccStateKeeper {
 private:
-	byte 	state_count;	
-	byte    generation;
-	byte    nextState;
+	DccStateSlot	state_count;	
+	DccStateSlot	state_limit;	
+	DccStateSlot	nextState;
+
+	// Refresh passes of the states, and refreshes left in the active rate per state
+	byte			refreshPass;
+	byte			activity[DCC_STATE_MAX_COUNT];
+
+	// Next state to restore, walks the LRU list
+	DccStateSlot	restoreNext;
+
+	DccStateRecord	records[DCC_STATE_MAX_COUNT];
+
+	// Changes are kept in RAM, and written to the storage by loop() or flush()
+	byte			dirty[(DCC_STATE_MAX_COUNT + 7) / 8];
+	boolean			resetPending;
+	boolean			pending;
+	boolean			importing;
+	unsigned long	firstChange;
+	unsigned long	lastChange;
+
+	// Storage is the circular log of the state entries. Each write goes to the head,
+	// so all the cells wear evenly. Live entry found at the head is copied to the next
+	// free entry first, so a torn write never loses the only copy of a state.
+	DccStorage*		store;
+	word			logCount;
+	word			logHead;
+	word			logSequence;
+	DccLogPosition	livePosition[DCC_STATE_MAX_COUNT];
+	unsigned long	logWrites;
+
+	// States linked from the most to the least recently used. Order is kept in the log by accessed.
+	word			accessClock;
+	DccStateSlot	lruFirst;
+	DccStateSlot	lruLast;
+	DccStateSlot	lruPrev[DCC_STATE_MAX_COUNT];
+	DccStateSlot	lruNext[DCC_STATE_MAX_COUNT];
+
+	// Open addressing hash of the decoder address to the state
+	DccStateSlot	index[DCC_STATE_INDEX_SIZE];
 	
 public:
+	// Storage of the states, used by the next begin(). 
+	// NULL for the internal EEPROM at DCC_STATE_EEPROM_ADDR, the default.
+	void storage(DccStorage* storage);
+
 	void begin();
 	void resetSpeed();
 	void resetAll();
 	
 	void saveState(DccPacket* packet);
+
+	// Adds packets of the next state due to refresh, see DCC_STATE_ACTIVE_COUNT. 
+	// Nothing is added, when no state is due in the whole pass, or the heap has fewer packets
+	// than the next state needs (up to DCC_STATE_PACKET_MAX_COUNT). That state is read next time.
 	void readNextState(DccQueue& queue, DccStack& heap);
 
+	// Every state is read once by readNextState(), from the most recently used,
+	// before the refresh continues. Called when the rails get power.
+	void restore();
+	boolean isRestoring();
+
+	// Snapshot of the state table as packed records (the same as in the storage log).
+	// The cursor starts at exportFirst(), the least recently used state. exportState() packs
+	// the state of the cursor, and moves the cursor to the next more recently used state, 
+	// DCC_STATE_NONE after the last one. Returns the record size, 0 for the state lost by the log.
+	// importState() adds or replaces the state of the record address as the most recently used,
+	// returns false for invalid record.
+	DccStateSlot stateCount();
+	DccStateSlot exportFirst();
+	byte 	exportState(DccStateSlot& cursor, byte* data);
+	boolean importState(const byte* data, byte size);
+
+	// beginImport() writes all the changes, resets the states and holds the storage writes.
+	// endImport(true) writes the imported states, endImport(false) reads the states
+	// back from the storage, as they were before beginImport().
+	void	beginImport();
+	void	endImport(boolean commit);
+
+	static byte crc8(byte crc, byte data);
+
+	// Locomotive state of the packet address: speed instruction byte (28 or 128 steps) and
+	// F0 - F28, bit N is FN. Returns false and the stopped state, when the address has no state.
+	boolean locoState(DccPacket* packet, byte& speed, boolean& speed128, unsigned long& functions);
+
+	// Function group instruction to the packet address, that changes function F0 - F28.
+	// The other functions of the group are kept from the state.
+	DccPacket* locoFunction(DccPacket* packet, byte function, byte change);
+
+	// Writes one changed state per call, when no state was changed for DCC_STATE_FLUSH_IDLE_MS,
+	// or states are kept changing for DCC_STATE_FLUSH_MAX_MS.
+	void loop();
+
+	// Writes all changed states now. Called on power off.
+	void flush();
+	boolean isDirty();
+
+	// Log entries written since the start
+	unsigned long writeCount();
+
 private:
 	byte extractStateKind(DccPacket* p);
 	void saveBroadcastState(byte stateKind, DccPacket* packet);
-	void saveState(word eeprom, byte stateKind, DccPacket* packet);
+	boolean saveState(DccStateRecord& record, byte stateKind, DccPacket* packet);
+	boolean isRefreshDue(DccStateSlot state);
+	void readState(DccStateRecord& record, DccQueue& queue, DccStack& heap);
+	static byte packetCount(DccStateRecord& record);
 	
-	word findEeprom(DccPacket* packet);
-	word appendAddress(DccPacket* p);
-	void resetAddress(word eeprom, DccPacket* p);
+	DccStateSlot findState(DccPacket* packet);
+	DccStateSlot appendAddress(DccPacket* p);
+	void resetAddress(DccStateRecord& record, DccPacket* p);
 	
-	void updateAccess(word eeprom);
+	void updateAccess(DccStateSlot state);
+	void lruMoveFirst(DccStateSlot state);
+	void lruUnlink(DccStateSlot state);
+	void lruInsertAfter(DccStateSlot state, DccStateSlot previous);
+	void lruBuild();
+	void renumberAccess();
 
-	void updateSpeed28 (word eeprom, DccPacket* p);
-	void updateSpeed128(word eeprom, DccPacket* p);
+	void updateSpeed28 (DccStateRecord& record, DccPacket* p);
+	void updateSpeed128(DccStateRecord& record, DccPacket* p);
 
-	void updateF0_F4 (word eeprom, DccPacket* p);
-	void updateF5_F8 (word eeprom, DccPacket* p);
-	void updateF9_F12(word eeprom, DccPacket* p);
+	void updateF0_F4 (DccStateRecord& record, DccPacket* p);
+	void updateF5_F8 (DccStateRecord& record, DccPacket* p);
+	void updateF9_F12(DccStateRecord& record, DccPacket* p);
+	void updateGroup (DccStateRecord& record, byte group, DccPacket* p);
 	
-	void resetSpeed(word eeprom);
-	void resetState(word eeprom);
+	void resetSpeed(DccStateRecord& record);
+	void resetState(DccStateRecord& record);
+
+	void markDirty(DccStateSlot state);
+	void markChanged();
+	boolean flushNext();
+
+	DccStateSlot indexFind(byte address0, byte address1);
+	void indexAdd(DccStateSlot state);
+	void indexRemove(DccStateSlot state);
+	void indexBuild();
+
+	void recover();
+	void reload();
+	boolean readEntry(word position, word& sequence, word& slot, DccStateRecord* record);
+	word readSequence(word position);
+	boolean appendEntry(word slot);
+	word freePosition();
+	void writeEntry(word slot, word position);
 };
 
 extern DccStateKeeper DccState;
 
-#endif //__DCC_STATE_KEEPER_H__
\ No newline at end of file
+inline boolean DccStateKeeper::isDirty() {
+	return pending;
+}
+
+inline unsigned long DccStateKeeper::writeCount() {
+	return logWrites;
+}
+
+inline DccStateSlot DccStateKeeper::stateCount() {
+	return state_count;
+}
+
+inline DccStateSlot DccStateKeeper::exportFirst() {
+	return lruLast;
+}
+
+inline boolean DccStateKeeper::isRestoring() {
+	return restoreNext != DCC_STATE_NONE;
+}
+
+#endif //__DCC_STATE_KEEPER_H__
@@ -0,0 +1,41 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include "DccStorage.h"
+
+// Region is cut at the end of the EEPROM, the writes would wrap to its start
+DccEepromStorage::DccEepromStorage(word start, word length) 
+	: start(start), length(length) {
+	if (start > E2END)
+		this->length = 0;
+	else if (length > E2END + 1 - start)
+		this->length = E2END + 1 - start;
+}
+
+unsigned long DccEepromStorage::size() {
+	return length;
+}
+
+void DccEepromStorage::read(unsigned long address, byte* data, byte count) {
+	for (byte i = 0; i < count; ++i)
+		data[i] = EEPROM.read(start + address + i);
+}
+
+void DccEepromStorage::write(unsigned long address, const byte* data, byte count) {
+	// Same byte is not written again, it saves the write time and wear
+	for (byte i = 0; i < count; ++i) {
+		if (EEPROM.read(start + address + i) != data[i])
+			EEPROM.write(start + address + i, data[i]);
+	}
+}
@@ -0,0 +1,48 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#ifndef __DCC_STORAGE_H__
+#define __DCC_STORAGE_H__
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+// Boards that don't define the last EEPROM address get the 1 KB of ATmega328P
+#ifndef E2END
+#define E2END	(0x3FF)
+#endif
+
+// Non volatile memory of the state log. Addresses are relative to the storage start.
+// Every byte could be written any time, no erase is required.
+class DccStorage {
+public:
+	virtual unsigned long size() = 0;
+
+	virtual void read (unsigned long address, byte* data, byte count) = 0;
+	virtual void write(unsigned long address, const byte* data, byte count) = 0;
+};
+
+// Region of the internal EEPROM, up to its last address E2END
+class DccEepromStorage : public DccStorage {
+private:
+	word	start;
+	word	length;
+
+public:
+	DccEepromStorage(word start, word length);
+
+	virtual unsigned long size();
+
+	virtual void read (unsigned long address, byte* data, byte count);
+	virtual void write(unsigned long address, const byte* data, byte count);
+};
+
+#endif //__DCC_STORAGE_H__
@@ -0,0 +1,381 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#include <Arduino.h>
+#include "DccConfig.h"
+#include "DccZ21.h"
+#include "DccCommander.h"
+#include "DccStateKeeper.h"
+
+static word readWord(const byte* data) {
+	return data[0] | (data[1] << 8);
+}
+
+static unsigned long readLong(const byte* data) {
+	return (unsigned long) readWord(data) | ((unsigned long) readWord(data + 2) << 16);
+}
+
+static void writeLong(byte* data, unsigned long value) {
+	for (byte i = 0; i < 4; ++i, value >>= 8)
+		data[i] = value & 0xFF;
+}
+
+static byte writeMessage(byte* message, word header, const byte* data, byte size) {
+	message[0] = DCC_Z21_MESSAGE_HEADER_SIZE + size;
+	message[1] = 0;
+	message[2] = header & 0xFF;
+	message[3] = header >> 8;
+	for (byte i = 0; i < size; ++i)
+		message[DCC_Z21_MESSAGE_HEADER_SIZE + i] = data[i];
+	return message[0];
+}
+
+// LAN_X message ends with XOR of the X-Header and all the data bytes
+static byte writeMessageX(byte* message, const byte* data, byte size) {
+	byte check = 0;
+	for (byte i = 0; i < size; ++i)
+		check ^= data[i];
+
+	byte length = writeMessage(message, DCC_Z21_LAN_X, data, size);
+	message[length++] = check;
+	message[0] = length;
+	return length;
+}
+
+// Returns DCC_Z21_LOCO_ADDRESS_NONE for the address out of the DCC range
+static word readLocoAddress(const byte* data) {
+	word address = ((data[0] & DCC_Z21_LOCO_ADDRESS_MASK) << 8) | data[1];
+	return address > DCC_Z21_LOCO_ADDRESS_MAX ? DCC_Z21_LOCO_ADDRESS_NONE : address;
+}
+
+static_assert(DCC_Z21_FUNCTION_OFF == DCC_STATE_FUNCTION_OFF && DCC_Z21_FUNCTION_ON == DCC_STATE_FUNCTION_ON
+			  && DCC_Z21_FUNCTION_TOGGLE == DCC_STATE_FUNCTION_TOGGLE, "Z21 function types are passed to DccState.locoFunction(..)");
+
+DccZ21::DccZ21(DccZ21Transport& transport)
+	: transport(&transport) {
+	memset(clients, 0, sizeof(clients));
+	memset(turnouts, 0, sizeof(turnouts));
+	replySize = 0;
+	replyAddress = NULL;
+	replyPort = 0;
+	powerOn = false;
+	now = 0;
+}
+
+void DccZ21::receive(const byte* address, word port, const byte* data, word size) {
+	DccZ21Client* client = findClient(address, port);
+	replyAddress = address;
+	replyPort = port;
+	replySize = 0;
+
+	while (size >= DCC_Z21_MESSAGE_HEADER_SIZE) {
+		word length = readWord(data);
+		if (length < DCC_Z21_MESSAGE_HEADER_SIZE || length > size)
+			break;
+		handleMessage(client, readWord(data + 2), data + DCC_Z21_MESSAGE_HEADER_SIZE, length - DCC_Z21_MESSAGE_HEADER_SIZE);
+		data += length;
+		size -= length;
+	}
+	flushReply();
+	replyAddress = NULL;
+}
+
+void DccZ21::loop() {
+	boolean on = DccCmd.power();
+	if (on != powerOn) {
+		powerOn = on;
+		byte message[] = { DCC_Z21_X_BC, (byte) (on ? DCC_Z21_X_BC_TRACK_POWER_ON : DCC_Z21_X_BC_TRACK_POWER_OFF) };
+		broadcastX(NULL, message, sizeof(message));
+	}
+
+	now = millis();
+	for (byte i = 0; i < DCC_Z21_CLIENT_COUNT; ++i)
+		if (clients[i].active && (word)(now - clients[i].seen) >= DCC_Z21_CLIENT_TIMEOUT_MS)
+			clients[i].active = false;
+}
+
+// New client takes a free entry, or the entry of the client silent for the longest time.
+// Clients are stamped with the time of the last loop(), that is precise enough for the timeout.
+DccZ21::DccZ21Client* DccZ21::findClient(const byte* address, word port) {
+	DccZ21Client* slot = NULL;
+	for (byte i = 0; i < DCC_Z21_CLIENT_COUNT; ++i) {
+		DccZ21Client& client = clients[i];
+		if (!client.active) {
+			if (slot == NULL || slot->active)
+				slot = &client;
+			continue;
+		}
+		if (client.port == port && memcmp(client.address, address, sizeof(client.address)) == 0) {
+			client.seen = now;
+			return &client;
+		}
+		if (slot == NULL || (slot->active && (word)(now - client.seen) > (word)(now - slot->seen)))
+			slot = &client;
+	}
+
+	memcpy(slot->address, address, sizeof(slot->address));
+	slot->port = port;
+	slot->flags = 0;
+	slot->seen = now;
+	slot->active = true;
+	return slot;
+}
+
+void DccZ21::handleMessage(DccZ21Client* client, word header, const byte* data, word size) {
+	byte value[4];
+	switch (header) {
+		case DCC_Z21_LAN_GET_SERIAL_NUMBER:
+			writeLong(value, DCC_Z21_SERIAL_NUMBER);
+			addReply(header, value, sizeof(value));
+			break;
+		case DCC_Z21_LAN_LOGOFF:
+			client->active = false;
+			break;
+		case DCC_Z21_LAN_SET_BROADCASTFLAGS:
+			if (size >= sizeof(value))
+				client->flags = readLong(data);
+			break;
+		case DCC_Z21_LAN_GET_BROADCASTFLAGS:
+			writeLong(value, client->flags);
+			addReply(header, value, sizeof(value));
+			break;
+		case DCC_Z21_LAN_X:
+			handleX(client, data, size);
+			break;
+	}
+}
+
+// Message with the wrong checksum is ignored, unknown one is answered with LAN_X_UNKNOWN_COMMAND
+void DccZ21::handleX(DccZ21Client* client, const byte* data, word size) {
+	if (size < 2)
+		return;
+	byte check = 0;
+	for (word i = 0; i < size; ++i)
+		check ^= data[i];
+	if (check != 0)
+		return;
+
+	byte message[DCC_Z21_MESSAGE_MAX_SIZE];
+	switch (data[0]) {
+		case DCC_Z21_X_GET:
+			if (size < 3)
+				break;
+			switch (data[1]) {
+				case DCC_Z21_X_GET_VERSION:
+					message[0] = DCC_Z21_X_VERSION;
+					message[1] = DCC_Z21_X_GET_VERSION;
+					message[2] = DCC_Z21_X_BUS_VERSION;
+					message[3] = DCC_Z21_X_CENTRAL_ID;
+					addReplyX(message, 4);
+					return;
+				case DCC_Z21_X_GET_STATUS:
+					message[0] = DCC_Z21_X_STATUS_CHANGED;
+					message[1] = DCC_Z21_X_STATUS_CHANGED_DB0;
+					message[2] = DccCmd.power() ? 0 : DCC_Z21_STATUS_TRACK_VOLTAGE_OFF;
+					addReplyX(message, 3);
+					return;
+				case DCC_Z21_X_SET_TRACK_POWER_OFF:
+				case DCC_Z21_X_SET_TRACK_POWER_ON:
+					handlePower(client, data[1] == DCC_Z21_X_SET_TRACK_POWER_ON);
+					return;
+			}
+			break;
+		case DCC_Z21_X_SET_STOP:
+			handleStop(client);
+			return;
+		case DCC_Z21_X_GET_LOCO_INFO:
+			if (size < 5 || data[1] != DCC_Z21_X_GET_LOCO_INFO_DB0 || readLocoAddress(data + 2) == DCC_Z21_LOCO_ADDRESS_NONE)
+				break;
+			addReplyX(message, buildLocoInfo(data + 2, message));
+			return;
+		case DCC_Z21_X_SET_LOCO:
+			if (size < 6 || readLocoAddress(data + 2) == DCC_Z21_LOCO_ADDRESS_NONE)
+				break;
+			if ((data[1] & DCC_Z21_X_SET_LOCO_DRIVE_MASK) == DCC_Z21_X_SET_LOCO_DRIVE) {
+				handleLocoDrive(client, data + 1);
+				return;
+			}
+			if (data[1] == DCC_Z21_X_SET_LOCO_FUNCTION && (data[4] & DCC_Z21_FUNCTION_INDEX_MASK) <= DCC_Z21_FUNCTION_MAX
+			 && (data[4] >> DCC_Z21_FUNCTION_TYPE_SHIFT) <= DCC_Z21_FUNCTION_TOGGLE) {
+				handleLocoFunction(client, data + 1);
+				return;
+			}
+			break;
+		case DCC_Z21_X_GET_TURNOUT_INFO:
+			if (size < 4)
+				break;
+			addReplyX(message, buildTurnoutInfo(data + 1, message));
+			return;
+		case DCC_Z21_X_SET_TURNOUT:
+			if (size < 5 || ((data[1] << 8) | data[2]) > DCC_Z21_TURNOUT_ADDRESS_MAX)
+				break;
+			handleTurnout(client, data + 1);
+			return;
+	}
+	message[0] = DCC_Z21_X_BC;
+	message[1] = DCC_Z21_X_UNKNOWN_COMMAND;
+	addReplyX(message, 2);
+}
+
+// data: DB0 (0x1S), Adr_MSB, Adr_LSB, RVVVVVVV
+void DccZ21::handleLocoDrive(DccZ21Client* client, const byte* data) {
+	DccPacket* packet = DccCmd.newPacket();
+	if (packet == NULL)
+		return;
+	packet->mfAddress(readLocoAddress(data + 1));
+
+	byte speed = data[3];
+	switch (data[0] & DCC_Z21_DRIVE_STEPS_MASK) {
+		case DCC_Z21_DRIVE_STEPS_14:
+			packet->speed14(speed & DCC_Z21_SPEED_FORWARD, speed & DCC_Z21_SPEED_14_MASK);
+			break;
+		case DCC_Z21_DRIVE_STEPS_128:
+			packet->speed128(speed);
+			break;
+		default:
+			packet->speed28(((speed & DCC_Z21_SPEED_FORWARD) ? DCC_MF_KIND3_FORWARD_OPERATION : DCC_MF_KIND3_REVERSE_OPERATION)
+						  | (speed & DCC_Z21_SPEED_28_MASK));
+			break;
+	}
+	DccCmd.send(packet);
+
+	byte message[DCC_Z21_MESSAGE_MAX_SIZE];
+	notifyX(client, message, buildLocoInfo(data + 1, message));
+}
+
+// data: DB0 (0xF8), Adr_MSB, Adr_LSB, TTNNNNNN. Whole function group is sent, the others are kept from the state.
+void DccZ21::handleLocoFunction(DccZ21Client* client, const byte* data) {
+	DccPacket* packet = DccCmd.newPacket();
+	if (packet == NULL)
+		return;
+	packet->mfAddress(readLocoAddress(data + 1));
+	DccCmd.send(DccState.locoFunction(packet, data[3] & DCC_Z21_FUNCTION_INDEX_MASK, data[3] >> DCC_Z21_FUNCTION_TYPE_SHIFT));
+
+	byte message[DCC_Z21_MESSAGE_MAX_SIZE];
+	notifyX(client, message, buildLocoInfo(data + 1, message));
+}
+
+// data: FAdr_MSB, FAdr_LSB, 10Q0A00P. Only the activation changes the turnout info.
+void DccZ21::handleTurnout(DccZ21Client* client, const byte* data) {
+	DccPacket* packet = DccCmd.newPacket();
+	if (packet == NULL)
+		return;
+
+	word functionAddress = (data[0] << 8) | data[1];
+	byte output = data[2] & DCC_Z21_TURNOUT_OUTPUT;
+	boolean on = data[2] & DCC_Z21_TURNOUT_ACTIVATE;
+	DccCmd.send(packet->baAddress((functionAddress >> DCC_Z21_TURNOUT_ADDRESS_SHIFT) + 1,
+								  functionAddress & DCC_Z21_TURNOUT_PORT_MASK, output).activate(on));
+	if (!on)
+		return;
+
+	if (functionAddress < DCC_Z21_TURNOUT_COUNT) {
+		byte shift = (functionAddress & 0x03) * 2;
+		turnouts[functionAddress >> 2] = (turnouts[functionAddress >> 2] & ~(0x03 << shift))
+									   | ((output ? DCC_Z21_TURNOUT_OUTPUT_1 : DCC_Z21_TURNOUT_OUTPUT_0) << shift);
+	}
+
+	byte message[DCC_Z21_MESSAGE_MAX_SIZE];
+	notifyX(client, message, buildTurnoutInfo(data, message));
+}
+
+void DccZ21::handlePower(DccZ21Client* client, boolean on) {
+	DccCmd.power(on);
+	powerOn = on;
+
+	byte message[] = { DCC_Z21_X_BC, (byte) (on ? DCC_Z21_X_BC_TRACK_POWER_ON : DCC_Z21_X_BC_TRACK_POWER_OFF) };
+	notifyX(client, message, sizeof(message));
+}
+
+// All the locomotives stop with the emergency stop broadcast, the track power stays on
+void DccZ21::handleStop(DccZ21Client* client) {
+	DccPacket* packet = DccCmd.newPacket();
+	if (packet == NULL)
+		return;
+	DccCmd.send(packet->mfBroadcast().speed28(true, DCC_MF_SPEED_28_EMERGENCY_STOP));
+
+	byte message[] = { DCC_Z21_X_BC_STOPPED, 0x00 };
+	notifyX(client, message, sizeof(message));
+}
+
+// LAN_X_LOCO_INFO without the checksum: X-Header, Adr_MSB, Adr_LSB, steps, speed, F0 F4-F1, F12-F5, F20-F13, F28-F21
+byte DccZ21::buildLocoInfo(const byte* address, byte* message) {
+	DccPacket packet;
+	packet.mfAddress(readLocoAddress(address));
+
+	byte speed;
+	boolean speed128;
+	unsigned long functions;
+	DccState.locoState(&packet, speed, speed128, functions);
+
+	message[0] = DCC_Z21_X_LOCO_INFO;
+	message[1] = address[0];
+	message[2] = address[1];
+	if (speed128) {
+		message[3] = DCC_Z21_INFO_STEPS_128;
+		message[4] = speed;
+	} else {
+		message[3] = DCC_Z21_INFO_STEPS_28;
+		message[4] = ((speed & DCC_MF_KIND3_MASK) == DCC_MF_KIND3_FORWARD_OPERATION ? DCC_Z21_SPEED_FORWARD : 0)
+				   | (speed & DCC_Z21_SPEED_28_MASK);
+	}
+	message[5] = ((functions & 1) ? DCC_Z21_INFO_F0 : 0) | ((functions >> 1) & DCC_Z21_INFO_F1_F4_MASK);
+	message[6] = (functions >> 5) & 0xFF;
+	message[7] = (functions >> 13) & 0xFF;
+	message[8] = (functions >> 21) & 0xFF;
+	return 9;
+}
+
+// LAN_X_TURNOUT_INFO without the checksum: X-Header, FAdr_MSB, FAdr_LSB, ZZ
+byte DccZ21::buildTurnoutInfo(const byte* address, byte* message) {
+	word functionAddress = (address[0] << 8) | address[1];
+	message[0] = DCC_Z21_X_TURNOUT_INFO;
+	message[1] = address[0];
+	message[2] = address[1];
+	message[3] = functionAddress < DCC_Z21_TURNOUT_COUNT
+			   ? (turnouts[functionAddress >> 2] >> ((functionAddress & 0x03) * 2)) & 0x03
+			   : DCC_Z21_TURNOUT_UNKNOWN;
+	return 4;
+}
+
+void DccZ21::addReply(word header, const byte* data, byte size) {
+	if (replySize + DCC_Z21_MESSAGE_MAX_SIZE > DCC_Z21_REPLY_SIZE)
+		flushReply();
+	replySize += writeMessage(reply + replySize, header, data, size);
+}
+
+void DccZ21::addReplyX(const byte* data, byte size) {
+	if (replySize + DCC_Z21_MESSAGE_MAX_SIZE > DCC_Z21_REPLY_SIZE)
+		flushReply();
+	replySize += writeMessageX(reply + replySize, data, size);
+}
+
+void DccZ21::flushReply() {
+	if (replySize > 0 && replyAddress != NULL)
+		transport->send(replyAddress, replyPort, reply, replySize);
+	replySize = 0;
+}
+
+// Change is replied to the client, and broadcast to the other subscribed clients
+void DccZ21::notifyX(DccZ21Client* client, const byte* data, byte size) {
+	addReplyX(data, size);
+	broadcastX(client, data, size);
+}
+
+void DccZ21::broadcastX(DccZ21Client* except, const byte* data, byte size) {
+	byte message[DCC_Z21_MESSAGE_MAX_SIZE];
+	byte length = writeMessageX(message, data, size);
+	for (byte i = 0; i < DCC_Z21_CLIENT_COUNT; ++i) {
+		DccZ21Client& client = clients[i];
+		if (client.active && &client != except && (client.flags & DCC_Z21_FLAG_DRIVING_SWITCHING))
+			transport->send(client.address, client.port, message, length);
+	}
+}
@@ -0,0 +1,192 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#ifndef __DCC_Z21_H__
+#define __DCC_Z21_H__
+
+#include <Arduino.h>
+#include "DccConfig.h"
+#include "DccPacket.h"
+
+// Z21 LAN Protocol
+//======================================================
+// Datagram has one or more messages: DataLen (2 bytes), Header (2 bytes), Data.
+// Numbers are little endian. DataLen counts the whole message.
+#define DCC_Z21_PORT						(21105)
+#define DCC_Z21_MESSAGE_HEADER_SIZE			(4)
+
+#define DCC_Z21_LAN_GET_SERIAL_NUMBER		(0x10)
+#define DCC_Z21_LAN_LOGOFF					(0x30)
+#define DCC_Z21_LAN_X						(0x40)
+#define DCC_Z21_LAN_SET_BROADCASTFLAGS		(0x50)
+#define DCC_Z21_LAN_GET_BROADCASTFLAGS		(0x51)
+
+// Broadcast of the track power, locomotive and turnout changes
+#define DCC_Z21_FLAG_DRIVING_SWITCHING		(0x00000001UL)
+
+// LAN_X message: X-Header, DB0 ... DBn, XOR of all the previous bytes
+#define DCC_Z21_X_GET						(0x21)
+#define DCC_Z21_X_GET_VERSION				(0x21)
+#define DCC_Z21_X_GET_STATUS				(0x24)
+#define DCC_Z21_X_SET_TRACK_POWER_OFF		(0x80)
+#define DCC_Z21_X_SET_TRACK_POWER_ON		(0x81)
+#define DCC_Z21_X_SET_STOP					(0x80)
+#define DCC_Z21_X_GET_LOCO_INFO				(0xE3)
+#define DCC_Z21_X_GET_LOCO_INFO_DB0			(0xF0)
+#define DCC_Z21_X_SET_LOCO					(0xE4)
+#define DCC_Z21_X_SET_LOCO_DRIVE_MASK		(0xF0)
+#define DCC_Z21_X_SET_LOCO_DRIVE			(0x10)
+#define DCC_Z21_X_SET_LOCO_FUNCTION			(0xF8)
+#define DCC_Z21_X_GET_TURNOUT_INFO			(0x43)
+#define DCC_Z21_X_SET_TURNOUT				(0x53)
+
+#define DCC_Z21_X_VERSION					(0x63)
+#define DCC_Z21_X_STATUS_CHANGED			(0x62)
+#define DCC_Z21_X_STATUS_CHANGED_DB0		(0x22)
+#define DCC_Z21_X_BC						(0x61)
+#define DCC_Z21_X_BC_TRACK_POWER_OFF		(0x00)
+#define DCC_Z21_X_BC_TRACK_POWER_ON			(0x01)
+#define DCC_Z21_X_UNKNOWN_COMMAND			(0x82)
+#define DCC_Z21_X_BC_STOPPED				(0x81)
+#define DCC_Z21_X_LOCO_INFO					(0xEF)
+#define DCC_Z21_X_TURNOUT_INFO				(0x43)
+
+// Reply of LAN_X_GET_VERSION: X-Bus version 3.0, Z21 central
+#define DCC_Z21_X_BUS_VERSION				(0x30)
+#define DCC_Z21_X_CENTRAL_ID				(0x12)
+
+// Central status bits
+#define DCC_Z21_STATUS_EMERGENCY_STOP		(0x01)
+#define DCC_Z21_STATUS_TRACK_VOLTAGE_OFF	(0x02)
+
+// Locomotive address: Adr_MSB (0xC0 set for the long address), Adr_LSB
+#define DCC_Z21_LOCO_ADDRESS_MASK			(0x3F)
+#define DCC_Z21_LOCO_ADDRESS_MAX			(10239)
+#define DCC_Z21_LOCO_ADDRESS_NONE			(0xFFFF)
+
+// Speed steps: S of SET_LOCO_DRIVE, KKK of LOCO_INFO
+#define DCC_Z21_DRIVE_STEPS_MASK			(0x03)
+#define DCC_Z21_DRIVE_STEPS_14				(0x00)
+#define DCC_Z21_DRIVE_STEPS_28				(0x02)
+#define DCC_Z21_DRIVE_STEPS_128				(0x03)
+#define DCC_Z21_INFO_STEPS_28				(0x02)
+#define DCC_Z21_INFO_STEPS_128				(0x04)
+
+// Speed: RVVVVVVV, R set for forward. 28 steps are coded as in DCC, with the low bit in bit 4.
+#define DCC_Z21_SPEED_FORWARD				(0x80)
+#define DCC_Z21_SPEED_14_MASK				(0x0F)
+#define DCC_Z21_SPEED_28_MASK				(0x1F)
+
+// Functions of LOCO_INFO: 0DSLFGHJ, L - F0, FGHJ - F4 - F1, as in the DCC F0 - F4 instruction
+#define DCC_Z21_INFO_F0						(0x10)
+#define DCC_Z21_INFO_F1_F4_MASK				(0x0F)
+
+// Function: TTNNNNNN, TT - 00 off, 01 on, 10 toggle, NNNNNN - function F0 - F28
+#define DCC_Z21_FUNCTION_TYPE_SHIFT			(6)
+#define DCC_Z21_FUNCTION_OFF				(0x00)
+#define DCC_Z21_FUNCTION_ON					(0x01)
+#define DCC_Z21_FUNCTION_TOGGLE				(0x02)
+#define DCC_Z21_FUNCTION_INDEX_MASK			(0x3F)
+#define DCC_Z21_FUNCTION_MAX				(28)
+
+// Turnout: 10Q0A00P, A - activate, P - output. Function address is 4 * (decoder address - 1) + port.
+#define DCC_Z21_TURNOUT_ACTIVATE			(0x08)
+#define DCC_Z21_TURNOUT_OUTPUT				(0x01)
+#define DCC_Z21_TURNOUT_PORT_MASK			(0x03)
+#define DCC_Z21_TURNOUT_ADDRESS_SHIFT		(2)
+#define DCC_Z21_TURNOUT_ADDRESS_MAX			(2039)
+// ZZ of TURNOUT_INFO: 00 - not switched yet, 01 - output 0, 10 - output 1
+#define DCC_Z21_TURNOUT_UNKNOWN				(0x00)
+#define DCC_Z21_TURNOUT_OUTPUT_0			(0x01)
+#define DCC_Z21_TURNOUT_OUTPUT_1			(0x02)
+
+// Largest message sent, and the largest datagram of the replies to one received datagram
+#define DCC_Z21_MESSAGE_MAX_SIZE			(16)
+#define DCC_Z21_REPLY_SIZE					(64)
+
+// Sends the datagram to the client, address is IPv4 (4 bytes), port is UDP port
+class DccZ21Transport {
+public:
+	virtual void send(const byte* address, word port, const byte* data, byte size) = 0;
+};
+
+// Z21 LAN protocol of the throttles and PC software, over any UDP stack.
+// Drive, function and turnout messages are built into packets directly and passed to DccCommander::send(),
+// locomotive info is read from DccStateKeeper. Track power, locomotive and turnout changes made by
+// any client are broadcast to the clients that set DCC_Z21_FLAG_DRIVING_SWITCHING.
+//
+// Clients are known by their address and port. Client is forgotten after LAN_LOGOFF,
+// DCC_Z21_CLIENT_TIMEOUT_MS without a message, or when the table is full and a new client comes.
+class DccZ21 {
+private:
+	struct DccZ21Client {
+		byte			address[4];
+		word			port;
+		unsigned long	flags;
+		word			seen;
+		boolean			active;
+	};
+
+	DccZ21Transport*	transport;
+	DccZ21Client		clients[DCC_Z21_CLIENT_COUNT];
+
+	// Replies to the received datagram are sent in one datagram
+	byte				reply[DCC_Z21_REPLY_SIZE];
+	byte				replySize;
+	const byte*			replyAddress;
+	word				replyPort;
+
+	// Last output of the turnouts, two bits (ZZ) per function address
+	byte				turnouts[(DCC_Z21_TURNOUT_COUNT + 3) / 4];
+
+	boolean				powerOn;
+	word				now;
+
+public:
+	DccZ21(DccZ21Transport& transport);
+
+	// Handles all the messages of the datagram received from the client
+	void 	receive(const byte* address, word port, const byte* data, word size);
+
+	// Broadcasts track power changed by other commands, forgets silent clients
+	void 	loop();
+
+	byte 	clientCount();
+
+private:
+	DccZ21Client* findClient(const byte* address, word port);
+	void 	handleMessage(DccZ21Client* client, word header, const byte* data, word size);
+	void 	handleX(DccZ21Client* client, const byte* data, word size);
+	void 	handleLocoDrive(DccZ21Client* client, const byte* data);
+	void 	handleLocoFunction(DccZ21Client* client, const byte* data);
+	void 	handleTurnout(DccZ21Client* client, const byte* data);
+	void 	handlePower(DccZ21Client* client, boolean on);
+	void 	handleStop(DccZ21Client* client);
+
+	byte 	buildLocoInfo(const byte* address, byte* message);
+	byte 	buildTurnoutInfo(const byte* address, byte* message);
+
+	void 	addReply(word header, const byte* data, byte size);
+	void 	addReplyX(const byte* data, byte size);
+	void 	flushReply();
+	void 	notifyX(DccZ21Client* client, const byte* data, byte size);
+	void 	broadcastX(DccZ21Client* except, const byte* data, byte size);
+};
+
+inline byte DccZ21::clientCount() {
+	byte count = 0;
+	for (byte i = 0; i < DCC_Z21_CLIENT_COUNT; ++i)
+		if (clients[i].active)
+			++count;
+	return count;
+}
+
+#endif //__DCC_Z21_H__
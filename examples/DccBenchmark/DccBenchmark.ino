@@ -0,0 +1,268 @@
+/**
+ ** This is Public Domain Software.
+ **
+ ** The author disclaims copyright to this source code.
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include <DccConfig.h>
+#include <DccPacket.h>
+#include <DccCollection.h>
+#include <DccStorage.h>
+#include <DccStateKeeper.h>
+#include <DccCommander.h>
+#include <DccZ21.h>
+
+// Every benchmark prints one line: <name>,<operations per second> or <name>,<count>
+#ifdef DCC_HOST
+#define BENCHMARK_ITERATIONS (200000L)
+#else
+#define BENCHMARK_ITERATIONS (2000)
+#endif
+
+const char* textCommands[] = {
+    "m3f20",
+    "M1234R100",
+    "m3A10101",
+    "M3000E01010101",
+    "B291P3O1A",
+    "E1929S31",
+    "H03FF00",
+    "m3x20",
+};
+
+#define TEXT_COMMAND_COUNT (sizeof(textCommands)/sizeof(textCommands[0]))
+
+DccPacket TEST;
+volatile byte sink;
+
+// Internal EEPROM region of the state log, counting the written bytes
+class CountingStorage : public DccEepromStorage {
+public:
+    unsigned long writes;
+
+    CountingStorage() : DccEepromStorage(DCC_STATE_EEPROM_ADDR, DCC_STATE_EEPROM_SIZE), writes(0) {}
+
+    virtual void write(unsigned long address, const byte* data, byte count) {
+        writes += count;
+        DccEepromStorage::write(address, data, count);
+    }
+};
+
+CountingStorage storage;
+
+// Drops the replies of the Z21 front end
+class NullTransport : public DccZ21Transport {
+public:
+    virtual void send(const byte* address, word port, const byte* data, byte size) {
+        sink = size;
+    }
+};
+
+NullTransport nullTransport;
+DccZ21 z21(nullTransport);
+
+const byte z21Client[] = { 127, 0, 0, 1 };
+// LAN_X_SET_LOCO_DRIVE: locomotive 3, 128 steps, forward 50
+const byte z21Drive[] = { 0x0A, 0x00, 0x40, 0x00, 0xE4, 0x13, 0x00, 0x03, 0xB2, 0x46 };
+
+void report(const char* name, unsigned long operations, unsigned long elapsed) {
+    Serial.print(name);
+    Serial.print(",");
+    Serial.println(elapsed == 0 ? 0 : (unsigned long)((operations * 1000000.0) / elapsed));
+}
+
+void reportCount(const char* name, unsigned long count) {
+    Serial.print(name);
+    Serial.print(",");
+    Serial.println(count);
+}
+
+// Reference: the unchecked switch parser the grammar table replaced.
+// It has no range checks and no error codes, so it only bounds the table parser from above.
+word switchNumber(const char*& s) {
+    word value = 0;
+    while (DccPacket::isDigit(*s))
+        value = value * 10 + (*s++ - '0');
+    return value;
+}
+
+byte switchBits(const char*& s, byte count) {
+    byte value = 0;
+    for (byte i = 0; i < count; ++i)
+        if (DccPacket::parseBoolean(*s++))
+            value |= (1 << i);
+    return value;
+}
+
+boolean switchParseMF(DccPacket& packet, const char*& s) {
+    switch(*s++) {
+        case 'f': packet.speed28(true, switchNumber(s)); return true;
+        case 'r': packet.speed28(false, switchNumber(s)); return true;
+        case 'F': packet.speed128(true, switchNumber(s)); return true;
+        case 'R': packet.speed128(false, switchNumber(s)); return true;
+        case 'A': { byte bits = switchBits(s, 5); packet.functionF0_F4(((bits & 0x01) << 4) | (bits >> 1)); return true; }
+        case 'B': packet.functionF5_F8(switchBits(s, 4)); return true;
+        case 'C': packet.functionF9_F12(switchBits(s, 4)); return true;
+        case 'D': packet.functionF13_F20(switchBits(s, 8)); return true;
+        case 'E': packet.functionF21_F28(switchBits(s, 8)); return true;
+    }
+    return false;
+}
+
+boolean switchParse(DccPacket& packet, const char* s) {
+    switch(*s++) {
+        case 'm': return switchParseMF(packet.mfAddress7(switchNumber(s)), s);
+        case 'M': return switchParseMF(packet.mfAddress14(switchNumber(s)), s);
+        case 'B': {
+            word address = DccPacket::isDigit(*s) ? switchNumber(s) : DCC_BA_ADDRESS_BROADCAST;
+            if (*s++ != 'P')
+                return false;
+            byte port = switchNumber(s);
+            if (*s++ != 'O')
+                return false;
+            byte output = switchNumber(s);
+            packet.baAddress(address, port, output);
+            switch(*s) {
+                case 'A': packet.activate(true); return true;
+                case 'D': packet.activate(false); return true;
+            }
+            return false;
+        }
+        case 'E':
+            packet.eaAddress(DccPacket::isDigit(*s) ? switchNumber(s) : DCC_EA_ADDRESS_BROADCAST);
+            if (*s++ != 'S')
+                return false;
+            packet.state(switchNumber(s));
+            return true;
+    }
+    return false;
+}
+
+void benchmarkTextParsing() {
+    unsigned long start = micros();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; ++i) {
+        const char* s = textCommands[i % TEXT_COMMAND_COUNT];
+        sink = (*s == 'H') ? TEST.parseDccHex(++s) : TEST.parseDccText(s);
+    }
+    report("text_parse_per_sec", BENCHMARK_ITERATIONS, micros() - start);
+
+    start = micros();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; ++i) {
+        const char* s = textCommands[i % TEXT_COMMAND_COUNT];
+        sink = (*s == 'H') ? TEST.parseDccHex(++s) : switchParse(TEST, s);
+    }
+    report("text_parse_switch_per_sec", BENCHMARK_ITERATIONS, micros() - start);
+}
+
+void benchmarkPacketBuilding() {
+    unsigned long start = micros();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; ++i) {
+        TEST.mfAddress14(i & 0x1FFF).speed128(true, i & DCC_MF_SPEED_128_MASK);
+        sink = TEST.dcc_data[4];
+    }
+    report("packet_build_per_sec", BENCHMARK_ITERATIONS, micros() - start);
+}
+
+void benchmarkQueue() {
+    DccPacket packets[DCC_QUEUE_MAX_COUNT];
+    DccStack  recycle(packets, DCC_QUEUE_MAX_COUNT);
+    DccQueue  queue;
+
+    unsigned long start = micros();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; ++i) {
+        queue.add(recycle.pop());
+        recycle.push(queue.next());
+        sink = queue.size();
+    }
+    report("queue_roundtrip_per_sec", BENCHMARK_ITERATIONS, micros() - start);
+}
+
+void benchmarkStateSave() {
+    DccState.storage(&storage);
+    DccState.begin();
+
+    unsigned long start = micros();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; ++i) {
+        TEST.mfAddress7(1 + i % DCC_STATE_MAX_COUNT).speed128(true, i & DCC_MF_SPEED_128_MASK);
+        DccState.saveState(&TEST);
+    }
+    report("state_save_per_sec", BENCHMARK_ITERATIONS, micros() - start);
+}
+
+void benchmarkStateRefresh() {
+    DccPacket packets[DCC_QUEUE_MAX_COUNT];
+    DccStack  recycle(packets, DCC_QUEUE_MAX_COUNT);
+    DccQueue  queue;
+
+    unsigned long start = micros();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; ++i) {
+        DccState.readNextState(queue, recycle);
+        while (!queue.isEmpty())
+            recycle.push(queue.next());
+    }
+    report("state_refresh_per_sec", BENCHMARK_ITERATIONS, micros() - start);
+}
+
+// Storage bytes per command, including the repeated ones, that change nothing
+void benchmarkStorageWrites() {
+    DccState.storage(&storage);
+    DccState.begin();
+    DccState.flush();
+    storage.writes = 0;
+
+    const int commands = 100;
+    for (int i = 0; i < commands; ++i) {
+        TEST.mfAddress7(1 + i % 4).speed128(true, (i / 8) & DCC_MF_SPEED_128_MASK);
+        DccState.saveState(&TEST);
+        DccState.flush();
+    }
+    reportCount("storage_bytes_written_per_100_commands", storage.writes);
+    DccState.storage(NULL);
+    DccState.begin();
+}
+
+// Locomotive 3, 128 steps, forward 50, as z21Drive
+void benchmarkTextCommand() {
+    unsigned long start = micros();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; ++i) {
+        sink = *DccCmd.handleTextCommand("m3F50");
+        DccCmd.resetQueue();
+    }
+    report("text_command_per_sec", BENCHMARK_ITERATIONS, micros() - start);
+}
+
+// Same command path as the text command, and the LAN_X_LOCO_INFO reply
+void benchmarkZ21Command() {
+    unsigned long start = micros();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; ++i) {
+        z21.receive(z21Client, DCC_Z21_PORT, z21Drive, sizeof(z21Drive));
+        DccCmd.resetQueue();
+    }
+    report("z21_command_per_sec", BENCHMARK_ITERATIONS, micros() - start);
+}
+
+void setup() {
+    Serial.begin(115200);
+
+    //Teensy 3.0 required some time before Serial become functional.
+    delay(500);
+
+    benchmarkTextParsing();
+    benchmarkPacketBuilding();
+    benchmarkQueue();
+    benchmarkStateSave();
+    benchmarkStateRefresh();
+    benchmarkStorageWrites();
+    benchmarkTextCommand();
+    benchmarkZ21Command();
+}
+
+void loop() {
+}
@@ -49,6 +49,10 @@ DccPacket DccProtocolTest::TEST;
 
 #define TIMER_COUNTER_REGISTER     FTM1_MOD
 
+#elif defined(DCC_HOST)
+
+#define TIMER_COUNTER_REGISTER     DccHostTimerCount
+
 #endif
 
 byte DccProtocolTest::readState() {
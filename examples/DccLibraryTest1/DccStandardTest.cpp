@@ -247,7 +247,7 @@ void DccStandardTest::testMF_CV_Long() {
         DCC_CV_BIT_VERIFY,
         DCC_CV_BIT_WRITE
     };    
-    ASSERT(UnitTest::unique_values(operations, sizeof(operations)));
+    ASSERT(UnitTest::unique_values(bitop, sizeof(bitop)));
     ASSERT(UnitTest::bits_in_mask(DCC_CV_BIT_VERIFY, DCC_CV_BIT_OP_MASK));
     ASSERT(UnitTest::bits_in_mask(DCC_CV_BIT_WRITE, DCC_CV_BIT_OP_MASK));
     
@@ -11,10 +11,14 @@
  
 #include <Arduino.h>
 #include <EEPROM.h>
+#include <Wire.h>
 
 #include <DccConfig.h>
 #include <DccPacket.h>
 #include <DccStateKeeper.h>
+#include <DccCommander.h>
+#include <DccFileStorage.h>
+#include <DccFramStorage.h>
 #include <UnitTest.h>
 
 #include "DccStateKeeperTest.h"
@@ -47,6 +51,7 @@ void DccStateKeeperTest::testSpeed() {
     TEST.mfAddress14(0x2345).speed128(false, 0x15);
     DccState.saveState(&TEST);  
     
+    //Functions all off are not refreshed
     DccState.readNextState(queue, recycle);
     DccPacket* p = queue.next();
     recycle.push(p);
@@ -57,15 +62,6 @@ void DccStateKeeperTest::testSpeed() {
     ASSERT( p->dcc_data[1] == 0x61);                    //05
     ASSERT( p->dcc_data[2] == 0x73);
 
-    p = queue.next();
-    recycle.push(p);
-    ASSERT( p->size() == 3);
-    ASSERT( p->repeat() == DCC_REPEAT_FUNCTION);
-    ASSERT(!p->hasAcknowledge());                               
-    ASSERT( p->dcc_data[0] == 0x12);                    //10
-    ASSERT( p->dcc_data[1] == 0x80);                    
-    ASSERT( p->dcc_data[2] == 0x92);
-
     ASSERT( queue.isEmpty());
 
     DccState.readNextState(queue, recycle);
@@ -73,37 +69,55 @@ void DccStateKeeperTest::testSpeed() {
     recycle.push(p);
 
     ASSERT( p->size() == 5);                           
-    ASSERT( p->repeat() == DCC_REPEAT_SPEED);            //15     
-    ASSERT(!p->hasAcknowledge());
+    ASSERT( p->repeat() == DCC_REPEAT_SPEED);
+    ASSERT(!p->hasAcknowledge());                       //10
     ASSERT( p->dcc_data[0] == 0xE3);
     ASSERT( p->dcc_data[1] == 0x45);                    
     ASSERT( p->dcc_data[2] == 0x3F);                   
-    ASSERT( p->dcc_data[3] == 0x15);                     //20              
-    ASSERT( p->dcc_data[4] == 0x8C);                    
-
-    p = queue.next();
-    recycle.push(p);
-    ASSERT( p->size() == 4);
-    ASSERT( p->repeat() == DCC_REPEAT_FUNCTION);
-    ASSERT(!p->hasAcknowledge());                               
-    ASSERT( p->dcc_data[0] == 0xE3);                    //25
-    ASSERT( p->dcc_data[1] == 0x45);                    
-    ASSERT( p->dcc_data[2] == 0x80);                    
-    ASSERT( p->dcc_data[3] == 0x26);
+    ASSERT( p->dcc_data[3] == 0x15);                                  
+    ASSERT( p->dcc_data[4] == 0x8C);                    //15
 
     ASSERT( queue.isEmpty());                           
     
     DccState.readNextState(queue, recycle);
     p = queue.next();
     recycle.push(p);
-    ASSERT( p->size() == 3);                            //30
+    ASSERT( p->size() == 3);
     ASSERT( p->repeat() == DCC_REPEAT_STOP);
     ASSERT(!p->hasAcknowledge());                       
-    ASSERT( p->dcc_data[0] == 0x12);
+    ASSERT( p->dcc_data[0] == 0x12);                    //20
     ASSERT( p->dcc_data[1] == 0x61);                    
     ASSERT( p->dcc_data[2] == 0x73);
 }
 
+void DccStateKeeperTest::testSpeed14() {
+    startTest();
+    
+    DccPacket TEST;
+
+    //14 steps share the instruction with 28 steps, F0 is the bit 4
+    TEST.mfAddress7(0x12).speed28(DCC_MF_KIND3_FORWARD_OPERATION | 0x10 | 0x07);
+    DccState.saveState(&TEST);    
+
+    DccState.readNextState(queue, recycle);
+    DccPacket* p = queue.next();
+    recycle.push(p);
+    ASSERT( p->dcc_data[0] == 0x12);
+    ASSERT( p->dcc_data[1] == 0x77);
+    ASSERT( queue.isEmpty());
+
+    //Reset stops, and keeps F0
+    TEST.mfAddress7(0x12).mfCommand1(DCC_MF_DECODER_SOFT_RESET);
+    DccState.saveState(&TEST);    
+
+    DccState.readNextState(queue, recycle);
+    p = queue.next();
+    recycle.push(p);
+    ASSERT( p->dcc_data[0] == 0x12);
+    ASSERT( p->dcc_data[1] == 0x70);                    //5
+    ASSERT( queue.isEmpty());
+}
+
 
 void DccStateKeeperTest::testFunctions() {
     startTest();
@@ -219,6 +233,58 @@ void DccStateKeeperTest::testFunctions() {
     ASSERT( p->dcc_data[2] == 0xAC);                   
     ASSERT( p->dcc_data[3] == 0x0A);    
 
+    p = queue.next();
+    recycle.push(p);
+    ASSERT( p->size() == 5);                           
+    ASSERT( p->repeat() == DCC_REPEAT_FUNCTION);        //50
+    ASSERT(!p->hasAcknowledge());
+    ASSERT( p->dcc_data[0] == 0xE3);                    
+    ASSERT( p->dcc_data[1] == 0x45);                    
+    ASSERT( p->dcc_data[2] == 0xDE);                   
+    ASSERT( p->dcc_data[3] == 0xAA);                    //55
+    ASSERT( p->dcc_data[4] == 0xD2);    
+
+    ASSERT( queue.isEmpty());    
+}
+
+void DccStateKeeperTest::testExtendedFunctions() {
+    startTest();
+    
+    DccPacket TEST;
+
+    TEST.mfAddress7(0x12).functionF61_F68(0x0F);
+    DccState.saveState(&TEST);    
+
+    TEST.mfAddress7(0x12).functionF29_F36(0x81);
+    DccState.saveState(&TEST);    
+
+    //Overwrite the privious value
+    TEST.mfAddress7(0x12).functionF61_F68(0xF0);
+    DccState.saveState(&TEST);    
+
+    //Binary states are not refreshed
+    TEST.mfAddress7(0x12).binaryState(5, true);
+    DccState.saveState(&TEST);    
+
+    DccState.readNextState(queue, recycle);
+    recycle.push(queue.next());
+
+    DccPacket* p = queue.next();
+    recycle.push(p);
+    ASSERT( p->size() == 4);
+    ASSERT( p->repeat() == DCC_REPEAT_FUNCTION);
+    ASSERT( p->dcc_data[0] == 0x12);
+    ASSERT( p->dcc_data[1] == 0xD8);
+    ASSERT( p->dcc_data[2] == 0x81);                    //05
+    ASSERT( p->dcc_data[3] == (0x12 ^ 0xD8 ^ 0x81));
+
+    p = queue.next();
+    recycle.push(p);
+    ASSERT( p->size() == 4);
+    ASSERT( p->dcc_data[1] == 0xDC);
+    ASSERT( p->dcc_data[2] == 0xF0);
+    ASSERT( p->dcc_data[3] == (0x12 ^ 0xDC ^ 0xF0));    //10
+
     ASSERT( queue.isEmpty());    
 }
 
@@ -246,29 +312,776 @@ void DccStateKeeperTest::testGeneration() {
     ASSERT( p->dcc_data[2] == 0x3F);                   
     ASSERT( p->dcc_data[3] == 0x15);                            
     ASSERT( p->dcc_data[4] == (0x2A ^ address0 ^ address1));                    
+   
+    ASSERT( queue.isEmpty()); 
+}
+
+
+// Reads all states, returns speed of the last state found for the address or 0xFF
+// Refreshes read by readStateSpeed(..), the same on every board
+#define READ_COUNT (40)
+
+static byte readStateSpeed(byte address0, byte address1, byte& found) {
+    byte speed = 0xFF;
+    found = 0;
+    for (int i = 0; i < READ_COUNT; ++i) {
+        DccState.readNextState(queue, recycle);
+        DccPacket* p = queue.next();
+        if (p == NULL)
+            continue;
+        if (p->dcc_data[0] == address0 && (p->isAddressShort() || p->dcc_data[1] == address1)) {
+            speed = p->dcc_data[p->size() - 2];
+            found++;
+        }
+        recycle.push(p);
+        while(!queue.isEmpty()) 
+            recycle.push(queue.next());
+    }
+    return speed;
+}
+
+void DccStateKeeperTest::testIndex() {
+    startTest();
+    
+    //Short and long addresses share the index buckets, every state is read once per pass
+    DccPacket TEST;
+    for (int i = 1; i <= DCC_STATE_MAX_COUNT / 2; ++i) {
+        TEST.mfAddress7(i).speed128(false, i);
+        DccState.saveState(&TEST);    
+        TEST.mfAddress14(i).speed128(false, i);
+        DccState.saveState(&TEST);    
+    }
+    for (int i = 1; i <= DCC_STATE_MAX_COUNT / 2; ++i) {
+        TEST.mfAddress14(i).speed128(false, i + 0x20);
+        DccState.saveState(&TEST);    
+    }
+
+    byte found;
+    ASSERT( readStateSpeed(0x03, 0x00, found) == 0x03);
+    ASSERT( found == READ_COUNT / DCC_STATE_MAX_COUNT);
+    ASSERT( readStateSpeed(0xC0, 0x03, found) == 0x23);
+    ASSERT( found == READ_COUNT / DCC_STATE_MAX_COUNT);
+
+    //Replaced state is removed from the index, the others are still found
+    TEST.mfAddress7(0x50).speed128(false, 0x50);
+    DccState.saveState(&TEST);    
+    for (int i = 1; i <= DCC_STATE_MAX_COUNT / 2; ++i) {
+        TEST.mfAddress14(i).speed128(false, i + 0x40);
+        DccState.saveState(&TEST);    
+    }
+    ASSERT( readStateSpeed(0x50, 0x00, found) == 0x50);         //5
+    ASSERT( found == READ_COUNT / DCC_STATE_MAX_COUNT);
+    ASSERT( readStateSpeed(0x01, 0x00, found) == 0xFF);
+    ASSERT( found == 0);
+    ASSERT( readStateSpeed(0xC0, DCC_STATE_MAX_COUNT / 2, found) == DCC_STATE_MAX_COUNT / 2 + 0x40);
+    ASSERT( found == READ_COUNT / DCC_STATE_MAX_COUNT);                                        //10
+
+    //Index is rebuilt by begin()
+    DccState.flush();
+    DccState.begin();
+    TEST.mfAddress14(3).speed128(false, 0x60);
+    DccState.saveState(&TEST);    
+    ASSERT( readStateSpeed(0xC0, 0x03, found) == 0x60);
+    ASSERT( found == READ_COUNT / DCC_STATE_MAX_COUNT);
+    ASSERT( queue.isEmpty());
+}
+
+void DccStateKeeperTest::testLru() {
+    startTest();
+    
+    DccPacket TEST;
+    for (int i = 1; i <= DCC_STATE_MAX_COUNT; ++i) {
+        TEST.mfAddress7(i).speed128(false, i);
+        DccState.saveState(&TEST);    
+    }
+    //Used again, so address 2 is the least recently used
+    TEST.mfAddress7(1).speed128(false, 0x51);
+    DccState.saveState(&TEST);    
+
+    TEST.mfAddress7(0x60).speed128(false, 0x60);
+    DccState.saveState(&TEST);    
+
+    byte found;
+    ASSERT( readStateSpeed(0x01, 0x00, found) == 0x51);
+    ASSERT( readStateSpeed(0x02, 0x00, found) == 0xFF);
+    ASSERT( readStateSpeed(0x60, 0x00, found) == 0x60);
+
+    //Order is restored by begin()
+    DccState.flush();
+    DccState.begin();
+    TEST.mfAddress7(3).speed128(false, 0x53);
+    DccState.saveState(&TEST);    
+    TEST.mfAddress7(0x61).speed128(false, 0x61);
+    DccState.saveState(&TEST);    
+
+    ASSERT( readStateSpeed(0x03, 0x00, found) == 0x53);
+    ASSERT( readStateSpeed(0x04, 0x00, found) == 0xFF);         //5
+    ASSERT( readStateSpeed(0x61, 0x00, found) == 0x61);
+    ASSERT( readStateSpeed(0x01, 0x00, found) == 0x51);
+    ASSERT( queue.isEmpty());
+}
+
+void DccStateKeeperTest::testActivity() {
+    startTest();
+    
+    DccPacket TEST;
+    TEST.mfAddress7(1).speed128(true, 0x20);
+    DccState.saveState(&TEST);    
+    for (int i = 2; i <= 4; ++i) {
+        TEST.mfAddress7(i).speed128(true, 0);
+        DccState.saveState(&TEST);    
+    }
+
+    //Changed states are refreshed every pass for a while
+    byte found;
+    readStateSpeed(0x04, 0x00, found);
+    ASSERT( found >= DCC_STATE_ACTIVE_COUNT);
+
+    //Running locomotive is refreshed more often than stopped ones
+    ASSERT( readStateSpeed(0x01, 0x00, found) == 0xA0);
+    ASSERT( found > READ_COUNT / 2);
+    readStateSpeed(0x04, 0x00, found);
+    ASSERT( found > 0);
+    ASSERT( found < READ_COUNT / 4);
+
+    //Stop is refreshed often, then the rate decays
+    TEST.mfAddress7(1).speed128(true, 0);
+    DccState.saveState(&TEST);    
+    ASSERT( readStateSpeed(0x01, 0x00, found) == 0x80);         //5
+    ASSERT( found >= DCC_STATE_ACTIVE_COUNT);
+    readStateSpeed(0x01, 0x00, found);
+    ASSERT( found < READ_COUNT / 4);
+    ASSERT( queue.isEmpty());
+}
+
+void DccStateKeeperTest::testRestore() {
+    startTest();
+    
+    DccPacket TEST;
+    for (int i = 1; i <= 3; ++i) {
+        TEST.mfAddress7(i).speed128(true, 0);
+        DccState.saveState(&TEST);    
+    }
+    TEST.mfAddress7(1).functionF0_F4(0x10);
+    DccState.saveState(&TEST);    
+    DccState.flush();
+    DccState.begin();
+    ASSERT(!DccState.isRestoring());
 
+    //All the states back to back, the most recently used first
+    DccState.restore();
+    ASSERT( DccState.isRestoring());
+    DccState.readNextState(queue, recycle);
+    DccPacket* p = queue.next();
+    recycle.push(p);
+    ASSERT( p->dcc_data[0] == 0x01);
     p = queue.next();
     recycle.push(p);
-    ASSERT( p->size() == 4);                           
-    ASSERT( p->repeat() == DCC_REPEAT_SPEED);                   //10
-    ASSERT(!p->hasAcknowledge());
-    ASSERT( p->dcc_data[0] == address0);
-    ASSERT( p->dcc_data[1] == address1);                    
-    ASSERT( p->dcc_data[2] == 0x80);                   
-    ASSERT( p->dcc_data[3] == (0x80 ^ address0 ^ address1));    //15                  
-   
-    ASSERT( queue.isEmpty()); 
+    ASSERT( p->dcc_data[1] == 0x90);
+
+    DccState.readNextState(queue, recycle);
+    p = queue.next();
+    recycle.push(p);
+    ASSERT( p->dcc_data[0] == 0x03);                        //5
+
+    DccState.readNextState(queue, recycle);
+    p = queue.next();
+    recycle.push(p);
+    ASSERT( p->dcc_data[0] == 0x02);
+    ASSERT(!DccState.isRestoring());
+    ASSERT( queue.isEmpty());
 }
 
+void DccStateKeeperTest::testPoolDrained() {
+    startTest();
+
+    DccPacket TEST;
+    TEST.mfAddress7(1).speed128(true, 10);
+    DccState.saveState(&TEST);
+    TEST.mfAddress7(1).functionF0_F4(0x10);
+    DccState.saveState(&TEST);
+    TEST.mfAddress7(1).functionF5_F8(0x01);
+    DccState.saveState(&TEST);
+
+    //Two packets left, the state needs three
+    DccPacket* taken[4];
+    for (int i = 0; i < 4; ++i)
+        taken[i] = recycle.pop();
+    ASSERT( recycle.size() == 2);
+    DccState.readNextState(queue, recycle);
+    ASSERT( queue.isEmpty());
+    ASSERT( recycle.size() == 2);
+
+    //The same state is read, when packets are back
+    recycle.push(taken[0]);
+    DccState.readNextState(queue, recycle);
+    ASSERT( queue.size() == 3);
+    ASSERT( queue.getFirst()->dcc_data[0] == 0x01);         //5
+    ASSERT( recycle.size() == 0);
+
+    //Restore waits for the packets too
+    while(!queue.isEmpty())
+        recycle.push(queue.next());
+    DccState.restore();
+    taken[0] = recycle.pop();
+    DccState.readNextState(queue, recycle);
+    ASSERT( queue.isEmpty());
+    ASSERT( DccState.isRestoring());
+    recycle.push(taken[0]);
+    DccState.readNextState(queue, recycle);
+    ASSERT( queue.size() == 3);
+    ASSERT(!DccState.isRestoring());                        //10
+
+    while(!queue.isEmpty())
+        recycle.push(queue.next());
+    for (int i = 1; i < 4; ++i)
+        recycle.push(taken[i]);
+}
+
+// Delayed batches can't take the packets kept for the commands and the refresh
+void DccStateKeeperTest::testScheduleReserve() {
+    startTest();
+    DccCmd.resetQueue();
+
+    ASSERT( DccCmd.handleTextCommand("M3f10") == DccCommander::QUEUED);
+    int queued = 0;
+    for (int i = 0; i < DCC_QUEUE_MAX_COUNT; ++i)
+        if (DccCmd.handleTextCommand("D30000;M5f10") == DccCommander::QUEUED)
+            ++queued;
+    ASSERT( queued == DCC_QUEUE_MAX_COUNT - 1 - DCC_SCHEDULE_RESERVE_COUNT);
+    ASSERT( DccCmd.handleTextCommand("D30000;M5f10") == DccCommander::ERROR);
+
+    //Immediate commands go on
+    ASSERT( DccCmd.handleTextCommand("M3F10") == DccCommander::QUEUED);
+
+    //Refresh goes on, as the interrupt sends the packets
+    for (int i = 0; i < DCC_STATE_IDLE_RATIO; ++i) {
+        DccCmd.loop();
+        DccPacket* packet = DccCmd.nextPacketToSend(NULL);
+        while (!packet->isIdle())
+            packet = DccCmd.nextPacketToSend(packet);
+    }
+    //Sent packets are back in the pool, delayed ones are not
+    ASSERT( DccCmd.handleTextCommand("D30000;M5f10") == DccCommander::QUEUED);    //5
+    ASSERT( DccCmd.handleTextCommand("D30000;M5f10") == DccCommander::ERROR);
+
+    DccCmd.resetQueue();
+}
+
+void DccStateKeeperTest::testFlush() {
+    startTest();
+    DccState.flush();
+    ASSERT(!DccState.isDirty());
+
+    DccPacket TEST;
+    TEST.mfAddress7(0x12).speed28(true, 2);
+    DccState.saveState(&TEST);    
+    ASSERT( DccState.isDirty());
+
+    //Changes are written only after idle time
+    DccState.loop();
+    ASSERT( DccState.isDirty());
+
+    delay(DCC_STATE_FLUSH_IDLE_MS);
+    for (byte i = 0; i < 4 && DccState.isDirty(); ++i)
+        DccState.loop();
+    ASSERT(!DccState.isDirty());                        //5
+
+    //Not written state is lost on restart
+    TEST.mfAddress7(0x13).speed28(true, 3);
+    DccState.saveState(&TEST);    
+    DccState.begin();
+    ASSERT(!DccState.isDirty());
+
+    byte found;
+    ASSERT( readStateSpeed(0x12, 0x00, found) == 0x61);
+    ASSERT( readStateSpeed(0x13, 0x00, found) == 0xFF);     //10
+
+    //Power off writes immediately
+    TEST.mfAddress7(0x13).speed28(true, 3);
+    DccState.saveState(&TEST);    
+    DccState.flush();
+    ASSERT(!DccState.isDirty());
+    DccState.begin();
+
+    ASSERT( readStateSpeed(0x13, 0x00, found) == 0x71);
+
+    //Repeated command changes nothing to write
+    DccState.saveState(&TEST);    
+    ASSERT(!DccState.isDirty());
+    TEST.mfAddress7(0x13).speed28(true, 4);
+    DccState.saveState(&TEST);    
+    ASSERT( DccState.isDirty());
+    DccState.flush();
+    ASSERT( queue.isEmpty());                           //15
+
+    //Every changed state is one log write
+    unsigned long writes = DccState.writeCount();
+    for (int i = 1; i <= 4; ++i) {
+        TEST.mfAddress7(0x20 + i).speed28(true, 5);
+        DccState.saveState(&TEST);    
+    }
+    ASSERT( DccState.writeCount() == writes);
+    DccState.flush();
+    ASSERT( DccState.writeCount() == writes + 4);
+    DccState.flush();
+    ASSERT( DccState.writeCount() == writes + 4);
+}
+
+void DccStateKeeperTest::testLog() {
+    startTest();
+    
+    DccPacket TEST;
+    TEST.mfAddress7(0x12).speed28(true, 2);
+    DccState.saveState(&TEST);    
+    TEST.mfAddress7(0x13).speed28(true, 3);
+    DccState.saveState(&TEST);    
+    DccState.flush();
+
+    //Log wraps many times, the state not changed is kept
+    for (word i = 0; i < 200; ++i) {
+        TEST.mfAddress7(0x13).speed28(true, 3 - (i & 1));
+        DccState.saveState(&TEST);    
+        DccState.flush();
+    }
+    DccState.begin();
+
+    byte found;
+    ASSERT( readStateSpeed(0x12, 0x00, found) == 0x61);
+    ASSERT( found > 0);
+    ASSERT( readStateSpeed(0x13, 0x00, found) == 0x61);
+    ASSERT( found > 0);
+    ASSERT( queue.isEmpty());                           //5
+
+    //Reset is kept in the log too
+    DccState.resetAll();
+    DccState.flush();
+    DccState.begin();
+    DccState.readNextState(queue, recycle);
+    ASSERT( queue.isEmpty());
+
+    //Erased EEPROM has no valid entries
+    for (word i = 0; i < DCC_STATE_EEPROM_SIZE; ++i)
+        EEPROM.write(DCC_STATE_EEPROM_ADDR + i, 0xFF);
+    DccState.begin();
+    DccState.readNextState(queue, recycle);
+    ASSERT( queue.isEmpty());
+
+    //Function groups turned on are kept in the entry
+    TEST.mfAddress7(0x14).speed28(true, 3);
+    DccState.saveState(&TEST);    
+    TEST.mfAddress7(0x14).functionF61_F68(0x55);
+    DccState.saveState(&TEST);    
+    DccState.flush();
+    DccState.begin();
+    DccState.readNextState(queue, recycle);
+    DccPacket* p = queue.next();
+    recycle.push(p);
+    ASSERT( p->dcc_data[0] == 0x14);
+    ASSERT( p->dcc_data[1] == 0x71);
+    p = queue.next();
+    recycle.push(p);
+    ASSERT( p->dcc_data[1] == 0xDC);                    //10
+    ASSERT( p->dcc_data[2] == 0x55);
+    ASSERT( queue.isEmpty());
+}
+
+void DccStateKeeperTest::testStorage() {
+    //Log of 5 entries keeps 3 states
+    DccEepromStorage small(0, 5 * 20);
+    DccState.storage(&small);
+    DccState.begin();
+    startTest();
+
+    DccPacket TEST;
+    for (int i = 1; i <= 5; ++i) {
+        TEST.mfAddress7(i).speed128(false, i);
+        DccState.saveState(&TEST);    
+    }
+    DccState.flush();
+    DccState.begin();
+
+    byte found;
+    ASSERT( readStateSpeed(0x01, 0x00, found) == 0xFF);
+    ASSERT( readStateSpeed(0x02, 0x00, found) == 0xFF);
+    ASSERT( readStateSpeed(0x03, 0x00, found) == 0x03);
+    ASSERT( readStateSpeed(0x05, 0x00, found) == 0x05);
+
+    //Log wraps in the small storage too
+    for (int i = 0; i < 20; ++i) {
+        TEST.mfAddress7(4).speed128(false, i);
+        DccState.saveState(&TEST);    
+        DccState.flush();
+    }
+    DccState.begin();
+    ASSERT( readStateSpeed(0x03, 0x00, found) == 0x03);         //5
+    ASSERT( readStateSpeed(0x04, 0x00, found) == 19);
+    ASSERT( readStateSpeed(0x05, 0x00, found) == 0x05);
+
+    //Region beyond the end of the EEPROM is cut
+    DccEepromStorage tail(E2END + 1 - 100, 200);
+    ASSERT( tail.size() == 100);
+    DccEepromStorage beyond(E2END + 1, 200);
+    ASSERT( beyond.size() == 0);
+    DccEepromStorage internal(DCC_STATE_EEPROM_ADDR, DCC_STATE_EEPROM_SIZE);
+    ASSERT( internal.size() == E2END + 1 - DCC_STATE_EEPROM_ADDR);      //10
+
+    //Back to the internal EEPROM
+    DccState.storage(NULL);
+    DccState.begin();
+    ASSERT( queue.isEmpty());
+}
+
+// Log of 5 entries in RAM. The write after tear(count) writes is torn in the middle,
+// and the power is off for the writes after it, until powerOn().
+class TornStorage : public DccStorage {
+public:
+    byte    data[5 * 20];
+    int     writesLeft;
+    boolean off;
+
+    TornStorage() : writesLeft(-1), off(false) {
+        memset(data, 0xFF, sizeof(data));
+    }
+    void tear(int count) {
+        writesLeft = count;
+    }
+    void powerOn() {
+        writesLeft = -1;
+        off = false;
+    }
+    virtual unsigned long size() {
+        return sizeof(data);
+    }
+    virtual void read(unsigned long address, byte* buffer, byte count) {
+        memcpy(buffer, data + address, count);
+    }
+    virtual void write(unsigned long address, const byte* buffer, byte count) {
+        if (off)
+            return;
+        if (writesLeft == 0) {
+            memcpy(data + address, buffer, count / 2);
+            off = true;
+            return;
+        }
+        if (writesLeft > 0)
+            --writesLeft;
+        memcpy(data + address, buffer, count);
+    }
+};
+
+static void saveSpeed(byte address, byte speed) {
+    DccPacket TEST;
+    TEST.mfAddress7(address).speed128(false, speed);
+    DccState.saveState(&TEST);
+    DccState.flush();
+}
+
+void DccStateKeeperTest::testTornWrite() {
+    TornStorage torn;
+    DccState.storage(&torn);
+    DccState.begin();
+    startTest();
+
+    //States 1, 2, 3 at the entries 0, 1, 2, state 1 moves to 3, 4 and 0, the head is at the entry of state 2
+    saveSpeed(1, 1);
+    saveSpeed(2, 2);
+    saveSpeed(3, 3);
+    saveSpeed(1, 4);
+    saveSpeed(1, 5);
+    saveSpeed(1, 6);
+
+    //State 2 copied from the head is torn
+    torn.tear(0);
+    saveSpeed(1, 7);
+    torn.powerOn();
+    DccState.begin();
+
+    byte found;
+    ASSERT( readStateSpeed(0x01, 0x00, found) == 6);
+    ASSERT( readStateSpeed(0x02, 0x00, found) == 2);
+    ASSERT( readStateSpeed(0x03, 0x00, found) == 3);
+
+    //State 2 is copied, state 1 written at the head is torn
+    torn.tear(1);
+    saveSpeed(1, 8);
+    torn.powerOn();
+    DccState.begin();
+    ASSERT( readStateSpeed(0x01, 0x00, found) == 6);
+    ASSERT( readStateSpeed(0x02, 0x00, found) == 2);            //5
+    ASSERT( readStateSpeed(0x03, 0x00, found) == 3);
+
+    //Log keeps wrapping over the copied states
+    for (int i = 0; i < 20; ++i)
+        saveSpeed(1, 10 + i);
+    DccState.begin();
+    ASSERT( readStateSpeed(0x01, 0x00, found) == 29);
+    ASSERT( readStateSpeed(0x02, 0x00, found) == 2);
+    ASSERT( readStateSpeed(0x03, 0x00, found) == 3);
+
+    //State 2 is changed until the head is at the entry of state 1,
+    //then state 1 copies itself ahead, that write is torn
+    for (int i = 0; i < 5; ++i)
+        saveSpeed(2, 30 + i);
+    torn.tear(0);
+    saveSpeed(1, 40);
+    torn.powerOn();
+    DccState.begin();
+    ASSERT( readStateSpeed(0x01, 0x00, found) == 29);           //10
+    ASSERT( readStateSpeed(0x02, 0x00, found) == 34);
+
+    DccState.storage(NULL);
+    DccState.begin();
+    ASSERT( queue.isEmpty());
+}
+
+// Host stand-ins: the file, and the FRAM of extras/host/Wire.h
+#ifdef DCC_HOST
+
+#define TEST_FILE_STORAGE   "DccStateKeeperTest.bin"
+
+void DccStateKeeperTest::testFileStorage() {
+    remove(TEST_FILE_STORAGE);
+    {
+        DccFileStorage file(TEST_FILE_STORAGE, 10 * 20);
+        DccState.storage(&file);
+        DccState.begin();
+        startTest();
+        ASSERT( file.size() == 10 * 20);
+        saveSpeed(1, 11);
+        saveSpeed(2, 12);
+        saveSpeed(1, 13);
+        DccState.storage(NULL);
+    }
+
+    //States are read back from the file opened again
+    DccFileStorage file(TEST_FILE_STORAGE, 10 * 20);
+    DccState.storage(&file);
+    DccState.begin();
+    byte found;
+    ASSERT( readStateSpeed(0x01, 0x00, found) == 13);
+    ASSERT( readStateSpeed(0x02, 0x00, found) == 12);
+
+    //Log wraps in the file
+    for (int i = 0; i < 30; ++i)
+        saveSpeed(3, i);
+    DccState.begin();
+    ASSERT( readStateSpeed(0x01, 0x00, found) == 13);
+    ASSERT( readStateSpeed(0x03, 0x00, found) == 29);            //5
+
+    DccState.storage(NULL);
+    DccState.begin();
+    remove(TEST_FILE_STORAGE);
+    ASSERT( queue.isEmpty());
+}
+
+void DccStateKeeperTest::testFramStorage() {
+    Wire.begin();
+    DccFramStorage fram(0x1000);
+    DccState.storage(&fram);
+    DccState.begin();
+    startTest();
+
+    //Blocks longer than a Wire transmission are split, the last chunk has a single byte.
+    //The device is 64 KB, the blocks are beyond the log.
+    DccFramStorage device(0x10000);
+    ASSERT( device.size() == 0x10000);
+    byte data[2 * BUFFER_LENGTH];
+    byte back[2 * BUFFER_LENGTH];
+    for (byte i = 0; i < sizeof(data); ++i)
+        data[i] = i + 1;
+    device.write(0x8000, data, BUFFER_LENGTH - 2);
+    device.read (0x8000, back, BUFFER_LENGTH - 2);
+    ASSERT( memcmp(data, back, BUFFER_LENGTH - 2) == 0);
+    device.write(0x8100, data, BUFFER_LENGTH - 1);
+    device.read (0x8100, back, BUFFER_LENGTH - 1);
+    ASSERT( memcmp(data, back, BUFFER_LENGTH - 1) == 0);
+    device.write(0x8200, data, sizeof(data));
+    memset(back, 0, sizeof(back));
+    device.read (0x8200, back, sizeof(back));
+    ASSERT( memcmp(data, back, sizeof(data)) == 0);
+
+    //States are read back by another storage of the same device
+    ASSERT( fram.size() == 0x1000);                                 //5
+    saveSpeed(1, 21);
+    saveSpeed(2, 22);
+    saveSpeed(1, 23);
+
+    DccFramStorage again(0x1000);
+    DccState.storage(&again);
+    DccState.begin();
+    byte found;
+    ASSERT( readStateSpeed(0x01, 0x00, found) == 23);
+    ASSERT( readStateSpeed(0x02, 0x00, found) == 22);
+
+    DccState.storage(NULL);
+    DccState.begin();
+    ASSERT( queue.isEmpty());
+}
+
+#endif //DCC_HOST
+
+void DccStateKeeperTest::testSnapshot() {
+    startTest();
+    
+    DccPacket TEST;
+    TEST.mfAddress7(0x21).speed128(true, 5);
+    DccState.saveState(&TEST);    
+    TEST.mfAddress(0xC1, 0x22).speed128(false, 6);
+    DccState.saveState(&TEST);    
+    TEST.mfAddress(0xC1, 0x22).functionF13_F20(0x81);
+    DccState.saveState(&TEST);    
+
+    //Exported in the least recently used order
+    byte data[2][DCC_STATE_RECORD_MAX_SIZE];
+    DccStateSlot cursor = DccState.exportFirst();
+    byte size0 = DccState.exportState(cursor, data[0]);
+    byte size1 = DccState.exportState(cursor, data[1]);
+    ASSERT( size0 == 7);
+    ASSERT( size1 == 8);
+    ASSERT( data[0][0] == 0x21);
+    ASSERT( data[1][0] == 0xC1);                            //5
+    ASSERT( cursor == DCC_STATE_NONE);
+    ASSERT( DccState.exportState(cursor, data[0]) == 0);
+
+    //Import brings the same states back
+    DccState.resetAll();
+    ASSERT( DccState.exportFirst() == DCC_STATE_NONE);
+    ASSERT( DccState.importState(data[0], size0));
+    ASSERT( DccState.importState(data[1], size1));          //10
+    
+    byte found;
+    ASSERT( readStateSpeed(0x21, 0x00, found) == 0x85);
+    ASSERT( readStateSpeed(0xC1, 0x22, found) == 0x06);
+
+    //Broken records are refused
+    ASSERT(!DccState.importState(data[1], size1 - 1));
+    data[1][0] = 0x00;
+    ASSERT(!DccState.importState(data[1], size1));
+    ASSERT( queue.isEmpty());
+}
+
+// Appends the bytes in hex to the command
+static void appendHex(char* command, const byte* data, byte size) {
+    command += strlen(command);
+    for (byte i = 0; i < size; ++i) {
+        *command++ = "0123456789ABCDEF"[data[i] >> 4];
+        *command++ = "0123456789ABCDEF"[data[i] & 0xF];
+    }
+    *command = 0;
+}
+
+void DccStateKeeperTest::testSnapshotImport() {
+    startTest();
+    DccCmd.resetQueue();
+
+    //Record of 0x33 with its CRC-8, the same as the CRC of the whole import of one record
+    DccPacket TEST;
+    TEST.mfAddress7(0x33).speed128(true, 7);
+    DccState.saveState(&TEST);    
+    byte record[DCC_STATE_RECORD_MAX_SIZE + 1];
+    DccStateSlot cursor = DccState.exportFirst();
+    byte size = DccState.exportState(cursor, record);
+    byte crc = 0xFF;
+    for (byte i = 0; i < size; ++i)
+        crc = DccStateKeeper::crc8(crc, record[i]);
+    record[size] = crc;
+
+    char line[2 * DCC_STATE_RECORD_MAX_SIZE + 8] = "SR";
+    appendHex(line, record, size + 1);
+    byte end[3] = { 0x00, 0x01, crc };
+
+    DccState.resetAll();
+    TEST.mfAddress7(0x21).speed128(true, 5);
+    DccState.saveState(&TEST);    
+
+    //Failed import keeps the states
+    ASSERT( DccCmd.handleTextCommand(line) == DccCommander::ERROR);
+    ASSERT( DccCmd.handleTextCommand("SB") == DccCommander::ACKNOWLEDGE);
+    ASSERT( DccCmd.handleTextCommand(line) == DccCommander::ACKNOWLEDGE);
+    ASSERT( DccCmd.handleTextCommand("SC000100") == DccCommander::ERROR);
+    
+    byte found;
+    ASSERT( readStateSpeed(0x21, 0x00, found) == 0x85);                     //5
+    ASSERT( found > 0);
+    readStateSpeed(0x33, 0x00, found);
+    ASSERT( found == 0);
+    ASSERT(!DccState.isDirty());
+
+    //Matching import replaces the states
+    char last[16] = "SC";
+    appendHex(last, end, sizeof(end));
+    ASSERT( DccCmd.handleTextCommand("SB") == DccCommander::ACKNOWLEDGE);   //10
+    ASSERT( DccCmd.handleTextCommand(line) == DccCommander::ACKNOWLEDGE);
+    ASSERT( DccCmd.handleTextCommand(last) == DccCommander::ACKNOWLEDGE);
+    ASSERT( DccState.isDirty());
+
+    ASSERT( readStateSpeed(0x33, 0x00, found) == 0x87);
+    readStateSpeed(0x21, 0x00, found);
+    ASSERT( found == 0);                                                    //15
+    DccCmd.resetQueue();
+}
+
+void DccStateKeeperTest::testLocoFunction() {
+    startTest();
+
+    DccPacket TEST;
+    TEST.mfAddress((word) 0x2345).functionF0_F4(false, true, false, false, true);
+    DccState.saveState(&TEST);
+
+    DccPacket* p = DccState.locoFunction(&TEST.mfAddress((word) 0x2345), 0, DCC_STATE_FUNCTION_ON);
+    ASSERT( p == &TEST);
+    ASSERT( TEST.size() == 4);
+    ASSERT( TEST.dcc_data[0] == 0xE3);
+    ASSERT( TEST.dcc_data[1] == 0x45);
+    ASSERT( TEST.dcc_data[2] == 0x99);                                 //5
+
+    // The state is not changed by the packet, until it is sent
+    DccState.locoFunction(&TEST, 4, DCC_STATE_FUNCTION_OFF);
+    ASSERT( TEST.dcc_data[2] == 0x81);
+    DccState.locoFunction(&TEST, 1, DCC_STATE_FUNCTION_TOGGLE);
+    ASSERT( TEST.dcc_data[2] == 0x88);
+
+    DccState.locoFunction(&TEST, 10, DCC_STATE_FUNCTION_ON);
+    ASSERT( TEST.dcc_data[2] == 0xA2);
+
+    // Address without the state
+    p = DccState.locoFunction(&TEST.mfAddress((word) 0x12), 20, DCC_STATE_FUNCTION_TOGGLE);
+    ASSERT( TEST.size() == 4);
+    ASSERT( TEST.dcc_data[0] == 0x12);                                 //10
+    ASSERT( TEST.dcc_data[1] == 0xDE);
+    ASSERT( TEST.dcc_data[2] == 0x80);
+}
 
 boolean DccStateKeeperTest::testAll() {
     UnitTest::suite("DccStateKeeper");
+    DccState.begin();
   
     testSpeed();
+    testSpeed14();
     testFunctions();
+    testExtendedFunctions();
     testGeneration();
+    testIndex();
+    testLru();
+    testActivity();
+    testRestore();
+    testPoolDrained();
+    testScheduleReserve();
+    testFlush();
+    testLog();
+    testStorage();
+    testTornWrite();
+#ifdef DCC_HOST
+    testFileStorage();
+    testFramStorage();
+#endif
+    testSnapshot();
+    testSnapshotImport();
+    testLocoFunction();
     
     DccState.resetAll();
+    DccState.flush();
     
     return UnitTest::report();
 }
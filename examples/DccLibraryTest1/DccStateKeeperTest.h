@@ -18,8 +18,25 @@ private:
 
 public:  
     static void testSpeed();
+    static void testSpeed14();
     static void testFunctions();
+    static void testExtendedFunctions();
     static void testGeneration();
+    static void testIndex();
+    static void testLru();
+    static void testActivity();
+    static void testRestore();
+    static void testPoolDrained();
+    static void testScheduleReserve();
+    static void testFlush();
+    static void testLog();
+    static void testStorage();
+    static void testTornWrite();
+    static void testFileStorage();
+    static void testFramStorage();
+    static void testSnapshot();
+    static void testSnapshotImport();
+    static void testLocoFunction();
 
     static boolean testAll();
 };
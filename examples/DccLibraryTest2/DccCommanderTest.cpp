@@ -0,0 +1,301 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+ 
+#include <Arduino.h>
+#include <DccConfig.h>
+#include <DccProtocol.h>
+#include <DccCommander.h>
+#include <DccStateKeeper.h>
+#include <UnitTest.h>
+
+#include "DccCommanderTest.h"
+
+// Field of the statistics (I) line, e.g. " P=" for the free packets
+static unsigned long statistic(const char* field) {
+    const char* s = strstr(DccCmd.handleTextCommand("I"), field);
+    return s == NULL ? 0xFFFFFFFFUL : strtoul(s + strlen(field), NULL, 10);
+}
+
+// Keeps the reply lines of the pipeline
+class ReplyBuffer : public Print {
+public:
+    char  text[256];
+    word  length;
+
+    ReplyBuffer() { clear(); }
+    void clear() {
+        length = 0;
+        text[0] = 0;
+    }
+    virtual size_t write(uint8_t c) {
+        if (length >= sizeof(text) - 1)
+            return 0;
+        text[length++] = c;
+        text[length] = 0;
+        return 1;
+    }
+};
+
+// Sends the queue out, as the interrupt does, returns the count of the packets (not repeats)
+static byte sendQueue() {
+    byte count = 0;
+    DccPacket* packet = DccCmd.nextPacketToSend(NULL);
+    while (!packet->isIdle()) {
+        DccPacket* next = DccCmd.nextPacketToSend(packet);
+        if (next != packet)
+            ++count;
+        packet = next;
+    }
+    return count;
+}
+
+void DccCommanderTest::testPower() {
+    UnitTest::start();
+
+    //Power is reported as it is set
+    DccCmd.power(true);
+    ASSERT( DccRails.power());
+    ASSERT( DccCmd.power());
+    DccCmd.power(false);
+    ASSERT(!DccRails.power());
+    ASSERT(!DccCmd.power());                                        //5
+    DccCmd.power(true);
+    ASSERT( DccCmd.power());
+}
+
+void DccCommanderTest::testPowerRestore() {
+    UnitTest::start();
+    DccCmd.resetAll();
+    ASSERT( DccCmd.handleTextCommand("m3f10;m4f10") == DccCommander::QUEUED);
+    sendQueue();
+
+    //Power on restores the states
+    ASSERT( DccCmd.handleTextCommand("P0") == DccCommander::ACKNOWLEDGE);
+    ASSERT( DccCmd.handleTextCommand("P1") == DccCommander::ACKNOWLEDGE);
+    ASSERT( DccState.isRestoring());
+    for (byte i = 0; i < DCC_STATE_MAX_COUNT && DccState.isRestoring(); ++i) {
+        DccCmd.loop();
+        sendQueue();
+    }
+    ASSERT(!DccState.isRestoring());                                //5
+
+    //Second P1 queues nothing
+    ASSERT( DccCmd.handleTextCommand("P1") == DccCommander::ACKNOWLEDGE);
+    ASSERT(!DccState.isRestoring());
+    ASSERT( statistic(" Q=") == 0);
+
+    //Restore in progress is not restarted, the second state is the last one
+    DccCmd.power(false);
+    DccCmd.power(true);
+    DccCmd.loop();
+    sendQueue();
+    ASSERT( DccState.isRestoring());
+    DccCmd.power(true);
+    DccCmd.loop();
+    sendQueue();
+    ASSERT(!DccState.isRestoring());                                //10
+    DccCmd.resetAll();
+}
+
+void DccCommanderTest::testReturnBack() {
+    UnitTest::start();
+    DccCmd.resetQueue();
+
+    //Power off without a packet on the rails returns nothing
+    DccCmd.returnBack(NULL);
+    DccCmd.power(false);
+    DccCmd.power(true);
+    DccPacket* packet = DccCmd.nextPacketToSend(NULL);
+    ASSERT( packet->isIdle());
+
+    //Unprocessed packet is sent first
+    DccPacket* unprocessed = DccCmd.newPacket();
+    unprocessed->mfAddress7(3).speed28(true, 10);
+    DccCmd.returnBack(unprocessed);
+    DccCmd.returnBack(packet);
+    packet = DccCmd.nextPacketToSend(NULL);
+    ASSERT( packet == unprocessed);
+    while (!packet->isIdle())
+        packet = DccCmd.nextPacketToSend(packet);
+    ASSERT( DccCmd.nextPacketToSend(NULL)->isIdle());
+}
+
+void DccCommanderTest::testTrafficStall() {
+    UnitTest::start();
+    DccCmd.resetAll();
+
+    //Windows without traffic
+    for (byte w = 0; w <= DCC_TRAFFIC_WINDOW_COUNT; ++w) {
+        delay(DCC_TRAFFIC_WINDOW_MS);
+        DccCmd.loop();
+    }
+    ASSERT( DccCmd.trafficPercent(DCC_TRAFFIC_IDLE) == 0);
+
+    //Idle bits over a word count, while loop() is late
+    for (int i = 0; i < 1600; ++i)
+        DccCmd.nextPacketToSend(NULL);
+    ASSERT( DccCmd.handleTextCommand("m3f10") == DccCommander::QUEUED);
+    DccPacket* packet = DccCmd.nextPacketToSend(NULL);
+    while (!packet->isIdle())
+        packet = DccCmd.nextPacketToSend(packet);
+    delay(10 * DCC_TRAFFIC_WINDOW_MS);
+    DccCmd.loop();
+
+    ASSERT( DccCmd.trafficPercent(DCC_TRAFFIC_IDLE) == 100);
+    ASSERT( DccCmd.trafficPercent(DCC_TRAFFIC_COMMAND) == 0);
+    DccCmd.resetAll();
+}
+
+void DccCommanderTest::testBatch() {
+    UnitTest::start();
+    DccCmd.resetAll();
+    sendQueue();
+    unsigned long free = statistic(" P=");
+
+    //Every packet of the batch is queued
+    ASSERT( DccCmd.handleTextCommand("M3f10;M3A10000") == DccCommander::QUEUED);
+    ASSERT( statistic(" Q=") == 2);
+    ASSERT( statistic(" P=") == free - 2);
+    ASSERT( sendQueue() == 2);
+    ASSERT( statistic(" P=") == free);                              //5
+
+    //Syntax error in the second command returns the first packet
+    ASSERT( DccCmd.handleTextCommand("M3f10;M3X") == DccCommander::UNKNOWN);
+    ASSERT( statistic(" Q=") == 0);
+    ASSERT( statistic(" P=") == free);
+
+    //Pool runs out in the middle of the batch
+    DccPacket* taken[DCC_QUEUE_MAX_COUNT];
+    byte count = 0;
+    while (statistic(" P=") > 1)
+        taken[count++] = DccCmd.newPacket();
+    ASSERT( DccCmd.handleTextCommand("M3f10;M3f11") == DccCommander::ERROR);
+    ASSERT( statistic(" Q=") == 0);                                 //10
+    ASSERT( statistic(" P=") == 1);
+
+    //Packets taken go back through the rails
+    while (count)
+        DccCmd.send(taken[--count]->mfAddress7(3).speed28(true, 10));
+    sendQueue();
+    ASSERT( statistic(" P=") == free);
+    DccCmd.resetAll();
+}
+
+void DccCommanderTest::testPipeline() {
+    UnitTest::start();
+    DccCmd.resetAll();
+    sendQueue();
+    ReplyBuffer reply;
+
+    //One status line per command
+    ASSERT( DccCmd.handleTextPipeline("M3f10/T0/X", '/', reply) == 3);
+    ASSERT( strcmp(reply.text, "Q\r\nA\r\nU\r\n") == 0);
+    sendQueue();
+
+    //Empty commands are skipped
+    reply.clear();
+    ASSERT( DccCmd.handleTextPipeline("//", '/', reply) == 0);
+    ASSERT( reply.length == 0);
+    ASSERT( DccCmd.handleTextPipeline("/T0//T0/", '/', reply) == 2);      //5
+    ASSERT( strcmp(reply.text, "A\r\nA\r\n") == 0);
+
+    //Command longer than the line fails, the next one is handled
+    char commands[DCC_LINE_MAX_SIZE + 8];
+    memset(commands, 'M', DCC_LINE_MAX_SIZE + 1);
+    strcpy(commands + DCC_LINE_MAX_SIZE + 1, "/T0");
+    unsigned long errors = statistic(" E=");
+    reply.clear();
+    ASSERT( DccCmd.handleTextPipeline(commands, '/', reply) == 2);
+    ASSERT( strcmp(reply.text, "E\r\nA\r\n") == 0);
+    ASSERT( statistic(" E=") == errors + 1);
+
+    //Command of the line size is handled
+    commands[DCC_LINE_MAX_SIZE] = 0;
+    reply.clear();
+    ASSERT( DccCmd.handleTextPipeline(commands, '/', reply) == 1);       //10
+    ASSERT( strcmp(reply.text, "U\r\n") == 0);
+
+    //Results of U and I are printed as they are
+    reply.clear();
+    ASSERT( DccCmd.handleTextPipeline("U;I", ';', reply) == 2);
+    char expected[2 * DCC_REPLY_LINE_SIZE + 4];
+    strcpy(expected, DccCmd.handleTextCommand("U"));
+    strcat(expected, "\r\n");
+    strcat(expected, DccCmd.handleTextCommand("I"));
+    strcat(expected, "\r\n");
+    ASSERT( strcmp(reply.text, expected) == 0);
+    ASSERT( strncmp(reply.text, "idle=", 5) == 0);
+    DccCmd.resetAll();
+}
+
+void DccCommanderTest::testStatistics() {
+    UnitTest::start();
+    DccCmd.resetAll();
+    sendQueue();
+    const char* line = DccCmd.handleTextCommand("I");
+    ASSERT( strncmp(line, "S=", 2) == 0);
+    ASSERT( strstr(line, " R=") && strstr(line, " I=") && strstr(line, " Q=") && strstr(line, " P="));
+    ASSERT( strstr(line, " X=") && strstr(line, " W=") && strstr(line, " E=") && strstr(line, " L=") && strstr(line, " T="));
+
+    //Every packet on the rails is counted: the command, its repeats and the idle after them
+    unsigned long sent    = statistic("S=");
+    unsigned long repeats = statistic(" R=");
+    unsigned long idles   = statistic(" I=");
+    ASSERT( DccCmd.handleTextCommand("M3f10") == DccCommander::QUEUED);
+    unsigned long calls = 1;
+    word repeated = 0;
+    DccPacket* packet = DccCmd.nextPacketToSend(NULL);
+    while (!packet->isIdle()) {
+        DccPacket* next = DccCmd.nextPacketToSend(packet);
+        if (next == packet)
+            ++repeated;
+        packet = next;
+        ++calls;
+    }
+    ASSERT( repeated > 0);                                          //5
+    ASSERT( statistic("S=") == sent + calls);
+    ASSERT( statistic(" R=") == repeats + repeated);
+    ASSERT( statistic(" I=") == idles + 1);
+
+    //Pool exhausted
+    unsigned long exhausted = statistic(" X=");
+    DccPacket* taken[DCC_QUEUE_MAX_COUNT];
+    byte count = 0;
+    while ((packet = DccCmd.newPacket()) != NULL)
+        taken[count++] = packet;
+    ASSERT( statistic(" P=") == 0);
+    ASSERT( statistic(" X=") == exhausted + 1);                     //10
+    while (count)
+        DccCmd.send(taken[--count]->mfAddress7(3).speed28(true, 10));
+    sendQueue();
+
+    //Failed commands
+    unsigned long errors = statistic(" E=");
+    ASSERT( DccCmd.handleTextCommand("M3X") == DccCommander::UNKNOWN);
+    ASSERT( DccCmd.handleTextCommand("D70000;M3f10") == DccCommander::ERROR);
+    ASSERT( statistic(" E=") == errors + 2);
+    ASSERT( strlen(DccCmd.handleTextCommand("I")) < DCC_REPLY_LINE_SIZE);
+    DccCmd.resetAll();
+}
+
+boolean DccCommanderTest::testAll() {
+    UnitTest::suite("DccCommander");
+  
+    testPower();
+    testPowerRestore();
+    testReturnBack();
+    testTrafficStall();
+    testBatch();
+    testPipeline();
+    testStatistics();
+    
+    return UnitTest::report();
+}
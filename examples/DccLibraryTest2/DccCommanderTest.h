@@ -0,0 +1,30 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+ 
+#ifndef __DCC_COMMANDER_TEST_H__
+#define __DCC_COMMANDER_TEST_H__
+
+class DccCommanderTest  {
+
+public:  
+    static void testPower();
+    static void testPowerRestore();
+    static void testReturnBack();
+    static void testTrafficStall();
+    static void testBatch();
+    static void testPipeline();
+    static void testStatistics();
+    
+    static boolean testAll();
+};
+
+
+#endif //__DCC_COMMANDER_TEST_H__
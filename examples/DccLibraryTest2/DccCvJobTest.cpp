@@ -0,0 +1,129 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+ 
+#include <Arduino.h>
+#include <DccConfig.h>
+#include <DccPacket.h>
+#include <DccCollection.h>
+#include <DccCvJob.h>
+#include <UnitTest.h>
+
+#include "DccCvJobTest.h"
+
+void DccCvJobTest::testAdd() {
+    UnitTest::start();
+
+    DccCvJob  test;
+    DccPacket packet;
+
+    ASSERT(!test.isPending());
+    
+    test.start(0x03, 0);
+    ASSERT( test.add(packet.mfAddress7(3).cvWrite(1, 3)));
+    ASSERT( test.add(packet.mfAddress14(3000).cvBitWrite(29, 5, true)));
+    ASSERT(!test.add(packet.mfAddress7(3).speed28(true, 10)));
+    ASSERT( test.isPending());                                  //5
+    ASSERT( test.pendingCount() == 2);
+
+    for (byte i = 2; i < DCC_CV_JOB_MAX_COUNT; ++i)
+        test.add(packet.mfAddress7(3).cvWrite(i, i));
+    ASSERT( test.pendingCount() == DCC_CV_JOB_MAX_COUNT);
+    ASSERT(!test.add(packet.mfAddress7(3).cvWrite(1, 3)));
+
+    test.cancel();
+    ASSERT(!test.isPending());                                  //10
+}
+
+void DccCvJobTest::testParse() {
+    UnitTest::start();
+
+    DccCvJob  test;
+
+    const char* s = "M3000W1D3W29D34X29B5D1";
+    ASSERT( test.parse(s) == DCC_PARSE_OK);
+    ASSERT( test.pendingCount() == 3);
+    ASSERT( *s == '\0');
+
+    s = "m3W1D3;";
+    ASSERT( test.parse(s) == DCC_PARSE_OK);
+    ASSERT( test.pendingCount() == 1);                          //5
+    ASSERT( *s == ';');
+
+    s = "m3W1D3f10";
+    ASSERT( test.parse(s) == DCC_PARSE_UNKNOWN_COMMAND);
+    ASSERT(!test.isPending());
+
+    s = "m3";
+    ASSERT( test.parse(s) == DCC_PARSE_MISSING_ARGUMENT);
+    s = "E3S1";
+    ASSERT( test.parse(s) == DCC_PARSE_UNKNOWN_ADDRESS);        //10
+    s = "m3W1D300";
+    ASSERT( test.parse(s) == DCC_PARSE_OUT_OF_RANGE);
+
+    char text[8 + DCC_CV_JOB_MAX_COUNT * 5];
+    char* t = text;
+    *t++ = 'm';
+    *t++ = '3';
+    for (byte i = 0; i <= DCC_CV_JOB_MAX_COUNT; ++i) {
+        *t++ = 'W';
+        *t++ = '1';
+        *t++ = 'D';
+        *t++ = '0';
+    }
+    *t = '\0';
+    s = text;
+    ASSERT( test.parse(s) == DCC_PARSE_OUT_OF_RANGE);
+    ASSERT(!test.isPending());
+}
+
+void DccCvJobTest::testNextPacket() {
+    UnitTest::start();
+
+    DccPacket testHeap[2];
+    DccStack  heap(testHeap, 2);
+    DccCvJob  test;
+    DccPacket expected;
+
+    const char* s = "M3000W1D3X29B5D1V8D145";
+    ASSERT( test.parse(s) == DCC_PARSE_OK);
+
+    DccPacket* p1 = test.nextPacket(heap);
+    ASSERT( p1 != NULL);
+    ASSERT( p1->size() == 6);
+    ASSERT( p1->repeat() == DCC_REPEAT_CV);
+    ASSERT( memcmp(p1->dcc_data, expected.mfAddress14(3000).cvWrite(1, 3)->dcc_data, 6) == 0);  //5
+
+    DccPacket* p2 = test.nextPacket(heap);
+    ASSERT( p2 != NULL);
+    ASSERT( memcmp(p2->dcc_data, expected.mfAddress14(3000).cvBitWrite(29, 5, true)->dcc_data, 6) == 0);
+
+    // Heap is empty, instruction is kept
+    ASSERT( test.nextPacket(heap) == NULL);
+    ASSERT( test.pendingCount() == 1);
+
+    heap.push(p1);
+    p1 = test.nextPacket(heap);
+    ASSERT( memcmp(p1->dcc_data, expected.mfAddress14(3000).cvVerify(8, 145)->dcc_data, 6) == 0);  //10
+    ASSERT(!test.isPending());
+
+    heap.push(p1);
+    ASSERT( test.nextPacket(heap) == NULL);
+}
+
+boolean DccCvJobTest::testAll() {
+    UnitTest::suite("DccCvJob");
+  
+    testAdd();
+    testParse();
+    testNextPacket();
+    
+    return UnitTest::report();
+}
@@ -0,0 +1,26 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+ 
+#ifndef __DCC_CV_JOB_TEST_H__
+#define __DCC_CV_JOB_TEST_H__
+
+class DccCvJobTest  {
+
+public:  
+    static void testAdd();
+    static void testParse();
+    static void testNextPacket();
+    
+    static boolean testAll();
+};
+
+
+#endif //__DCC_CV_JOB_TEST_H__
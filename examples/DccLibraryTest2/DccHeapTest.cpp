@@ -0,0 +1,126 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+ 
+#include <Arduino.h>
+#include <DccCollection.h>
+#include <UnitTest.h>
+
+#include "DccHeapTest.h"
+
+void DccHeapTest::testAdd() {
+    UnitTest::start();
+
+    DccPacket* items[3];
+    DccHeap   test(items, 3);
+    DccPacket pack1;
+    DccPacket pack2;
+    DccPacket pack3;
+    ASSERT(test.isEmpty());
+    ASSERT(test.getFirst() == NULL);
+    
+    ASSERT(test.add(&pack1, 200));
+    ASSERT(test.getFirst() == &pack1);
+    ASSERT(pack1.deadline  == 200);
+    
+    ASSERT(test.add(&pack2, 300));                  //5
+    ASSERT(test.getFirst() == &pack1);
+    
+    ASSERT(test.add(&pack3, 100));
+    ASSERT(test.getFirst() == &pack3);
+    ASSERT(test.size()     == 3);
+}
+
+void DccHeapTest::testNext() {
+    UnitTest::start();
+
+    DccPacket* items[5];
+    DccHeap   test(items, 5);
+    DccPacket pack[5];
+    word      deadline[5] = {40, 10, 50, 30, 20};
+    
+    for (byte i = 0; i < 5; ++i)
+        test.add(&pack[i], deadline[i]);
+
+    ASSERT(test.next()  == &pack[1]);
+    ASSERT(test.next()  == &pack[4]);
+    ASSERT(test.next()  == &pack[3]);
+    ASSERT(test.next()  == &pack[0]);
+    ASSERT(test.next()  == &pack[2]);               //5
+    ASSERT(test.next()  == NULL);
+    ASSERT(test.isEmpty());
+}
+
+void DccHeapTest::testFull() {
+    UnitTest::start();
+
+    DccPacket* items[2];
+    DccHeap   test(items, 2);
+    DccPacket pack1;
+    DccPacket pack2;
+    DccPacket pack3;
+    
+    ASSERT( test.add(&pack1, 10));
+    ASSERT( test.add(&pack2, 20));
+    ASSERT( test.isFull());
+    ASSERT(!test.add(&pack3, 5));
+    ASSERT( test.getFirst() == &pack1);             //5
+
+    test.next();
+    ASSERT( test.add(&pack3, 5));
+    ASSERT( test.getFirst() == &pack3);
+}
+
+void DccHeapTest::testDue() {
+    UnitTest::start();
+
+    DccPacket* items[2];
+    DccHeap   test(items, 2);
+    DccPacket pack1;
+    ASSERT(!test.isDue(0));
+    
+    test.add(&pack1, 100);
+    ASSERT(!test.isDue(99));
+    ASSERT( test.isDue(100));
+    ASSERT( test.isDue(101));
+}
+
+void DccHeapTest::testWrap() {
+    UnitTest::start();
+
+    DccPacket* items[3];
+    DccHeap   test(items, 3);
+    DccPacket pack1;
+    DccPacket pack2;
+    DccPacket pack3;
+    
+    //Deadlines after millis wrap come later
+    test.add(&pack1, 0x0010);
+    test.add(&pack2, 0xFFF0);
+    test.add(&pack3, 0x8000);
+
+    ASSERT( test.next() == &pack3);
+    ASSERT( test.next() == &pack2);
+    ASSERT(!test.isDue(0xFFFF));
+    ASSERT( test.isDue(0x0010));
+    ASSERT( test.next() == &pack1);                 //5
+}
+
+boolean DccHeapTest::testAll() {
+    UnitTest::suite("DccHeap");
+  
+    testAdd();
+    testNext();
+    testFull();
+    testDue();
+    testWrap();
+    
+    return UnitTest::report();
+}
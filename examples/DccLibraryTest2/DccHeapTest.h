@@ -0,0 +1,28 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+ 
+#ifndef __DCC_HEAP_TEST_H__
+#define __DCC_HEAP_TEST_H__
+
+class DccHeapTest  {
+
+public:  
+    static void testAdd();
+    static void testNext();
+    static void testFull();
+    static void testDue();
+    static void testWrap();
+    
+    static boolean testAll();
+};
+
+
+#endif //__DCC_HEAP_TEST_H__
@@ -19,9 +19,20 @@
 #include <DccStandard.h>
 #include <DccPacket.h>
 #include <DccCollection.h>
+#include <DccCvJob.h>
+#include <DccScheduler.h>
+#include <DccLineReader.h>
+#include <DccCommander.h>
+#include <DccPlusPlus.h>
 
 #include "DccStackTest.h"
 #include "DccQueueTest.h"
+#include "DccHeapTest.h"
+#include "DccCvJobTest.h"
+#include "DccSchedulerTest.h"
+#include "DccLineReaderTest.h"
+#include "DccPlusPlusTest.h"
+#include "DccCommanderTest.h"
 
 #define LED (13)
 
@@ -35,6 +46,12 @@ void setup() {
 
    success = (DccStackTest::testAll() && success);
    success = (DccQueueTest::testAll() && success);
+   success = (DccHeapTest::testAll() && success);
+   success = (DccCvJobTest::testAll() && success);
+   success = (DccSchedulerTest::testAll() && success);
+   success = (DccLineReaderTest::testAll() && success);
+   success = (DccPlusPlusTest::testAll() && success);
+   success = (DccCommanderTest::testAll() && success);
 
    pinMode(LED, OUTPUT);
 }
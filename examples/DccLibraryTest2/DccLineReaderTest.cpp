@@ -0,0 +1,158 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+ 
+#include <Arduino.h>
+#include <DccLineReader.h>
+#include <UnitTest.h>
+
+#include "DccLineReaderTest.h"
+
+// Stream of the given text
+class TextStream : public Stream {
+public:
+    const char* text;
+
+    TextStream() : text("") {}
+    virtual int available()     { return strlen(text); }
+    virtual int read()          { return *text ? *text++ : -1; }
+    virtual int peek()          { return *text ? *text : -1; }
+    virtual void flush()        {}
+    virtual size_t write(uint8_t) { return 1; }
+};
+
+static char line[DCC_LINE_MAX_SIZE + 1];
+
+void DccLineReaderTest::testLine() {
+    UnitTest::start();
+
+    TextStream    stream;
+    DccLineReader test(stream);
+    ASSERT(!test.hasLine());
+    ASSERT(!test.readLine(line));
+
+    stream.text = "M3f10\r\n";
+    test.loop();
+    ASSERT( test.hasLine());
+    ASSERT( test.readLine(line));
+    ASSERT( strcmp(line, "M3f10") == 0);            //5
+    ASSERT(!test.hasLine());
+}
+
+void DccLineReaderTest::testManyLines() {
+    UnitTest::start();
+
+    TextStream    stream;
+    DccLineReader test(stream);
+
+    //Empty lines are skipped
+    stream.text = "P1\n\nM3f10\r\n\r\nB12P0O1A\n";
+    test.loop();
+    ASSERT( test.readLine(line));
+    ASSERT( strcmp(line, "P1") == 0);
+    ASSERT( test.readLine(line));
+    ASSERT( strcmp(line, "M3f10") == 0);
+    ASSERT( test.readLine(line));                   //5
+    ASSERT( strcmp(line, "B12P0O1A") == 0);
+    ASSERT(!test.readLine(line));
+}
+
+void DccLineReaderTest::testPartialLine() {
+    UnitTest::start();
+
+    TextStream    stream;
+    DccLineReader test(stream);
+
+    stream.text = "M3";
+    test.loop();
+    ASSERT(!test.hasLine());
+
+    stream.text = "f10\nP";
+    test.loop();
+    ASSERT( test.readLine(line));
+    ASSERT( strcmp(line, "M3f10") == 0);
+    ASSERT(!test.hasLine());
+
+    stream.text = "0\n";
+    test.loop();
+    ASSERT( test.readLine(line));                   //5
+    ASSERT( strcmp(line, "P0") == 0);
+}
+
+void DccLineReaderTest::testLongLine() {
+    UnitTest::start();
+
+    TextStream    stream;
+    DccLineReader test(stream);
+    char long_line[DCC_LINE_MAX_SIZE + 3];
+    memset(long_line, 'H', DCC_LINE_MAX_SIZE + 1);
+    long_line[DCC_LINE_MAX_SIZE + 1] = '\n';
+    long_line[DCC_LINE_MAX_SIZE + 2] = '\0';
+
+    //The whole long line is dropped, the next one is kept
+    stream.text = long_line;
+    test.loop();
+    stream.text = "P1\n";
+    test.loop();
+    ASSERT( test.droppedCount() == 1);
+    ASSERT( test.readLine(line));
+    ASSERT( strcmp(line, "P1") == 0);
+    ASSERT(!test.hasLine());
+
+    //Line of the max size fits
+    long_line[DCC_LINE_MAX_SIZE] = '\n';
+    long_line[DCC_LINE_MAX_SIZE + 1] = '\0';
+    stream.text = long_line;
+    test.loop();
+    ASSERT( test.readLine(line));                   //5
+    ASSERT( strlen(line) == DCC_LINE_MAX_SIZE);
+}
+
+void DccLineReaderTest::testFullRing() {
+    UnitTest::start();
+
+    TextStream    stream;
+    DccLineReader test(stream);
+    
+    //Lines not fitting into the ring are dropped
+    byte count = 0;
+    for (; count < DCC_LINE_BUFFER_SIZE; ++count) {
+        stream.text = "M1234f10\n";
+        test.loop();
+        if (test.droppedCount() > 0)
+            break;
+    }
+    ASSERT( count == DCC_LINE_BUFFER_SIZE / 9);
+    ASSERT( test.droppedCount() == 1);
+
+    //Ring is reused, when lines are read
+    for (byte i = 0; i < count; ++i)
+        test.readLine(line);
+    ASSERT(!test.hasLine());
+    for (byte i = 0; i < count; ++i) {
+        stream.text = "M1234f10\n";
+        test.loop();
+    }
+    ASSERT( test.droppedCount() == 1);
+    ASSERT( test.readLine(line));                   //5
+    ASSERT( strcmp(line, "M1234f10") == 0);
+}
+
+boolean DccLineReaderTest::testAll() {
+    UnitTest::suite("DccLineReader");
+  
+    testLine();
+    testManyLines();
+    testPartialLine();
+    testLongLine();
+    testFullRing();
+    
+    return UnitTest::report();
+}
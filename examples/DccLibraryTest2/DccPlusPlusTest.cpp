@@ -0,0 +1,223 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+ 
+#include <Arduino.h>
+#include <DccCommander.h>
+#include <DccStateKeeper.h>
+#include <DccPlusPlus.h>
+#include <UnitTest.h>
+
+#include "DccPlusPlusTest.h"
+
+// Stream of the given commands, that keeps the replies
+class ReplyStream : public Stream {
+public:
+    const char* text;
+    char  reply[128];
+    byte  length;
+
+    ReplyStream() : text(""), length(0) { reply[0] = 0; }
+    virtual int available()     { return strlen(text); }
+    virtual int read()          { return *text ? *text++ : -1; }
+    virtual int peek()          { return *text ? *text : -1; }
+    virtual void flush()        {}
+    virtual size_t write(uint8_t c) {
+        if (length >= sizeof(reply) - 1)
+            return 0;
+        reply[length++] = c;
+        reply[length] = 0;
+        return 1;
+    }
+
+    // Handles the commands and returns the replies. Queue is sent out, as the interrupt does
+    // with the power on, so the packets return to the pool.
+    const char* handle(DccPlusPlus& test, const char* commands) {
+        length = 0;
+        reply[0] = 0;
+        text = commands;
+        test.loop();
+        DccCmd.loop();
+        if (DccCmd.power()) {
+            DccPacket* packet = DccCmd.nextPacketToSend(NULL);
+            while (!packet->isIdle())
+                packet = DccCmd.nextPacketToSend(packet);
+        }
+        return reply;
+    }
+};
+
+static boolean locoState(word address, byte& speed, unsigned long& functions) {
+    DccPacket packet;
+    if (address <= DCC_ADDRESS_SHORT_MAX)
+        packet.mfAddress7(address);
+    else
+        packet.mfAddress14(address);
+    boolean speed128;
+    return DccState.locoState(&packet, speed, speed128, functions);
+}
+
+void DccPlusPlusTest::testParser() {
+    UnitTest::start();
+
+    ReplyStream stream;
+    DccPlusPlus test(stream);
+
+    //Text outside of the command is ignored
+    ASSERT( strcmp(stream.handle(test, "hello\r\n"), "") == 0);
+    ASSERT( strcmp(stream.handle(test, "<s>"), "<p1>" DCC_PLUS_REPLY_INFO) == 0);
+    ASSERT( strcmp(stream.handle(test, "\n< s >\n"), "<p1>" DCC_PLUS_REPLY_INFO) == 0);
+
+    //Command split over several reads
+    ASSERT( strcmp(stream.handle(test, "<t 1 3"), "") == 0);
+    ASSERT( strcmp(stream.handle(test, " 20 1>"), "<T 1 20 1>") == 0);     //5
+
+    //Parameter right after the opcode, many commands
+    ASSERT( strcmp(stream.handle(test, "<t1 3 0 1><t2 3 -1 0>"), "<T 1 0 1><T 2 0 0>") == 0);
+
+    //New command drops the unfinished one
+    ASSERT( strcmp(stream.handle(test, "<t 1 3 <s>"), "<p1>" DCC_PLUS_REPLY_INFO) == 0);
+
+    //Invalid commands
+    ASSERT( strcmp(stream.handle(test, "<>"), DCC_PLUS_REPLY_FAILED) == 0);
+    ASSERT( strcmp(stream.handle(test, "<q>"), DCC_PLUS_REPLY_FAILED) == 0);
+    ASSERT( strcmp(stream.handle(test, "<t 1 3 x 1>"), DCC_PLUS_REPLY_FAILED) == 0);     //10
+    ASSERT( strcmp(stream.handle(test, "<t 1 3 2- 1>"), DCC_PLUS_REPLY_FAILED) == 0);
+    ASSERT( strcmp(stream.handle(test, "<t 1 3 - 1>"), DCC_PLUS_REPLY_FAILED) == 0);
+    ASSERT( strcmp(stream.handle(test, "<t 1 99999 2 1>"), DCC_PLUS_REPLY_FAILED) == 0);
+    ASSERT( strcmp(stream.handle(test, "<b 1 2 3 4 5 6>"), DCC_PLUS_REPLY_FAILED) == 0);
+    ASSERT( strcmp(stream.handle(test, "<s 1>"), DCC_PLUS_REPLY_FAILED) == 0);     //15
+}
+
+void DccPlusPlusTest::testThrottle() {
+    UnitTest::start();
+
+    ReplyStream   stream;
+    DccPlusPlus   test(stream);
+    byte          speed;
+    unsigned long functions;
+
+    ASSERT( strcmp(stream.handle(test, "<t 1 5 20 1>"), "<T 1 20 1>") == 0);
+    ASSERT( locoState(5, speed, functions));
+    ASSERT( speed == (DCC_MF_SPEED_128_FORWARD | 21));
+
+    //DCC-EX form replies the state
+    ASSERT( strcmp(stream.handle(test, "<t 5 126 0>"), "<l 5 0 127 0>") == 0);
+    ASSERT( locoState(5, speed, functions));     //5
+    ASSERT( speed == (DCC_MF_SPEED_128_REVERSE | DCC_MF_SPEED_128_MAX));
+
+    //Emergency stop
+    ASSERT( strcmp(stream.handle(test, "<t 5 -1 1>"), "<l 5 0 129 0>") == 0);
+    ASSERT( strcmp(stream.handle(test, "<t 5 0 1>"), "<l 5 0 128 0>") == 0);
+
+    //Long address
+    ASSERT( strcmp(stream.handle(test, "<t 2 1000 1 1>"), "<T 2 1 1>") == 0);
+    ASSERT( locoState(1000, speed, functions));     //10
+    ASSERT( speed == (DCC_MF_SPEED_128_FORWARD | 2));
+
+    //28 steps set by the text command are scaled to 128 steps
+    ASSERT( strcmp(DccCmd.handleTextCommand("m6f31"), DccCommander::QUEUED) == 0);
+    DccCmd.loop();
+    ASSERT( strcmp(stream.handle(test, "<F 6 0 0>"), "<l 6 0 255 0>") == 0);
+
+    //Invalid address, speed and direction
+    ASSERT( strcmp(stream.handle(test, "<t 0 10 1>"), DCC_PLUS_REPLY_FAILED) == 0);
+    ASSERT( strcmp(stream.handle(test, "<t 10240 10 1>"), DCC_PLUS_REPLY_FAILED) == 0);     //15
+    ASSERT( strcmp(stream.handle(test, "<t 5 127 1>"), DCC_PLUS_REPLY_FAILED) == 0);
+    ASSERT( strcmp(stream.handle(test, "<t 5 -2 1>"), DCC_PLUS_REPLY_FAILED) == 0);
+    ASSERT( strcmp(stream.handle(test, "<t 5 10 2>"), DCC_PLUS_REPLY_FAILED) == 0);
+    ASSERT( strcmp(stream.handle(test, "<t 5 10>"), DCC_PLUS_REPLY_FAILED) == 0);
+}
+
+void DccPlusPlusTest::testFunction() {
+    UnitTest::start();
+
+    ReplyStream   stream;
+    DccPlusPlus   test(stream);
+    byte          speed;
+    unsigned long functions;
+
+    //F0 and F1
+    ASSERT( strcmp(stream.handle(test, "<t 7 0 1><f 7 145>"), "<l 7 0 128 0>") == 0);
+    ASSERT( locoState(7, speed, functions));
+    ASSERT( functions == 0x00000003UL);
+
+    //F5, F9, F13 and F28
+    ASSERT( strcmp(stream.handle(test, "<f 7 177><f 7 161><f 7 222 1><f 7 223 128>"), "") == 0);
+    ASSERT( locoState(7, speed, functions));     //5
+    ASSERT( functions == 0x10002223UL);
+
+    //Single function keeps the rest of its group
+    ASSERT( strcmp(stream.handle(test, "<F 7 4 1>"), "<l 7 0 128 268444211>") == 0);
+    ASSERT( strcmp(stream.handle(test, "<F 7 0 0>"), "<l 7 0 128 268444210>") == 0);
+    ASSERT( strcmp(stream.handle(test, "<F 7 28 0>"), "<l 7 0 128 8754>") == 0);
+    ASSERT( locoState(7, speed, functions));     //10
+    ASSERT( functions == 0x00002232UL);
+
+    //Invalid instruction, group and function
+    ASSERT( strcmp(stream.handle(test, "<f 7 96>"), DCC_PLUS_REPLY_FAILED) == 0);
+    ASSERT( strcmp(stream.handle(test, "<f 7 221 1>"), DCC_PLUS_REPLY_FAILED) == 0);
+    ASSERT( strcmp(stream.handle(test, "<f 7 222 256>"), DCC_PLUS_REPLY_FAILED) == 0);
+    ASSERT( strcmp(stream.handle(test, "<F 7 29 1>"), DCC_PLUS_REPLY_FAILED) == 0);     //15
+    ASSERT( strcmp(stream.handle(test, "<F 7 1 2>"), DCC_PLUS_REPLY_FAILED) == 0);
+}
+
+void DccPlusPlusTest::testAccessory() {
+    UnitTest::start();
+
+    ReplyStream stream;
+    DccPlusPlus test(stream);
+
+    ASSERT( strcmp(stream.handle(test, "<a 1 0 1>"), "") == 0);
+    ASSERT( strcmp(stream.handle(test, "<a 511 3 0>"), "") == 0);
+    ASSERT( strcmp(stream.handle(test, "<a 2044 1>"), "") == 0);
+    ASSERT( strcmp(stream.handle(test, "<a 512 0 1>"), DCC_PLUS_REPLY_FAILED) == 0);
+    ASSERT( strcmp(stream.handle(test, "<a 1 4 1>"), DCC_PLUS_REPLY_FAILED) == 0);     //5
+    ASSERT( strcmp(stream.handle(test, "<a 0 1>"), DCC_PLUS_REPLY_FAILED) == 0);
+
+    //Main track CV write
+    ASSERT( strcmp(stream.handle(test, "<w 3 1 10>"), "") == 0);
+    ASSERT( strcmp(stream.handle(test, "<b 3 29 5 1>"), "") == 0);
+    ASSERT( strcmp(stream.handle(test, "<w 3 1025 10>"), DCC_PLUS_REPLY_FAILED) == 0);
+    ASSERT( strcmp(stream.handle(test, "<w 3 1 256>"), DCC_PLUS_REPLY_FAILED) == 0);     //10
+    ASSERT( strcmp(stream.handle(test, "<b 3 29 8 1>"), DCC_PLUS_REPLY_FAILED) == 0);
+}
+
+void DccPlusPlusTest::testPower() {
+    UnitTest::start();
+
+    ReplyStream stream;
+    DccPlusPlus test(stream);
+
+    ASSERT( strcmp(stream.handle(test, "<1>"), "<p1>") == 0);
+    ASSERT( DccCmd.power());
+    ASSERT( strcmp(stream.handle(test, "<s>"), "<p1>" DCC_PLUS_REPLY_INFO) == 0);
+    ASSERT( strcmp(stream.handle(test, "<!>"), "") == 0);
+    ASSERT( DccCmd.power());     //5
+    ASSERT( strcmp(stream.handle(test, "<0>"), "<p0>") == 0);
+    ASSERT(!DccCmd.power());
+
+    //Packets wait in the queue while the power is off
+    ASSERT( strcmp(stream.handle(test, "<1>"), "<p1>") == 0);
+}
+
+boolean DccPlusPlusTest::testAll() {
+    UnitTest::suite("DccPlusPlus");
+
+    DccCmd.begin();
+
+    testPower();
+    testParser();
+    testThrottle();
+    testFunction();
+    testAccessory();
+
+    return UnitTest::report();
+}
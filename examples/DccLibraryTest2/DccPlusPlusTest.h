@@ -0,0 +1,28 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+ 
+#ifndef __DCC_PLUS_PLUS_TEST_H__
+#define __DCC_PLUS_PLUS_TEST_H__
+
+class DccPlusPlusTest  {
+
+public:  
+    static void testParser();
+    static void testThrottle();
+    static void testFunction();
+    static void testAccessory();
+    static void testPower();
+    
+    static boolean testAll();
+};
+
+
+#endif //__DCC_PLUS_PLUS_TEST_H__
@@ -16,6 +16,13 @@
 
 #include "DccQueueTest.h"
 
+// XOR of all the bytes with the error byte is zero
+static boolean isErrorByteValid(DccPacket& packet) {
+    byte error = 0;
+    for (byte i = 0; i < packet.size(); ++i)
+        error ^= packet.dcc_data[i];
+    return error == 0;
+}
 
 void DccQueueTest::testConstructor() {
     UnitTest::start();
@@ -135,6 +142,30 @@ void DccQueueTest::testSize() {
     ASSERT(test.size() == 0);
 }
 
+void DccQueueTest::testHighWater() {
+    UnitTest::start();
+    
+    DccQueue  test;
+    DccPacket pack1;
+    DccPacket pack2;
+    ASSERT(test.highWater() == 0);
+    
+    test.add(&pack1);    
+    test.push(&pack2);    
+    ASSERT(test.highWater() == 2);
+    
+    test.next();    
+    ASSERT(test.size() == 1);
+    ASSERT(test.highWater() == 2);
+    
+    test.resetHighWater();    
+    ASSERT(test.highWater() == 1);                  //5
+
+    test.next();    
+    test.add(&pack1);    
+    ASSERT(test.highWater() == 1);
+}
+
 void DccQueueTest::testIsEmpty() {
     UnitTest::start();
     
@@ -228,6 +259,8 @@ void DccQueueTest::testReplaceSpeedKindPacket() {
     ASSERT(pack2.dcc_data[1] == 0x23);
     ASSERT(pack2.dcc_data[2] == DCC_MF_KIND8_SPEED_128);
     ASSERT(pack2.dcc_data[3] == 0x8E);                              
+    ASSERT(isErrorByteValid(pack1));
+    ASSERT(isErrorByteValid(pack2));                                 //45
 }
 
 void DccQueueTest::testReplaceFunctionKindPacket() {
@@ -421,6 +454,47 @@ void DccQueueTest::testReplaceAccessoryKindPacket() {
     
 }    
 
+void DccQueueTest::testReplaceBinaryStateKindPacket() {
+    UnitTest::start();
+    
+    DccQueue  test;
+    DccPacket pack1;
+    DccPacket pack2;
+    DccPacket pack3;
+    pack1.mfAddress7(0x23).binaryState(5, false);
+    pack2.mfAddress7(0x23).binaryState(300, false);
+    pack3.mfAddress7(0x23).functionF29_F36(0x01);
+    test.add(&pack1);
+    test.add(&pack2);
+    test.add(&pack3);
+
+    DccPacket packR;
+    packR.mfAddress7(0x23).binaryState(6, true);
+    ASSERT(!test.replaceSameKindPacket(&packR, true));
+    packR.mfAddress7(0x23).binaryState(5, true);
+    ASSERT( test.replaceSameKindPacket(&packR, true));
+    packR.mfAddress7(0x23).binaryState(172, true);
+    ASSERT(!test.replaceSameKindPacket(&packR, true));
+    packR.mfAddress7(0x23).binaryState(300, true);
+    ASSERT( test.replaceSameKindPacket(&packR, false));
+    packR.mfAddress7(0x23).functionF37_F44(0x02);
+    ASSERT(!test.replaceSameKindPacket(&packR, true));             //5
+    packR.mfAddress7(0x23).functionF29_F36(0x02);
+    ASSERT( test.replaceSameKindPacket(&packR, true));
+
+    ASSERT(test.size() == 3);
+    ASSERT(pack1.repeat() == 0);
+    ASSERT(pack1.dcc_data[2] == (DCC_MF_BINARY_STATE_ON | 5));
+    ASSERT(pack2.repeat() == DCC_REPEAT_FUNCTION);                  //10
+    ASSERT(pack2.dcc_data[2] == (DCC_MF_BINARY_STATE_ON | (300 & DCC_MF_BINARY_STATE_MASK)));
+    ASSERT(pack2.dcc_data[3] == (300 >> 7));
+    ASSERT(pack3.repeat() == 0);
+    ASSERT(pack3.dcc_data[2] == 0x02);
+    ASSERT(isErrorByteValid(pack1));                                //15
+    ASSERT(isErrorByteValid(pack2));
+    ASSERT(isErrorByteValid(pack3));
+}
+
 boolean DccQueueTest::testAll() {
     UnitTest::suite("DccQueue");
   
@@ -429,11 +503,13 @@ boolean DccQueueTest::testAll() {
     testPush();
     testNext();
     testSize();
+    testHighWater();
     testIsEmpty();
     
     testReplaceSpeedKindPacket();
     testReplaceFunctionKindPacket();
     testReplaceAccessoryKindPacket();
+    testReplaceBinaryStateKindPacket();
     
     return UnitTest::report();
 }
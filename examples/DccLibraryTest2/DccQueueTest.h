@@ -20,11 +20,13 @@ public:
     static void testPush();
     static void testNext();
     static void testSize();
+    static void testHighWater();
     static void testIsEmpty();
     
     static void testReplaceSpeedKindPacket();
     static void testReplaceFunctionKindPacket();
     static void testReplaceAccessoryKindPacket();
+    static void testReplaceBinaryStateKindPacket();
     
     static boolean testAll();
 };
@@ -0,0 +1,96 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+ 
+#include <Arduino.h>
+#include <DccScheduler.h>
+#include <UnitTest.h>
+
+#include "DccSchedulerTest.h"
+
+static byte runA;
+static byte runB;
+
+void DccSchedulerTest::taskA() {
+    ++runA;
+}
+
+void DccSchedulerTest::taskB() {
+    ++runB;
+}
+
+void DccSchedulerTest::testAdd() {
+    UnitTest::start();
+
+    DccScheduler test;
+    ASSERT( test.size() == 0);
+    ASSERT(!test.add(NULL, 0));
+
+    for (byte i = 0; i < DCC_SCHEDULER_TASK_COUNT; ++i)
+        ASSERT( test.add(taskA, 0));
+    ASSERT(!test.add(taskA, 0));
+    ASSERT( test.size() == DCC_SCHEDULER_TASK_COUNT);
+}
+
+void DccSchedulerTest::testEveryLoop() {
+    UnitTest::start();
+
+    DccScheduler test;
+    test.add(taskA, 0);
+    test.add(taskB, 0);
+    runA = runB = 0;
+
+    test.loop();
+    ASSERT(runA == 1);
+    ASSERT(runB == 1);
+    test.loop();
+    ASSERT(runA == 2);
+    ASSERT(runB == 2);
+}
+
+void DccSchedulerTest::testPeriod() {
+    UnitTest::start();
+
+    DccScheduler test;
+    test.add(taskA, 0);
+    test.add(taskB, 100);
+    runA = runB = 0;
+
+    //Periodic task runs first time right away
+    test.loop();
+    test.loop();
+    ASSERT(runA == 2);
+    ASSERT(runB == 1);
+
+    delay(100);
+    test.loop();
+    test.loop();
+    ASSERT(runB == 2);
+
+    //Missed periods run only once
+    delay(350);
+    test.loop();
+    test.loop();
+    ASSERT(runB == 3);
+
+    delay(100);
+    test.loop();
+    ASSERT(runB == 4);                  //5
+}
+
+boolean DccSchedulerTest::testAll() {
+    UnitTest::suite("DccScheduler");
+  
+    testAdd();
+    testEveryLoop();
+    testPeriod();
+    
+    return UnitTest::report();
+}
@@ -0,0 +1,29 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+ 
+#ifndef __DCC_SCHEDULER_TEST_H__
+#define __DCC_SCHEDULER_TEST_H__
+
+class DccSchedulerTest  {
+private:
+    static void taskA();
+    static void taskB();
+
+public:  
+    static void testAdd();
+    static void testEveryLoop();
+    static void testPeriod();
+    
+    static boolean testAll();
+};
+
+
+#endif //__DCC_SCHEDULER_TEST_H__
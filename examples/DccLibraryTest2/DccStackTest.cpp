@@ -135,6 +135,33 @@ void DccStackTest::testIsEmpty() {
     ASSERT(test.isEmpty());
 }
 
+void DccStackTest::testLowWater() {
+    UnitTest::start();
+    
+    DccPacket pack[3];
+    DccStack  test(pack, 3);
+    ASSERT(test.lowWater() == 3);
+    
+    test.pop();    
+    test.pop();    
+    ASSERT(test.lowWater() == 1);
+    
+    test.push(&pack[0]);    
+    ASSERT(test.lowWater() == 1);
+    ASSERT(test.exhaustedCount() == 0);
+    
+    test.pop();    
+    test.pop();    
+    test.pop();    
+    ASSERT(test.lowWater() == 0);                   //5
+    ASSERT(test.exhaustedCount() == 1);
+
+    test.push(&pack[0]);    
+    test.resetLowWater();    
+    ASSERT(test.lowWater() == 1);
+    ASSERT(test.exhaustedCount() == 0);
+}
+
     
 boolean DccStackTest::testAll() {
     UnitTest::suite("DccStack");
@@ -144,6 +171,7 @@ boolean DccStackTest::testAll() {
     testPop();
     testSize();
     testIsEmpty();
+    testLowWater();
     
     return UnitTest::report();
 }
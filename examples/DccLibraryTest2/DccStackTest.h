@@ -20,6 +20,7 @@ public:
     static void testPop();
     static void testSize();
     static void testIsEmpty();
+    static void testLowWater();
     
     static boolean testAll();
 };
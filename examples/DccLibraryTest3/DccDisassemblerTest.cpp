@@ -0,0 +1,159 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+ 
+#include <Arduino.h>
+#include <DccConfig.h>
+#include <DccPacket.h>
+#include <DccDisassembler.h>
+#include <UnitTest.h>
+
+#include "DccDisassemblerTest.h"
+
+void DccDisassemblerTest::testKind() {
+    UnitTest::start();
+
+    DccPacket TEST;
+
+    ASSERT( TEST.idle()->kind() == DCC_KIND_IDLE);
+    ASSERT( TEST.mfAddress7(3).speed28(true, 10)->kind() == DCC_KIND_SPEED_28);
+    ASSERT( TEST.mfAddress14(3000).speed128(false, 10)->kind() == DCC_KIND_SPEED_128);
+    ASSERT( TEST.mfBroadcast().functionF0_F4(0x1F)->kind() == DCC_KIND_F0_F4);
+    ASSERT( TEST.mfAddress14(3000).functionF5_F8(0x0F)->kind() == DCC_KIND_F5_F8);          //5
+    ASSERT( TEST.mfAddress7(3).functionF9_F12(0x0F)->kind() == DCC_KIND_F9_F12);
+    ASSERT( TEST.mfAddress7(3).functionF13_F20(0xFF)->kind() == DCC_KIND_F13_F20);
+    ASSERT( TEST.mfAddress14(3000).functionF21_F28(0xFF)->kind() == DCC_KIND_F21_F28);
+    ASSERT( TEST.mfAddress7(3).mfCommand1(DCC_MF_DECODER_SOFT_RESET)->kind() == DCC_KIND_DECODER_RESET);
+    ASSERT( TEST.mfAddress7(3).mfCommand1(DCC_MF_DECODER_HARD_RESET)->kind() == DCC_KIND_DECODER_HARD_RESET); //10
+    ASSERT( TEST.mfAddress7(3).mfCommand1(DCC_MF_DECODER_SET_FLAGS)->kind() == DCC_KIND_DECODER_CONTROL);
+    ASSERT( TEST.mfAddress7(3).mfCommand2(DCC_MF_KIND4_CONSIST_CONTROL | DCC_MF_CONSIST_SET_ADDRESS_NORMAL, 5)->kind() == DCC_KIND_CONSIST_CONTROL);
+    ASSERT( TEST.mfAddress7(3).mfCommand2(DCC_MF_KIND4_CV_SHORT_ACCESS | DCC_MF_CV_SHORT_ACCELERATION, 5)->kind() == DCC_KIND_CV_SHORT);
+    ASSERT( TEST.baAddress(291, 3, 1).activate(true)->kind() == DCC_KIND_BA_OUTPUT);
+    ASSERT( TEST.eaAddress(1929).state(7)->kind() == DCC_KIND_EA_STATE);                    //15
+    ASSERT( TEST.mfAddress7(3).mfCommand2(DCC_MF_KIND8_SPEED_LIMIT, 5)->kind() == DCC_KIND_UNKNOWN);
+}
+
+void DccDisassemblerTest::testDecodeMultiFunction() {
+    UnitTest::start();
+
+    DccPacket     TEST;
+    DccPacketInfo info;
+
+    DccDisassembler::decode(TEST.mfAddress7(3).speed28(false, 21), info);
+    ASSERT( info.kind == DCC_KIND_SPEED_28);
+    ASSERT( info.addressKind == DCC_ADDRESS_KIND_SHORT);
+    ASSERT( info.address == 3);
+    ASSERT(!info.on);
+    ASSERT( info.value == 21);                                              //5
+
+    DccDisassembler::decode(TEST.mfAddress14(10239).speed128(true, 127), info);
+    ASSERT( info.kind == DCC_KIND_SPEED_128);
+    ASSERT( info.addressKind == DCC_ADDRESS_KIND_LONG);
+    ASSERT( info.address == 10239);
+    ASSERT( info.on);
+    ASSERT( info.value == 127);                                             //10
+
+    DccDisassembler::decode(TEST.mfBroadcast().functionF0_F4(true, false, false, true, true), info);
+    ASSERT( info.kind == DCC_KIND_F0_F4);
+    ASSERT( info.addressKind == DCC_ADDRESS_KIND_BROADCAST);
+    ASSERT( info.value == 0x19);
+
+    DccDisassembler::decode(TEST.mfAddress7(3).functionF21_F28(0xA5), info);
+    ASSERT( info.kind == DCC_KIND_F21_F28);                                 //15
+    ASSERT( info.value == 0xA5);
+
+    TEST.mfAddress14(300).mfCommand2(DCC_MF_KIND4_CV_LONG_ACCESS | DCC_CV_WRITE | 0x03, 0xFF);
+    TEST.dcc_info = DCC_INFO_SIZE_6;
+    TEST.dcc_data[4] = 0x55;
+    DccDisassembler::decode(&TEST, info);
+    ASSERT( info.kind == DCC_KIND_CV_LONG);
+    ASSERT( info.cvOperation == DCC_CV_WRITE);
+    ASSERT( info.cv == 1024);
+    ASSERT( info.value == 0x55);                                            //20
+}
+
+void DccDisassemblerTest::testDecodeAccessory() {
+    UnitTest::start();
+
+    DccPacket     TEST;
+    DccPacketInfo info;
+
+    DccDisassembler::decode(TEST.baAddress(291, 3, 1).activate(true), info);
+    ASSERT( info.kind == DCC_KIND_BA_OUTPUT);
+    ASSERT( info.addressKind == DCC_ADDRESS_KIND_BASIC_ACCESSORY);
+    ASSERT( info.address == 291);
+    ASSERT( info.port == 3);
+    ASSERT( info.output == 1);                                              //5
+    ASSERT( info.on);
+
+    DccDisassembler::decode(TEST.baBroadcast(2, 0).activate(false), info);
+    ASSERT( info.address == DCC_BA_ADDRESS_BROADCAST);
+    ASSERT( info.port == 2);
+    ASSERT( info.output == 0);
+    ASSERT(!info.on);                                                       //10
+
+    DccDisassembler::decode(TEST.eaAddress(1929).state(31), info);
+    ASSERT( info.kind == DCC_KIND_EA_STATE);
+    ASSERT( info.addressKind == DCC_ADDRESS_KIND_EXTENDED_ACCESSORY);
+    ASSERT( info.address == 1929);
+    ASSERT( info.value == 31);
+
+    DccDisassembler::decode(TEST.eaBroadcast().state(0), info);
+    ASSERT( info.address == DCC_EA_ADDRESS_BROADCAST);                      //15
+}
+
+// Printed text has to be parsed back into the same packet
+void DccDisassemblerTest::testFormat() {
+    UnitTest::start();
+
+    const char* commands[] = {
+        "m3f21", "M10239R127", "m0A10011", "M3000B1010", "m127C0110", 
+        "m5D10000001", "M5E01111110", "B291P3O1A", "B511P2O0D", "E1929S31",
+        "m3G10000001", "M3000K00001111", "m0S0V0", "m3S127V1", "M3000S32767V1",
+        "m3W1D3", "M3000V1024D255", "m3X29B5D1", "m3Y29B0D0",
+    };
+
+    DccPacket TEST;
+    DccPacket PARSED;
+    char      buffer[24];
+    boolean   same = true;
+    for (byte i = 0; i < sizeof(commands)/sizeof(commands[0]); ++i) {
+        TEST.parseDccTextCommand(commands[i]);
+        DccDisassembler::format(&TEST, buffer, sizeof(buffer));
+        same = same && (strcmp(buffer, commands[i]) == 0);
+    }
+    ASSERT( same);
+
+    TEST.idle();
+    ASSERT( DccDisassembler::format(&TEST, buffer, sizeof(buffer)) == 7);
+    ASSERT( strcmp(buffer, "H00FF00") == 0);
+
+    PARSED.parseDccHexCommand(buffer + 1);
+    ASSERT( memcmp(PARSED.dcc_data, TEST.dcc_data, TEST.size()) == 0);       //5
+    
+    ASSERT( DccDisassembler::format(&TEST, buffer, 4) == 3);
+    ASSERT( strcmp(buffer, "H00") == 0);
+
+    // Long form of the short form state has no text command 
+    TEST.mfBroadcast().binaryStateLong(0, false);
+    DccDisassembler::format(&TEST, buffer, sizeof(buffer));
+    ASSERT( strcmp(buffer, "H8300C00000") == 0);
+}
+
+boolean DccDisassemblerTest::testAll() {
+    UnitTest::suite("DccDisassembler");
+  
+    testKind();
+    testDecodeMultiFunction();
+    testDecodeAccessory();
+    testFormat();
+    
+    return UnitTest::report();
+}
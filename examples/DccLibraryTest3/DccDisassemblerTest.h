@@ -0,0 +1,27 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+ 
+#ifndef __DCC_DISASSEMBLER_TEST_H__
+#define __DCC_DISASSEMBLER_TEST_H__
+
+class DccDisassemblerTest  {
+
+public:  
+    static void testKind();
+    static void testDecodeMultiFunction();
+    static void testDecodeAccessory();
+    static void testFormat();
+    
+    static boolean testAll();
+};
+
+
+#endif //__DCC_DISASSEMBLER_TEST_H__
@@ -17,8 +17,10 @@
 #include <DccPacket.h>
 #include <DccCollection.h>
 #include <DccStateKeeper.h>
+#include <DccDisassembler.h>
 
 #include "DccPacketTest.h"
+#include "DccDisassemblerTest.h"
 
 
 #define LED (13)
@@ -32,6 +34,7 @@ void setup() {
    delay(500);
 
    success = (DccPacketTest::testAll() && success);
+   success = (DccDisassemblerTest::testAll() && success);
 
    pinMode(LED, OUTPUT);
 }
@@ -519,6 +519,23 @@ void DccPacketTest::testMultiFunctionBuilds() {
     ASSERT( TEST.dcc_data[2] == 0xDF);                //130
     ASSERT( TEST.dcc_data[3] == 0x55);
     ASSERT( TEST.dcc_data[4] == 0x4A);        
+
+    // Short form up to 127, long form above
+    TEST.mfAddress((word) 0x7F).functionF0_F4(0x10);
+    ASSERT( TEST.size() == 3);
+    ASSERT( TEST.dcc_data[0] == 0x7F);
+    ASSERT( TEST.dcc_data[1] == 0x90);                //135
+
+    TEST.mfAddress((word) 0x80).functionF0_F4(0x10);
+    ASSERT( TEST.size() == 4);
+    ASSERT( TEST.dcc_data[0] == 0xC0);
+    ASSERT( TEST.dcc_data[1] == 0x80);
+    ASSERT( TEST.dcc_data[2] == 0x90);
+
+    TEST.mfAddress((word) 0x2345).functionF0_F4(0x10);
+    ASSERT( TEST.size() == 4);                        //140
+    ASSERT( TEST.dcc_data[0] == 0xE3);
+    ASSERT( TEST.dcc_data[1] == 0x45);
     
 }
 
@@ -674,6 +691,180 @@ void DccPacketTest::testMultiFunctionParsing() {
     ASSERT( TEST.dcc_data[4] == 0x4A);                //115
 }
 
+void DccPacketTest::testExtendedFunctions() {
+    UnitTest::start();
+
+    DccPacket TEST;
+
+    DccPacket* p = TEST.mfAddress7(3).functionF29_F36(0x81);
+    ASSERT( p == &TEST);
+    ASSERT( TEST.size() == 4);
+    ASSERT( TEST.repeat() == DCC_REPEAT_FUNCTION);
+    ASSERT(!TEST.hasAcknowledge());
+    ASSERT( TEST.dcc_data[0] == 0x03);                //5
+    ASSERT( TEST.dcc_data[1] == 0xD8);
+    ASSERT( TEST.dcc_data[2] == 0x81);
+    ASSERT( TEST.dcc_data[3] == 0x5A);
+    ASSERT( TEST.kind() == DCC_KIND_F29_F36);
+
+    ASSERT( TEST.mfAddress7(3).functionF37_F44(0)->dcc_data[1] == 0xD9);      //10
+    ASSERT( TEST.mfAddress7(3).functionF45_F52(0)->dcc_data[1] == 0xDA);
+    ASSERT( TEST.mfAddress7(3).functionF53_F60(0)->dcc_data[1] == 0xDB);
+    
+    p = TEST.mfAddress14(3000).functionF61_F68(0x0F);
+    ASSERT( p == &TEST);
+    ASSERT( TEST.size() == 5);
+    ASSERT( TEST.dcc_data[0] == 0xCB);                //15
+    ASSERT( TEST.dcc_data[1] == 0xB8);
+    ASSERT( TEST.dcc_data[2] == 0xDC);
+    ASSERT( TEST.dcc_data[3] == 0x0F);
+    ASSERT( TEST.dcc_data[4] == 0xA0);
+    ASSERT( TEST.kind() == DCC_KIND_F61_F68);         //20
+
+    p = TEST.mfAddress7(3).binaryState(5, true);
+    ASSERT( p == &TEST);
+    ASSERT( TEST.size() == 4);
+    ASSERT( TEST.repeat() == DCC_REPEAT_FUNCTION);
+    ASSERT( TEST.dcc_data[0] == 0x03);
+    ASSERT( TEST.dcc_data[1] == 0xDD);                //25
+    ASSERT( TEST.dcc_data[2] == 0x85);
+    ASSERT( TEST.dcc_data[3] == 0x5B);
+    ASSERT( TEST.kind() == DCC_KIND_BINARY_STATE_SHORT);
+
+    p = TEST.mfAddress7(3).binaryState(300, false);
+    ASSERT( p == &TEST);
+    ASSERT( TEST.size() == 5);                        //30
+    ASSERT( TEST.dcc_data[0] == 0x03);
+    ASSERT( TEST.dcc_data[1] == 0xC0);
+    ASSERT( TEST.dcc_data[2] == 0x2C);
+    ASSERT( TEST.dcc_data[3] == 0x02);
+    ASSERT( TEST.dcc_data[4] == 0xED);                //35
+    ASSERT( TEST.kind() == DCC_KIND_BINARY_STATE_LONG);
+
+    p = TEST.mfAddress14(3000).binaryState(32767, true);
+    ASSERT( p == &TEST);
+    ASSERT( TEST.size() == 6);
+    ASSERT( TEST.dcc_data[2] == 0xC0);
+    ASSERT( TEST.dcc_data[3] == 0xFF);                //40
+    ASSERT( TEST.dcc_data[4] == 0xFF);
+    ASSERT( TEST.dcc_data[5] == 0xB3);
+
+    //All 32767 states off
+    p = TEST.mfBroadcast().binaryStateLong(0, false);
+    ASSERT( TEST.size() == 5);
+    ASSERT( TEST.dcc_data[1] == 0xC0);
+    ASSERT( TEST.dcc_data[2] == 0x00);                //45
+    ASSERT( TEST.dcc_data[3] == 0x00);
+    ASSERT( TEST.dcc_data[4] == 0xC0);
+
+    DccPacket PARSED;
+    ASSERT( PARSED.parseDccTextCommand("m3G10000001") == &PARSED);
+    ASSERT( memcmp(PARSED.dcc_data, TEST.mfAddress7(3).functionF29_F36(0x81)->dcc_data, 4) == 0);
+    ASSERT( PARSED.parseDccTextCommand("M3000K11110000") == &PARSED);              //50
+    ASSERT( memcmp(PARSED.dcc_data, TEST.mfAddress14(3000).functionF61_F68(0x0F)->dcc_data, 5) == 0);
+    ASSERT( PARSED.parseDccTextCommand("m3S5V1") == &PARSED);
+    ASSERT( memcmp(PARSED.dcc_data, TEST.mfAddress7(3).binaryState(5, true)->dcc_data, 4) == 0);
+    ASSERT( PARSED.parseDccTextCommand("m3S300V0") == &PARSED);
+    ASSERT( memcmp(PARSED.dcc_data, TEST.mfAddress7(3).binaryState(300, false)->dcc_data, 5) == 0);   //55
+    ASSERT( PARSED.parseDccTextCommand("M3000S32767Vy") == &PARSED);
+    ASSERT( PARSED.size() == 6);
+    ASSERT( memcmp(PARSED.dcc_data, TEST.mfAddress14(3000).binaryState(32767, true)->dcc_data, 6) == 0);
+
+    const char* s = "m3S5";
+    ASSERT( PARSED.parseDccText(s) == DCC_PARSE_MISSING_ARGUMENT);
+    s = "m3S32768V1";
+    ASSERT( PARSED.parseDccText(s) == DCC_PARSE_OUT_OF_RANGE);                 //60
+    s = "m3S5X1";
+    ASSERT( PARSED.parseDccText(s) == DCC_PARSE_UNKNOWN_COMMAND);
+    s = "m3H1010101";
+    ASSERT( PARSED.parseDccText(s) == DCC_PARSE_MISSING_ARGUMENT);
+
+    //Group of the function from F0 - F28 bits: F0, F4, F13
+    unsigned long functions = 0x00002011UL;
+    ASSERT( TEST.mfAddress7(3).functionGroup(4, functions) == &TEST);
+    ASSERT( TEST.dcc_data[1] == (DCC_MF_KIND3_F0_F4 | DCC_MF_FUNCTION_F0 | DCC_MF_FUNCTION_F4));
+    ASSERT( TEST.mfAddress7(3).functionGroup(6, functions)->dcc_data[1] == DCC_MF_KIND4_F5_F8);   //65
+    ASSERT( TEST.mfAddress7(3).functionGroup(12, 1UL << 12)->dcc_data[1] == (DCC_MF_KIND4_F9_F12 | DCC_MF_FUNCTION_F12));
+    ASSERT( TEST.mfAddress7(3).functionGroup(13, functions)->dcc_data[1] == DCC_MF_KIND8_F13_F20);
+    ASSERT( TEST.dcc_data[2] == 0x01);
+    ASSERT( TEST.mfAddress7(3).functionGroup(28, 1UL << 28)->dcc_data[1] == DCC_MF_KIND8_F21_F28);
+    ASSERT( TEST.dcc_data[2] == 0x80);                //70
+    ASSERT( TEST.kind() == DCC_KIND_F21_F28);
+}
+
+void DccPacketTest::testCvAccess() {
+    UnitTest::start();
+
+    DccPacket TEST;
+
+    DccPacket* p = TEST.mfAddress7(3).cvWrite(1, 3);
+    ASSERT( p == &TEST);
+    ASSERT( TEST.size() == 5);
+    ASSERT( TEST.repeat() == DCC_REPEAT_CV);
+    ASSERT(!TEST.hasAcknowledge());
+    ASSERT( TEST.dcc_data[0] == 0x03);                //5
+    ASSERT( TEST.dcc_data[1] == 0xEC);
+    ASSERT( TEST.dcc_data[2] == 0x00);
+    ASSERT( TEST.dcc_data[3] == 0x03);
+    ASSERT( TEST.dcc_data[4] == 0xEC);
+    ASSERT( TEST.kind() == DCC_KIND_CV_LONG);         //10
+
+    p = TEST.mfAddress14(3000).cvVerify(1024, 0x55);
+    ASSERT( p == &TEST);
+    ASSERT( TEST.size() == 6);
+    ASSERT( TEST.dcc_data[2] == 0xE7);
+    ASSERT( TEST.dcc_data[3] == 0xFF);
+    ASSERT( TEST.dcc_data[4] == 0x55);                //15
+    ASSERT( TEST.dcc_data[5] == 0x3E);
+
+    p = TEST.mfAddress7(3).cvBitWrite(29, 5, true);
+    ASSERT( p == &TEST);
+    ASSERT( TEST.size() == 5);
+    ASSERT( TEST.dcc_data[1] == 0xE8);
+    ASSERT( TEST.dcc_data[2] == 0x1C);                //20
+    ASSERT( TEST.dcc_data[3] == 0xFD);
+    ASSERT( TEST.dcc_data[4] == 0x0A);
+
+    p = TEST.mfAddress7(3).cvBitVerify(29, 5, false);
+    ASSERT( TEST.dcc_data[1] == 0xE8);
+    ASSERT( TEST.dcc_data[3] == 0xE5);
+
+    DccPacket PARSED;
+    ASSERT( PARSED.parseDccTextCommand("m3W1D3") == &PARSED);                   //25
+    ASSERT( memcmp(PARSED.dcc_data, TEST.mfAddress7(3).cvWrite(1, 3)->dcc_data, 5) == 0);
+    ASSERT( PARSED.repeat() == DCC_REPEAT_CV);
+    ASSERT( PARSED.parseDccTextCommand("M3000V1024D85") == &PARSED);
+    ASSERT( memcmp(PARSED.dcc_data, TEST.mfAddress14(3000).cvVerify(1024, 85)->dcc_data, 6) == 0);
+    ASSERT( PARSED.parseDccTextCommand("m3X29B5D1") == &PARSED);                //30
+    ASSERT( memcmp(PARSED.dcc_data, TEST.mfAddress7(3).cvBitWrite(29, 5, true)->dcc_data, 5) == 0);
+    ASSERT( PARSED.parseDccTextCommand("m3Y29B5D0") == &PARSED);
+    ASSERT( memcmp(PARSED.dcc_data, TEST.mfAddress7(3).cvBitVerify(29, 5, false)->dcc_data, 5) == 0);
+
+    const char* s = "m3W0D3";
+    ASSERT( PARSED.parseDccText(s) == DCC_PARSE_OUT_OF_RANGE);
+    s = "m3W1025D3";
+    ASSERT( PARSED.parseDccText(s) == DCC_PARSE_OUT_OF_RANGE);                  //35
+    s = "m3W1D256";
+    ASSERT( PARSED.parseDccText(s) == DCC_PARSE_OUT_OF_RANGE);
+    s = "m3W1";
+    ASSERT( PARSED.parseDccText(s) == DCC_PARSE_MISSING_ARGUMENT);
+    s = "m3X1B8D1";
+    ASSERT( PARSED.parseDccText(s) == DCC_PARSE_OUT_OF_RANGE);
+    s = "m3X1B7D2";
+    ASSERT( PARSED.parseDccText(s) == DCC_PARSE_OUT_OF_RANGE);
+    s = "m3Y1D1";
+    ASSERT( PARSED.parseDccText(s) == DCC_PARSE_UNKNOWN_COMMAND);              //40
+
+    s = "m3W1D3W2D4";
+    ASSERT( PARSED.parseDccTextAddress(s) == DCC_PARSE_OK);
+    ASSERT( PARSED.parseDccTextMF(s) == DCC_PARSE_OK);
+    ASSERT( *s == 'W');
+    ASSERT( PARSED.parseDccTextMF(s) == DCC_PARSE_OK);
+    ASSERT( *s == '\0');                                                        //45
+    s = "B1P0O0A";
+    ASSERT( PARSED.parseDccTextAddress(s) == DCC_PARSE_UNKNOWN_ADDRESS);
+}
+
 void DccPacketTest::testAccessoryBuilds() {
     UnitTest::start();
 
@@ -876,6 +1067,167 @@ void DccPacketTest::testMultiFunctionBits() {
     ASSERT( TEST.dcc_data[3] == 0x15);
 }
     
+void DccPacketTest::testParsingErrors() {
+    UnitTest::start();
+
+    DccPacket TEST;
+
+    const char* s = "X12f3";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_UNKNOWN_ADDRESS);
+    ASSERT( *s == 'X');
+
+    s = "m12x3";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_UNKNOWN_COMMAND);
+    ASSERT( *s == 'x');
+    
+    s = "m128f3";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_OUT_OF_RANGE);     //5
+    ASSERT( *s == '8');
+
+    s = "M10240f3";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_OUT_OF_RANGE);
+    
+    s = "M10239f31";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_OK);
+    ASSERT( *s == '\0');                                         //10
+    
+    s = "m3f32";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_OUT_OF_RANGE);
+    
+    s = "m3R128";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_OUT_OF_RANGE);
+
+    s = "m3f99999999";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_OUT_OF_RANGE);
+
+    s = "m3D1010";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_MISSING_ARGUMENT);
+    ASSERT( *s == '\0');                                         //15
+
+    s = "m3A10;m3f4";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_MISSING_ARGUMENT);
+    ASSERT( *s == ';');
+
+    s = "m3";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_MISSING_ARGUMENT);
+
+    s = "m3f4x";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_EXTRA_CHARACTERS);
+    ASSERT( *s == 'x');                                          //20
+    
+    s = "m3f4;m3f5";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_OK);
+    ASSERT( *s == ';');
+
+    s = "m3f4\r\n";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_OK);
+    
+    s = "B12P4O1A";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_OUT_OF_RANGE);
+    
+    s = "B12P3O2A";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_OUT_OF_RANGE);    //25
+
+    s = "B12O1A";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_UNKNOWN_COMMAND);
+    
+    s = "B512P0O1A";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_OUT_OF_RANGE);
+
+    s = "B12P0O1";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_MISSING_ARGUMENT);
+    
+    s = "E2048S1";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_OUT_OF_RANGE);
+    
+    s = "E12S32";
+    ASSERT( TEST.parseDccText(s) == DCC_PARSE_OUT_OF_RANGE);    //30
+
+    s = "03FF";
+    ASSERT( TEST.parseDccHex(s) == DCC_PARSE_MISSING_ARGUMENT);
+    
+    s = "03FFx0";
+    ASSERT( TEST.parseDccHex(s) == DCC_PARSE_INVALID_HEX);
+    ASSERT( *s == 'x');
+
+    s = "03FF0000";
+    ASSERT( TEST.parseDccHex(s) == DCC_PARSE_EXTRA_CHARACTERS);
+    
+    s = "03FF00";
+    ASSERT( TEST.parseDccHex(s) == DCC_PARSE_OK);                //35
+    ASSERT( TEST.dcc_data[2] == 0xFF);
+}
+
+// Random and truncated commands should never be read past the terminator,
+// and every accepted command has to produce the packet with valid error byte.
+// Hex commands are marked by the leading H, as in the benchmark.
+static byte parseFuzzCommand(DccPacket& packet, const char*& s) {
+    if (*s == 'H')
+        return packet.parseDccHex(++s);
+    return packet.parseDccText(s);
+}
+
+void DccPacketTest::testParsingFuzz() {
+    UnitTest::start();
+
+    DccPacket TEST;
+
+    const char* valid[] = {
+        "m127f31", "M10239R127", "m3A10101", "M3000E01010101", "B511P3O1A", "E2047S31", 
+        "H03FF00", "H4203FF10", "H80FFEE0102", "HC301020304AA",
+    };
+    
+    char buffer[24];
+    boolean inside = true;
+    boolean checked = true;
+    for (byte v = 0; v < sizeof(valid)/sizeof(valid[0]); ++v) {
+        byte length = strlen(valid[v]);
+        for (byte l = 0; l <= length; ++l) {
+            memcpy(buffer, valid[v], l);
+            buffer[l] = '\0';
+            const char* s = buffer;
+            byte result = parseFuzzCommand(TEST, s);
+            inside  = inside  && (s <= buffer + l);
+            checked = checked && (l < length || result == DCC_PARSE_OK);
+        }
+    }
+    ASSERT( inside);
+    ASSERT( checked);
+    
+    const char textAlphabet[] = "mMBEPOSVWXfrFRABCDEGHIJK0123456789YN;x";
+    const char hexAlphabet[] = "0123456789ABCDEF0123456789ABCDEFa;x";
+    boolean errorByte = true;
+    boolean knownResult = true;
+    word hexAccepted = 0;
+    inside = true;
+    randomSeed(42);
+    for (int i = 0; i < 4000; ++i) {
+        boolean hex = (i & 1);
+        byte length = random(sizeof(buffer));
+        for (byte l = 0; l < length; ++l)
+            buffer[l] = hex ? hexAlphabet[random(sizeof(hexAlphabet) - 1)] : textAlphabet[random(sizeof(textAlphabet) - 1)];
+        buffer[length] = '\0';
+        
+        const char* s = buffer;
+        byte result = hex ? TEST.parseDccHex(s) : TEST.parseDccText(s);
+        inside      = inside && (s <= buffer + length);
+        knownResult = knownResult && (result <= DCC_PARSE_EXTRA_CHARACTERS);
+        if (result != DCC_PARSE_OK)
+            continue;
+            
+        if (hex)
+            ++hexAccepted;
+        byte error = 0;
+        for (byte b = 0; b < TEST.size(); ++b)
+            error ^= TEST.dcc_data[b];
+        errorByte = errorByte && (error == 0);
+    }
+    ASSERT( inside);
+    ASSERT( knownResult);                                       //5
+    ASSERT( errorByte);
+    ASSERT( hexAccepted > 0);
+}
+
 boolean DccPacketTest::testAll() {
     UnitTest::suite("DccPacket");
   
@@ -886,8 +1238,12 @@ boolean DccPacketTest::testAll() {
     
     testMultiFunctionBuilds();
     testMultiFunctionParsing();
+    testExtendedFunctions();
+    testCvAccess();
     testAccessoryBuilds();
     testAccessoryParsing();
+    testParsingErrors();
+    testParsingFuzz();
     
     testMultiFunctionBits();
     
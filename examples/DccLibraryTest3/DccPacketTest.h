@@ -22,8 +22,12 @@ public:
     
     static void testMultiFunctionBuilds();
     static void testMultiFunctionParsing();
+    static void testExtendedFunctions();
+    static void testCvAccess();
     static void testAccessoryBuilds();
     static void testAccessoryParsing();
+    static void testParsingErrors();
+    static void testParsingFuzz();
     
     static void testMultiFunctionBits();
     
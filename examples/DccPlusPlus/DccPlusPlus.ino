@@ -0,0 +1,41 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+ 
+#include <EEPROM.h>
+#include <DccCommander.h>
+#include <DccScheduler.h>
+#include <DccPlusPlus.h>
+
+// DCC++ base station on the USB serial port, for JMRI and the DCC++ / DCC-EX throttles.
+// JMRI connects as "DCC++ Serial Port" at 115200 baud.
+DccPlusPlus dccPlusPlus(Serial);
+
+void serialTask() {
+    dccPlusPlus.loop();
+}
+
+void commanderTask() {
+    DccCmd.loop();
+}
+
+void setup() {
+    Serial.begin(115200);
+
+    DccCmd.begin();
+
+    DccTasks.add(serialTask, 0);
+    DccTasks.add(commanderTask, 0);
+}
+
+
+void loop() {
+    DccTasks.loop();
+}
@@ -11,33 +11,53 @@
  
 #include <EEPROM.h>
 #include <DccCommander.h>
+#include <DccDisassembler.h>
+#include <DccScheduler.h>
+#include <DccLineReader.h>
 
-void processSerialInput() {
-    if (!Serial.available())
+// Enabled by "T1" command
+void tracePacket(DccPacket* packet) {
+    if (packet->isIdle())
         return;
         
-    char buffer[21];
-    if (!Serial.readBytesUntil('\n', buffer, 20))
-        return;    
+    Serial.print("> ");
+    DccDisassembler::print(packet, Serial);
+    Serial.println();
+}
+
+DccLineReader serialLines(Serial);
+
+void processSerialInput() {
+    serialLines.loop();
+
+    char line[DCC_LINE_MAX_SIZE + 1];
+    if (!serialLines.readLine(line))
+        return;
     
-    const char* result = DccCmd.handleTextCommand(buffer); // skip first slash
+    const char* result = DccCmd.handleTextCommand(line, &Serial);
     Serial.println(result);
 }
 
+void commanderTask() {
+    DccCmd.loop();
+}
+
 void setup() {
     Serial.begin(115200);
-    Serial.setTimeout(500); // half a second
 
     Serial.println("Initializing...");
     DccCmd.begin();
+    DccCmd.trace(tracePacket);
+    DccCmd.trace(false);
+
+    DccTasks.add(processSerialInput, 0);
+    DccTasks.add(commanderTask, 0);
     Serial.println("Ready");
 }
 
 
 void loop() {
-    processSerialInput();
-    DccCmd.loop();
-    delay(10); 
+    DccTasks.loop();
 }
 
 
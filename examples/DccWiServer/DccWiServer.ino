@@ -12,6 +12,8 @@
 #include <WiServer.h>
 #include <EEPROM.h>
 #include <DccCommander.h>
+#include <DccScheduler.h>
+#include <DccLineReader.h>
 
 
 extern "C" {
@@ -70,35 +72,42 @@ void Serial_printConnectionState() {
         Serial.println("WiFi: Disconnected");
 }
 
-// This is our page serving function that generates web pages
+// This is our page serving function that generates web pages.
+// One request could carry several commands: "/M3f10/M5F0/U", answered line by line.
 boolean processRequest(char* URL) {
-    const char* result = DccCmd.handleTextCommand(URL+1); // skip first slash
-    if (result == DccCmd.UNKNOWN)
-        return false;
-        
-    WiServer.print(result);
-    return true;
+    return DccCmd.handleTextPipeline(URL, '/', WiServer) > 0;
 }
 
+DccLineReader serialLines(Serial);
+
 void processSerialInput() {
-    if (!Serial.available())
+    serialLines.loop();
+
+    char line[DCC_LINE_MAX_SIZE + 1];
+    if (!serialLines.readLine(line))
         return;
-        
-    char buffer[21];
-    if (!Serial.readBytesUntil('\n', buffer, 20))
-        return;    
     
-    const char* result = DccCmd.handleTextCommand(buffer); // skip first slash
+    const char* result = DccCmd.handleTextCommand(line);
     Serial.println(result);
 }
 
 
 // DCC WiServer app -----------------------------
 
+// WiServer keeps its own timers, polling it on every pass keeps the command latency low
+#define SERVER_TASK_PERIOD_MS (0)
+
+void serverTask() {
+    WiServer.server_task();
+}
+
+void commanderTask() {
+    DccCmd.loop();
+}
+
 
 void setup() {
     Serial.begin(115200);
-    Serial.setTimeout(500); // half a second
 
     Serial.println("Initializing...");
     // Initialize WiServer and have it use the sendMyPage function to serve pages
@@ -109,16 +118,16 @@ void setup() {
     Serial_printConnectionState();
 
     DccCmd.begin();
+
+    DccTasks.add(serverTask, SERVER_TASK_PERIOD_MS);
+    DccTasks.add(processSerialInput, 0);
+    DccTasks.add(commanderTask, 0);
     Serial.println("Ready");
 }
 
 
 void loop() {
-    WiServer.server_task();
-    delay(10); // Don't know why but WiServer Works better.
-    processSerialInput();
-    DccCmd.loop();
-
+    DccTasks.loop();
 }
 
 
@@ -0,0 +1,77 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+ 
+#include <SPI.h>
+#include <Ethernet.h>
+#include <EthernetUdp.h>
+#include <EEPROM.h>
+#include <DccCommander.h>
+#include <DccScheduler.h>
+#include <DccZ21.h>
+
+// Z21 LAN station on the Ethernet shield (pins 10 - 13 for SPI).
+// Throttles and PC software find the station at the IP address below, UDP port 21105.
+byte mac[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0x21 };
+IPAddress ip(192, 168, 1, 111);
+
+// Largest datagram received, several messages could come in one datagram
+#define DATAGRAM_SIZE (128)
+
+EthernetUDP udp;
+
+// Replies and broadcasts go out as one datagram each
+class UdpTransport : public DccZ21Transport {
+public:
+    virtual void send(const byte* address, word port, const byte* data, byte size) {
+        udp.beginPacket(IPAddress(address[0], address[1], address[2], address[3]), port);
+        udp.write(data, size);
+        udp.endPacket();
+    }
+};
+
+UdpTransport transport;
+DccZ21 z21(transport);
+
+// Every waiting datagram is handled, so a burst from many clients doesn't wait for the next loop
+void z21Task() {
+    byte datagram[DATAGRAM_SIZE];
+    while (udp.parsePacket() > 0) {
+        int size = udp.read(datagram, sizeof(datagram));
+        IPAddress remote = udp.remoteIP();
+        byte address[4] = { remote[0], remote[1], remote[2], remote[3] };
+        if (size > 0)
+            z21.receive(address, udp.remotePort(), datagram, size);
+    }
+    z21.loop();
+}
+
+void commanderTask() {
+    DccCmd.loop();
+}
+
+void setup() {
+    Serial.begin(115200);
+
+    Serial.println("Initializing...");
+    Ethernet.begin(mac, ip);
+    udp.begin(DCC_Z21_PORT);
+
+    DccCmd.begin();
+
+    DccTasks.add(z21Task, 0);
+    DccTasks.add(commanderTask, 0);
+    Serial.println("Ready");
+}
+
+
+void loop() {
+    DccTasks.loop();
+}
@@ -0,0 +1,357 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#include <stdio.h>
+#include <time.h>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <Wire.h>
+#include <UnitTest.h>
+
+// Sketch entry points
+void setup();
+
+//+----------------------------------------------------+
+//| Arduino core                                       |
+//+----------------------------------------------------+
+
+static unsigned long delayed_us = 0;
+
+static unsigned long long clockMicros() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static unsigned long long start_us = clockMicros();
+
+// Output pins keep the written value
+static uint8_t pins[64];
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+	pins[pin % sizeof(pins)] = value;
+}
+
+int digitalRead(uint8_t pin) {
+	return pins[pin % sizeof(pins)];
+}
+
+unsigned long micros() {
+	return (unsigned long) (clockMicros() - start_us) + delayed_us;
+}
+
+unsigned long millis() {
+	return micros() / 1000;
+}
+
+void delay(unsigned long ms) {
+	delayed_us += ms * 1000;
+}
+
+void noInterrupts() {
+}
+
+void interrupts() {
+}
+
+long random(long max) {
+	return max > 0 ? rand() % max : 0;
+}
+
+long random(long min, long max) {
+	return max > min ? min + rand() % (max - min) : min;
+}
+
+void randomSeed(unsigned long seed) {
+	srand(seed);
+}
+
+size_t Print::write(const char* s) {
+	size_t count = 0;
+	while (*s)
+		count += write((uint8_t) *s++);
+	return count;
+}
+
+size_t Print::print(const char* s) {
+	return write(s);
+}
+
+size_t Print::print(char c) {
+	return write((uint8_t) c);
+}
+
+size_t Print::print(unsigned long value, int base) {
+	char buffer[33];
+	char* s = buffer + sizeof(buffer) - 1;
+	*s = '\0';
+	do {
+		byte digit = value % base;
+		*--s = (digit < 10) ? '0' + digit : 'A' + digit - 10;
+		value /= base;
+	} while (value);
+	return write(s);
+}
+
+size_t Print::print(long value, int base) {
+	if (value < 0 && base == DEC)
+		return write('-') + print((unsigned long) -value, base);
+	return print((unsigned long) value, base);
+}
+
+size_t Print::print(unsigned int value, int base) {
+	return print((unsigned long) value, base);
+}
+
+size_t Print::print(int value, int base) {
+	return print((long) value, base);
+}
+
+size_t Print::print(unsigned char value, int base) {
+	return print((unsigned long) value, base);
+}
+
+size_t Print::println() {
+	return write("\r\n");
+}
+
+size_t Print::println(const char* s) {
+	return print(s) + println();
+}
+
+size_t Print::println(char c) {
+	return print(c) + println();
+}
+
+size_t Print::println(unsigned long value, int base) {
+	return print(value, base) + println();
+}
+
+size_t Print::println(long value, int base) {
+	return print(value, base) + println();
+}
+
+size_t Print::println(unsigned int value, int base) {
+	return print(value, base) + println();
+}
+
+size_t Print::println(int value, int base) {
+	return print(value, base) + println();
+}
+
+HostSerial Serial;
+
+void HostSerial::begin(unsigned long baud) {
+}
+
+void HostSerial::setTimeout(unsigned long ms) {
+}
+
+int HostSerial::available() {
+	return feof(stdin) ? 0 : 1;
+}
+
+int HostSerial::read() {
+	return getchar();
+}
+
+size_t HostSerial::readBytesUntil(char terminator, char* buffer, size_t length) {
+	size_t count = 0;
+	while (count < length) {
+		int c = getchar();
+		if (c == EOF || c == terminator)
+			break;
+		buffer[count++] = c;
+	}
+	return count;
+}
+
+size_t HostSerial::write(uint8_t c) {
+	return fputc(c, stdout) == EOF ? 0 : 1;
+}
+
+//+----------------------------------------------------+
+//| EEPROM, erased                                     |
+//+----------------------------------------------------+
+
+static uint8_t eeprom[HOST_EEPROM_SIZE];
+
+static class EEPROMErase {
+public:
+	EEPROMErase() { memset(eeprom, 0xFF, sizeof(eeprom)); }
+} eepromErase;
+
+EEPROMClass EEPROM;
+
+uint8_t EEPROMClass::read(int address) {
+	++reads;
+	return eeprom[address % HOST_EEPROM_SIZE];
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+	++writes;
+	eeprom[address % HOST_EEPROM_SIZE] = value;
+}
+
+void EEPROMClass::update(int address, uint8_t value) {
+	if (read(address) != value)
+		write(address, value);
+}
+
+uint16_t EEPROMClass::length() {
+	return HOST_EEPROM_SIZE;
+}
+
+//+----------------------------------------------------+
+//| Wire, FRAM on the bus                              |
+//+----------------------------------------------------+
+
+TwoWire Wire;
+
+TwoWire::TwoWire() {
+	memset(memory, 0xFF, sizeof(memory));
+	address = 0;
+	addressBytes = 0;
+	transmitted = 0;
+	receivedCount = receivedNext = 0;
+}
+
+void TwoWire::begin() {
+}
+
+void TwoWire::beginTransmission(byte device) {
+	addressBytes = 0;
+	transmitted = 0;
+}
+
+size_t TwoWire::write(byte data) {
+	if (transmitted == BUFFER_LENGTH)
+		return 0;
+	++transmitted;
+	if (addressBytes < 2) {
+		address = (address << 8) | data;
+		++addressBytes;
+	} else {
+		memory[address++] = data;
+	}
+	return 1;
+}
+
+size_t TwoWire::write(const byte* data, size_t count) {
+	size_t written = 0;
+	for (size_t i = 0; i < count; ++i)
+		written += write(data[i]);
+	return written;
+}
+
+byte TwoWire::endTransmission(boolean stop) {
+	return 0;
+}
+
+byte TwoWire::requestFrom(byte device, byte count) {
+	if (count > BUFFER_LENGTH)
+		count = BUFFER_LENGTH;
+	for (byte i = 0; i < count; ++i)
+		received[i] = memory[address++];
+	receivedCount = count;
+	receivedNext = 0;
+	return count;
+}
+
+int TwoWire::available() {
+	return receivedCount - receivedNext;
+}
+
+int TwoWire::read() {
+	return receivedNext < receivedCount ? received[receivedNext++] : -1;
+}
+
+//+----------------------------------------------------+
+//| UnitTest                                           |
+//+----------------------------------------------------+
+
+static const char*	suiteName = "";
+static int			suiteAsserts = 0;
+static int			suiteFailures = 0;
+static int			testNumber = 0;
+static int			assertNumber = 0;
+static int			totalFailures = 0;
+
+void UnitTest::suite(const char* name) {
+	suiteName = name;
+	suiteAsserts = suiteFailures = testNumber = 0;
+}
+
+void UnitTest::start() {
+	++testNumber;
+	assertNumber = 0;
+}
+
+void UnitTest::check(boolean condition, const char* text, const char* file, int line) {
+	++suiteAsserts;
+	++assertNumber;
+	if (condition)
+		return;
+	++suiteFailures;
+	++totalFailures;
+	printf("FAIL %s test %d assert %d: %s (%s:%d)\n", suiteName, testNumber, assertNumber, text, file, line);
+}
+
+boolean UnitTest::report() {
+	printf("%s: %d asserts, %d failures\n", suiteName, suiteAsserts, suiteFailures);
+	return suiteFailures == 0;
+}
+
+boolean UnitTest::bits_in_mask(byte bits, byte mask) {
+	return (bits & ~mask) == 0;
+}
+
+boolean UnitTest::unique_bits(const byte* masks, byte count) {
+	byte all = 0;
+	for (byte i = 0; i < count; ++i) {
+		if (all & masks[i])
+			return false;
+		all |= masks[i];
+	}
+	return true;
+}
+
+boolean UnitTest::unique_values(const byte* values, byte count) {
+	for (byte i = 0; i < count; ++i) {
+		for (byte j = i + 1; j < count; ++j) {
+			if (values[i] == values[j])
+				return false;
+		}
+	}
+	return true;
+}
+
+boolean UnitTest::ordered_values(const byte* values, byte count) {
+	for (byte i = 1; i < count; ++i) {
+		if (values[i - 1] > values[i])
+			return false;
+	}
+	return true;
+}
+
+//+----------------------------------------------------+
+//| Sketch runs setup() once, fails on failed asserts  |
+//+----------------------------------------------------+
+
+int main() {
+	setup();
+	fflush(stdout);
+	return totalFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#ifndef __DCC_HOST_ARDUINO_H__
+#define __DCC_HOST_ARDUINO_H__
+
+// Arduino core stand-in for the host build. Only the part used by the library,
+// the test sketches and the benchmark sketch is provided.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef uint8_t		byte;
+typedef uint16_t	word;
+typedef bool		boolean;
+
+#define HIGH		(1)
+#define LOW			(0)
+#define INPUT		(0)
+#define OUTPUT		(1)
+
+#define DEC			(10)
+#define HEX			(16)
+
+// Last EEPROM address of the ATmega328P, as in <avr/io.h>
+#define E2END		(0x3FF)
+
+#define PROGMEM
+#define pgm_read_byte(p)	(*(const uint8_t*)(p))
+#define pgm_read_word(p)	(*(const uint16_t*)(p))
+
+void			pinMode(uint8_t pin, uint8_t mode);
+void			digitalWrite(uint8_t pin, uint8_t value);
+int				digitalRead(uint8_t pin);
+
+// Clock runs in the real time. delay() doesn't sleep, it moves the clock forward.
+unsigned long	millis();
+unsigned long	micros();
+void			delay(unsigned long ms);
+
+void			noInterrupts();
+void			interrupts();
+
+long			random(long max);
+long			random(long min, long max);
+void			randomSeed(unsigned long seed);
+
+class Print {
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+
+	size_t write(const char* s);
+	size_t print(const char* s);
+	size_t print(char c);
+	size_t print(unsigned long value, int base = DEC);
+	size_t print(long value, int base = DEC);
+	size_t print(unsigned int value, int base = DEC);
+	size_t print(int value, int base = DEC);
+	size_t print(unsigned char value, int base = DEC);
+	size_t println();
+	size_t println(const char* s);
+	size_t println(char c);
+	size_t println(unsigned long value, int base = DEC);
+	size_t println(long value, int base = DEC);
+	size_t println(unsigned int value, int base = DEC);
+	size_t println(int value, int base = DEC);
+};
+
+class Stream : public Print {
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+};
+
+// Writes to the standard output, reads from the standard input
+class HostSerial : public Stream {
+public:
+	void	begin(unsigned long baud);
+	void	setTimeout(unsigned long ms);
+	virtual int available();
+	virtual int read();
+	size_t	readBytesUntil(char terminator, char* buffer, size_t length);
+	size_t	write(uint8_t c);
+};
+
+extern HostSerial Serial;
+
+#endif //__DCC_HOST_ARDUINO_H__
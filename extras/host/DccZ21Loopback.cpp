@@ -0,0 +1,254 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+// Z21 LAN front end over real UDP sockets of the loopback interface.
+// Station socket is bound to 127.0.0.1 on a free port, every client is a socket of its own.
+
+#include <Arduino.h>
+#include <UnitTest.h>
+#include <DccCommander.h>
+#include <DccZ21.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+// Sends the replies from the station socket
+class UdpTransport : public DccZ21Transport {
+public:
+	int socket;
+
+	virtual void send(const byte* address, word port, const byte* data, byte size) {
+		sockaddr_in to;
+		memset(&to, 0, sizeof(to));
+		to.sin_family = AF_INET;
+		to.sin_port = htons(port);
+		memcpy(&to.sin_addr, address, 4);
+		sendto(socket, data, size, 0, (sockaddr*) &to, sizeof(to));
+	}
+};
+
+UdpTransport transport;
+DccZ21 z21(transport);
+sockaddr_in station;
+
+static int openSocket(sockaddr_in& bound) {
+	int s = ::socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&bound, 0, sizeof(bound));
+	bound.sin_family = AF_INET;
+	bound.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(s, (sockaddr*) &bound, sizeof(bound));
+	socklen_t length = sizeof(bound);
+	getsockname(s, (sockaddr*) &bound, &length);
+	return s;
+}
+
+// Returns the datagram size, 0 when nothing comes in 200ms
+static int receive(int s, byte* data, int size, sockaddr_in* from) {
+	pollfd fd = { s, POLLIN, 0 };
+	if (poll(&fd, 1, 200) <= 0)
+		return 0;
+	socklen_t length = sizeof(sockaddr_in);
+	int received = recvfrom(s, data, size, 0, (sockaddr*) from, from ? &length : NULL);
+	return received < 0 ? 0 : received;
+}
+
+// Client sends the datagram, the station handles all the datagrams received
+static void send(int client, const byte* data, int size) {
+	sendto(client, data, size, 0, (sockaddr*) &station, sizeof(station));
+
+	byte datagram[256];
+	sockaddr_in from;
+	int received;
+	while ((received = receive(transport.socket, datagram, sizeof(datagram), &from)) > 0) {
+		z21.receive((const byte*) &from.sin_addr, ntohs(from.sin_port), datagram, received);
+		pollfd fd = { transport.socket, POLLIN, 0 };
+		if (poll(&fd, 1, 0) <= 0)
+			break;
+	}
+}
+
+static boolean expect(int client, const byte* expected, int size) {
+	byte data[256];
+	int received = receive(client, data, sizeof(data), NULL);
+	return received == size && memcmp(data, expected, size) == 0;
+}
+
+static boolean expectNothing(int client) {
+	byte data[256];
+	return receive(client, data, sizeof(data), NULL) == 0;
+}
+
+static const byte GET_SERIAL_NUMBER[] 	= { 0x04, 0x00, 0x10, 0x00 };
+static const byte SERIAL_NUMBER[] 		= { 0x08, 0x00, 0x10, 0x00, 0x00, 0x00, 0x01, 0x00 };
+static const byte SET_BROADCASTFLAGS[] 	= { 0x08, 0x00, 0x50, 0x00, 0x01, 0x00, 0x00, 0x00 };
+static const byte GET_BROADCASTFLAGS[] 	= { 0x04, 0x00, 0x51, 0x00 };
+static const byte BROADCASTFLAGS[] 		= { 0x08, 0x00, 0x51, 0x00, 0x01, 0x00, 0x00, 0x00 };
+static const byte LOGOFF[] 				= { 0x04, 0x00, 0x30, 0x00 };
+
+// LAN_X_GET_VERSION and LAN_X_GET_STATUS in one datagram, replies come in one datagram too
+static const byte GET_VERSION_STATUS[] 	= { 0x07, 0x00, 0x40, 0x00, 0x21, 0x21, 0x00,
+											0x07, 0x00, 0x40, 0x00, 0x21, 0x24, 0x05 };
+static const byte VERSION_STATUS[] 		= { 0x09, 0x00, 0x40, 0x00, 0x63, 0x21, 0x30, 0x12, 0x60,
+											0x08, 0x00, 0x40, 0x00, 0x62, 0x22, 0x00, 0x40 };
+
+static const byte POWER_OFF[] 			= { 0x07, 0x00, 0x40, 0x00, 0x21, 0x80, 0xA1 };
+static const byte POWER_ON[] 			= { 0x07, 0x00, 0x40, 0x00, 0x21, 0x81, 0xA0 };
+static const byte BC_POWER_OFF[] 		= { 0x07, 0x00, 0x40, 0x00, 0x61, 0x00, 0x61 };
+static const byte BC_POWER_ON[] 		= { 0x07, 0x00, 0x40, 0x00, 0x61, 0x01, 0x60 };
+
+// Locomotive 3, 128 steps, forward 50
+static const byte DRIVE_3[] 			= { 0x0A, 0x00, 0x40, 0x00, 0xE4, 0x13, 0x00, 0x03, 0xB2, 0x46 };
+static const byte LOCO_INFO_3[] 		= { 0x0E, 0x00, 0x40, 0x00, 0xEF, 0x00, 0x03, 0x04, 0xB2, 0x00, 0x00, 0x00, 0x00, 0x5A };
+// Toggle F0 and switch F13 on
+static const byte TOGGLE_F0_3[] 		= { 0x0A, 0x00, 0x40, 0x00, 0xE4, 0xF8, 0x00, 0x03, 0x80, 0x9F };
+static const byte F0_INFO_3[] 			= { 0x0E, 0x00, 0x40, 0x00, 0xEF, 0x00, 0x03, 0x04, 0xB2, 0x10, 0x00, 0x00, 0x00, 0x4A };
+static const byte SET_F13_3[] 			= { 0x0A, 0x00, 0x40, 0x00, 0xE4, 0xF8, 0x00, 0x03, 0x4D, 0x52 };
+static const byte F13_INFO_3[] 			= { 0x0E, 0x00, 0x40, 0x00, 0xEF, 0x00, 0x03, 0x04, 0xB2, 0x10, 0x00, 0x01, 0x00, 0x4B };
+static const byte GET_LOCO_INFO_3[] 	= { 0x09, 0x00, 0x40, 0x00, 0xE3, 0xF0, 0x00, 0x03, 0x10 };
+
+// Locomotive 1234 (long address), 28 steps, reverse step 1
+static const byte DRIVE_1234[] 			= { 0x0A, 0x00, 0x40, 0x00, 0xE4, 0x12, 0xC4, 0xD2, 0x02, 0xE2 };
+static const byte LOCO_INFO_1234[] 		= { 0x0E, 0x00, 0x40, 0x00, 0xEF, 0xC4, 0xD2, 0x02, 0x02, 0x00, 0x00, 0x00, 0x00, 0xF9 };
+
+// Turnout of function address 5 (decoder 2, port 1), output 1
+static const byte SET_TURNOUT_5[] 		= { 0x09, 0x00, 0x40, 0x00, 0x53, 0x00, 0x05, 0x89, 0xDF };
+static const byte TURNOUT_INFO_5[] 		= { 0x09, 0x00, 0x40, 0x00, 0x43, 0x00, 0x05, 0x02, 0x44 };
+static const byte GET_TURNOUT_INFO_6[] 	= { 0x08, 0x00, 0x40, 0x00, 0x43, 0x00, 0x06, 0x45 };
+static const byte TURNOUT_INFO_6[] 		= { 0x09, 0x00, 0x40, 0x00, 0x43, 0x00, 0x06, 0x00, 0x45 };
+
+static const byte UNKNOWN[] 			= { 0x07, 0x00, 0x40, 0x00, 0x21, 0x99, 0xB8 };
+static const byte UNKNOWN_COMMAND[] 	= { 0x07, 0x00, 0x40, 0x00, 0x61, 0x82, 0xE3 };
+static const byte BAD_CHECKSUM[] 		= { 0x07, 0x00, 0x40, 0x00, 0x21, 0x21, 0x01 };
+
+static int throttle;
+static int tablet;
+
+void testClient() {
+	UnitTest::start();
+
+	send(throttle, GET_SERIAL_NUMBER, sizeof(GET_SERIAL_NUMBER));
+	ASSERT(expect(throttle, SERIAL_NUMBER, sizeof(SERIAL_NUMBER)));
+	ASSERT(z21.clientCount() == 1);
+
+	send(throttle, SET_BROADCASTFLAGS, sizeof(SET_BROADCASTFLAGS));
+	ASSERT(expectNothing(throttle));
+	send(throttle, GET_BROADCASTFLAGS, sizeof(GET_BROADCASTFLAGS));
+	ASSERT(expect(throttle, BROADCASTFLAGS, sizeof(BROADCASTFLAGS)));
+
+	send(throttle, GET_VERSION_STATUS, sizeof(GET_VERSION_STATUS));
+	ASSERT(expect(throttle, VERSION_STATUS, sizeof(VERSION_STATUS)));					//5
+
+	send(throttle, UNKNOWN, sizeof(UNKNOWN));
+	ASSERT(expect(throttle, UNKNOWN_COMMAND, sizeof(UNKNOWN_COMMAND)));
+	send(throttle, BAD_CHECKSUM, sizeof(BAD_CHECKSUM));
+	ASSERT(expectNothing(throttle));
+}
+
+void testLoco() {
+	UnitTest::start();
+
+	// Tablet is not subscribed, it gets the replies only
+	send(tablet, DRIVE_3, sizeof(DRIVE_3));
+	ASSERT(expect(tablet, LOCO_INFO_3, sizeof(LOCO_INFO_3)));
+	ASSERT(expect(throttle, LOCO_INFO_3, sizeof(LOCO_INFO_3)));
+	ASSERT(z21.clientCount() == 2);
+
+	send(throttle, TOGGLE_F0_3, sizeof(TOGGLE_F0_3));
+	ASSERT(expect(throttle, F0_INFO_3, sizeof(F0_INFO_3)));
+	ASSERT(expectNothing(tablet));														//5
+
+	send(tablet, SET_F13_3, sizeof(SET_F13_3));
+	ASSERT(expect(tablet, F13_INFO_3, sizeof(F13_INFO_3)));
+	ASSERT(expect(throttle, F13_INFO_3, sizeof(F13_INFO_3)));
+
+	send(tablet, GET_LOCO_INFO_3, sizeof(GET_LOCO_INFO_3));
+	ASSERT(expect(tablet, F13_INFO_3, sizeof(F13_INFO_3)));
+	ASSERT(expectNothing(throttle));
+
+	send(throttle, DRIVE_1234, sizeof(DRIVE_1234));
+	ASSERT(expect(throttle, LOCO_INFO_1234, sizeof(LOCO_INFO_1234)));					//10
+}
+
+void testTurnout() {
+	UnitTest::start();
+
+	send(tablet, SET_TURNOUT_5, sizeof(SET_TURNOUT_5));
+	ASSERT(expect(tablet, TURNOUT_INFO_5, sizeof(TURNOUT_INFO_5)));
+	ASSERT(expect(throttle, TURNOUT_INFO_5, sizeof(TURNOUT_INFO_5)));
+
+	send(tablet, GET_TURNOUT_INFO_6, sizeof(GET_TURNOUT_INFO_6));
+	ASSERT(expect(tablet, TURNOUT_INFO_6, sizeof(TURNOUT_INFO_6)));
+}
+
+void testPower() {
+	UnitTest::start();
+
+	send(tablet, POWER_OFF, sizeof(POWER_OFF));
+	ASSERT(expect(tablet, BC_POWER_OFF, sizeof(BC_POWER_OFF)));
+	ASSERT(expect(throttle, BC_POWER_OFF, sizeof(BC_POWER_OFF)));
+	ASSERT(!DccCmd.power());
+
+	// Power changed by the text command is broadcast from loop()
+	DccCmd.handleTextCommand("P1");
+	z21.loop();
+	ASSERT(expect(throttle, BC_POWER_ON, sizeof(BC_POWER_ON)));
+	ASSERT(expectNothing(tablet));														//5
+
+	send(tablet, POWER_ON, sizeof(POWER_ON));
+	ASSERT(expect(tablet, BC_POWER_ON, sizeof(BC_POWER_ON)));
+	ASSERT(expect(throttle, BC_POWER_ON, sizeof(BC_POWER_ON)));
+}
+
+void testLogoff() {
+	UnitTest::start();
+
+	send(throttle, LOGOFF, sizeof(LOGOFF));
+	ASSERT(z21.clientCount() == 1);
+
+	send(tablet, DRIVE_3, sizeof(DRIVE_3));
+	ASSERT(expect(tablet, F13_INFO_3, sizeof(F13_INFO_3)));
+	ASSERT(expectNothing(throttle));
+
+	// Silent client is forgotten
+	delay(DCC_Z21_CLIENT_TIMEOUT_MS);
+	z21.loop();
+	ASSERT(z21.clientCount() == 0);
+}
+
+void setup() {
+	UnitTest::suite("DccZ21Loopback");
+
+	DccCmd.begin();
+	z21.loop();
+
+	transport.socket = openSocket(station);
+	sockaddr_in bound;
+	throttle = openSocket(bound);
+	tablet = openSocket(bound);
+
+	testClient();
+	testLoco();
+	testTurnout();
+	testPower();
+	testLogoff();
+
+	UnitTest::report();
+
+	close(throttle);
+	close(tablet);
+	close(transport.socket);
+}
+
+void loop() {
+}
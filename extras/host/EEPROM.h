@@ -0,0 +1,35 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#ifndef __DCC_HOST_EEPROM_H__
+#define __DCC_HOST_EEPROM_H__
+
+#include <Arduino.h>
+
+// ATmega328 size
+#define HOST_EEPROM_SIZE	(E2END + 1)
+
+// EEPROM stand-in, counts the operations for the benchmark
+class EEPROMClass {
+public:
+	unsigned long	reads;
+	unsigned long	writes;
+
+public:
+	uint8_t		read(int address);
+	void		write(int address, uint8_t value);
+	void		update(int address, uint8_t value);
+	uint16_t	length();
+};
+
+extern EEPROMClass EEPROM;
+
+#endif //__DCC_HOST_EEPROM_H__
@@ -0,0 +1,34 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#ifndef __DCC_HOST_UNIT_TEST_H__
+#define __DCC_HOST_UNIT_TEST_H__
+
+#include <Arduino.h>
+
+// UnitTest library stand-in. Failed asserts are printed with the file and line,
+// every suite prints one line: <suite>: <asserts> asserts, <failures> failures
+#define ASSERT(condition)	UnitTest::check((condition), #condition, __FILE__, __LINE__)
+
+class UnitTest {
+public:
+	static void		suite(const char* name);
+	static void		start();
+	static void		check(boolean condition, const char* text, const char* file, int line);
+	static boolean	report();
+
+	static boolean	bits_in_mask(byte bits, byte mask);
+	static boolean	unique_bits(const byte* masks, byte count);
+	static boolean	unique_values(const byte* values, byte count);
+	static boolean	ordered_values(const byte* values, byte count);
+};
+
+#endif //__DCC_HOST_UNIT_TEST_H__
@@ -0,0 +1,47 @@
+/**
+ ** This is Public Domain Software.
+ ** 
+ ** The author disclaims copyright to this source code.  
+ ** In place of a legal notice, here is a blessing:
+ **
+ **    May you do good and not evil.
+ **    May you find forgiveness for yourself and forgive others.
+ **    May you share freely, never taking more than you give.
+ **/
+
+#ifndef __DCC_HOST_WIRE_H__
+#define __DCC_HOST_WIRE_H__
+
+#include <Arduino.h>
+
+#define BUFFER_LENGTH		(32)
+
+// I2C stand-in with a 64KB FRAM on every device address.
+// The first two bytes written in a transmission are the memory address.
+// As the Arduino Wire, a transmission holds up to BUFFER_LENGTH bytes, the others are dropped.
+class TwoWire {
+private:
+	byte	memory[0x10000];
+	word	address;
+	byte	addressBytes;
+	byte	transmitted;
+	byte	received[BUFFER_LENGTH];
+	byte	receivedCount;
+	byte	receivedNext;
+
+public:
+	TwoWire();
+
+	void	begin();
+	void	beginTransmission(byte device);
+	size_t	write(byte data);
+	size_t	write(const byte* data, size_t count);
+	byte	endTransmission(boolean stop = true);
+	byte	requestFrom(byte device, byte count);
+	int		available();
+	int		read();
+};
+
+extern TwoWire Wire;
+
+#endif //__DCC_HOST_WIRE_H__